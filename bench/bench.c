@@ -0,0 +1,404 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../includes/memory.h"
+#include "../includes/natives.h"
+#include "../includes/vm.h"
+
+#include <stdarg.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// make bench: generates every workload from a fixed seed, so the same commit always runs the same
+// scripts, and prints one json object per workload:
+//   compile_ms / run_ms    best of --repeat runs, compile_program() and run_program() apart
+//   instructions           counted in one extra profiled run, instructions_per_sec uses run_ms
+//   scan_ms / codegen_ms   the compile split up by the vm's phase timers (--stats), same extra run
+//   peak_rss_kb            each workload runs in its own process so this is its own high water mark
+
+#define BENCH_SEED 0x9e3779b97f4a7c15ull
+#define BENCH_REPEAT 5
+
+// ------------------------ Source generation ------------------------ //
+
+typedef struct {
+    char *data;
+    int count;
+    int capacity;
+} Source_t;
+
+static uint64_t rng_state;
+
+static uint64_t next_random() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static int random_below(int bound) {
+    return (int)(next_random() % (uint64_t)bound);
+}
+
+static void append(Source_t *source, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (source->count + length + 1 > source->capacity) {
+        while (source->count + length + 1 > source->capacity) {
+            source->capacity = grow_capacity(source->capacity);
+        }
+        source->data = resize(source->data, sizeof(char), source->capacity);
+    }
+    va_start(args, format);
+    vsnprintf(source->data + source->count, length + 1, format, args);
+    va_end(args);
+    source->count += length;
+}
+
+// many globals, most statements read two and overwrite a third
+static void gen_global_churn(Source_t *source, int size) {
+    int num_globals = 1000;
+    for (int i = 0; i < num_globals; i++) {
+        append(source, "let g%d = %d;\n", i, i);
+    }
+    for (int i = 0; i < size; i++) {
+        append(source, "g%d = g%d + g%d;\n", random_below(num_globals), random_below(num_globals),
+               random_below(num_globals));
+    }
+    append(source, "print g0;\n");
+}
+
+// long left to right chains over a few globals and literals
+static void gen_arith_chain(Source_t *source, int size) {
+    static const char *ops[] = {"+", "-", "*", "/"};
+    append(source, "let a = 1.5;\nlet b = 2;\nlet c = 0.25;\n");
+    for (int i = 0; i < size / 64; i++) {
+        append(source, "print a");
+        for (int j = 0; j < 64; j++) {
+            const char *operand = j % 3 == 0 ? "b" : j % 3 == 1 ? "c" : "3";
+            append(source, " %s %s", ops[random_below(4)], operand);
+        }
+        append(source, ";\n");
+    }
+}
+
+// strings that keep growing, every concatenation allocates and interns a new one
+static void gen_string_concat(Source_t *source, int size) {
+    append(source, "let s = \"\";\nlet t = \"x\";\n");
+    for (int i = 0; i < size; i++) {
+        if (i % 512 == 0) {
+            append(source, "s = \"\";\n");
+        }
+        append(source, "s = s + \"ab%d\" + t;\n", random_below(100));
+    }
+    append(source, "print s;\n");
+}
+
+// parentheses and unary minus nested a few hundred levels, alternating operators
+static void gen_deep_nesting(Source_t *source, int size) {
+    int depth = 200;
+    for (int i = 0; i < size / depth; i++) {
+        append(source, "print ");
+        for (int j = 0; j < depth; j++) {
+            append(source, j % 2 == 0 ? "%d + (" : "-(%d * (", random_below(10));
+        }
+        append(source, "1");
+        for (int j = 0; j < depth; j++) {
+            append(source, j % 2 == 0 ? ")" : "))");
+        }
+        append(source, ";\n");
+    }
+}
+
+// every literal distinct, so the constant pool gets as big as the program
+static void gen_literal_pool(Source_t *source, int size) {
+    for (int i = 0; i < size; i++) {
+        if (i % 2 == 0) {
+            append(source, "print %d.%d;\n", i, random_below(1000));
+        } else {
+            append(source, "print \"lit%d_%d\";\n", i, random_below(1000));
+        }
+    }
+}
+
+// one long while loop reading a few globals it never writes, the rest of the time is the loop body
+static void gen_counting_loop(Source_t *source, int size) {
+    append(source, "let i = 0;\nlet total = 0;\nlet step = %d;\nlet scale = 3;\n",
+           random_below(9) + 1);
+    append(source, "while (i < %d) {\n    total = total + step * scale - i;\n    i = i + 1;\n}\n",
+           size);
+    append(source, "print total;\n");
+}
+
+// a loop over a filter of and / or clauses, most rows are decided by the first one or two
+static void gen_filter_loop(Source_t *source, int size) {
+    append(source, "let n = 0;\nlet i = 0;\nlet hits = 0;\nlet lo = %d;\nlet hi = %d;\n",
+           random_below(10), 90 + random_below(10));
+    append(source, "while (n < %d) {\n", size);
+    append(source, "    if (i > lo and i < hi and (i * 3 - 7) * 2 > lo or i == %d) {\n",
+           random_below(100));
+    append(source, "        hits = hits + 1;\n    }\n");
+    append(source, "    n = n + 1;\n    i = i + 1;\n    if (i == 100) i = 0;\n}\nprint hits;\n");
+}
+
+// recursive fib for the cost of calls and returns, then a tail recursive count in a single frame
+static void gen_calls(Source_t *source, int size) {
+    append(source, "func fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }\n");
+    append(source,
+           "func count(n, acc) { if (n == 0) return acc; return count(n - 1, acc + %d); }\n",
+           random_below(9) + 1);
+    append(source, "let i = 0;\nlet total = 0;\nwhile (i < %d) {\n", size / 1000);
+    append(source, "    total = total + fib(15);\n    i = i + 1;\n}\n");
+    append(source, "print total;\nprint count(%d, 0);\n", size);
+}
+
+// the same sum of square roots and clamps twice: written in the language, then with the builtins
+static void gen_math(Source_t *source, int size, bool native) {
+    if (native) {
+        append(source, "func term(x) { return sqrt(x) + max(min(x, 500), 20) + abs(x - 700); }\n");
+    } else {
+        append(source, "func root(x) {\n    let g = x / 2 + 1;\n");
+        append(source, "    for (let k = 0; k < 12; k = k + 1) { g = (g + x / g) / 2; }\n");
+        append(source, "    return g;\n}\n");
+        append(source, "func most(a, b) { if (a > b) return a; return b; }\n");
+        append(source, "func least(a, b) { if (a < b) return a; return b; }\n");
+        append(source, "func magnitude(a) { if (a < 0) return -a; return a; }\n");
+        append(source,
+               "func term(x) { return root(x) + most(least(x, 500), 20) + magnitude(x - 700); }\n");
+    }
+    append(source, "let i = 1;\nlet total = 0;\n");
+    append(source, "while (i <= %d) {\n    total = total + term(i);\n    i = i + 1;\n}\n", size);
+    append(source, "print total;\n");
+}
+
+static void gen_math_scripted(Source_t *source, int size) {
+    gen_math(source, size, false);
+}
+
+static void gen_math_native(Source_t *source, int size) {
+    gen_math(source, size, true);
+}
+
+// ------------------------ Workloads ------------------------ //
+
+typedef void (*Generator_t)(Source_t *source, int size);
+
+typedef struct {
+    const char *name;
+    Generator_t generate;
+    int size;  // statements generated (before --scale)
+    int lines; // > 0: split into inputs of this many lines, compiled and run one by one
+} Workload_t;
+
+// repl_small reuses the global churn script, fed a line at a time like the repl does
+static const Workload_t workloads[] = {
+    {"global_churn", gen_global_churn, 200000, 0},
+    {"arith_chain", gen_arith_chain, 200000, 0},
+    {"string_concat", gen_string_concat, 50000, 0},
+    {"deep_nesting", gen_deep_nesting, 100000, 0},
+    {"literal_pool", gen_literal_pool, 100000, 0},
+    {"repl_small", gen_global_churn, 50000, 1},
+    {"counting_loop", gen_counting_loop, 2000000, 0},
+    {"filter_loop", gen_filter_loop, 1000000, 0},
+    {"calls", gen_calls, 1000000, 0},
+    {"math_scripted", gen_math_scripted, 200000, 0},
+    {"math_native", gen_math_native, 200000, 0},
+};
+
+#define NUM_WORKLOADS ((int)(sizeof(workloads) / sizeof(Workload_t)))
+
+typedef struct {
+    double compile_seconds;
+    double run_seconds;
+    VmStats_t stats;
+    bool failed;
+} Measurement_t;
+
+typedef struct {
+    int repeat;
+    double scale;
+    bool optimize;
+    const char *label;
+} BenchOptions_t;
+
+static double now_seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// compiles and runs one input on vm, adding to the totals in measurement
+static void run_input(vm_t *vm, const char *code, Measurement_t *measurement) {
+    double start = now_seconds();
+    Program_t *program = compile_program(vm, code, NULL, 0);
+    double compiled = now_seconds();
+    measurement->compile_seconds += compiled - start;
+    if (program == NULL) {
+        measurement->failed = true;
+        return;
+    }
+    if (run_program(vm, program, NULL, NULL) != INTERPRET_OK) {
+        measurement->failed = true;
+    }
+    measurement->run_seconds += now_seconds() - compiled;
+    free_program(program);
+}
+
+// one fresh vm per run. input is the whole script or, for line based workloads, split in place
+static Measurement_t measure(const Workload_t *workload, Source_t *source, BenchOptions_t *options,
+                             FILE *null_out, Profile_t *profile) {
+    Measurement_t measurement = {0};
+    vm_t vm;
+    init_vm(&vm);
+    define_natives(&vm);
+    vm.optimize = options->optimize;
+    vm.profile = profile;
+    vm.time_phases = profile != NULL;
+    set_output(&vm, null_out, FLUSH_SIZE);
+
+    if (workload->lines == 0) {
+        run_input(&vm, source->data, &measurement);
+    } else {
+        char *line = source->data;
+        while (*line != '\0' && !measurement.failed) {
+            char *end = line;
+            for (int i = 0; i < workload->lines && *end != '\0'; i++) {
+                end = strchr(end, '\n');
+                end = end == NULL ? line + strlen(line) : end + 1;
+            }
+            char saved = *end;
+            *end = '\0';
+            run_input(&vm, line, &measurement);
+            *end = saved;
+            line = end;
+        }
+    }
+    measurement.stats = vm.stats;
+    free_vm(&vm);
+    return measurement;
+}
+
+static uint64_t count_instructions(Profile_t *profile) {
+    uint64_t total = 0;
+    for (int i = 0; i < OP_COUNT; i++) {
+        total += profile->ops[i].runs;
+    }
+    return total;
+}
+
+// runs in a child process, prints the workload's json line
+static int bench_workload(const Workload_t *workload, BenchOptions_t *options) {
+    rng_state = BENCH_SEED;
+    Source_t source = {NULL, 0, 0};
+    append(&source, "");
+    workload->generate(&source, (int)(workload->size * options->scale));
+
+    FILE *null_out = fopen("/dev/null", "w");
+    Measurement_t best = {0};
+    for (int i = 0; i < options->repeat; i++) {
+        Measurement_t run = measure(workload, &source, options, null_out, NULL);
+        if (run.failed) {
+            fprintf(stderr, "bench: %s failed\n", workload->name);
+            return 1;
+        }
+        if (i == 0 || run.compile_seconds < best.compile_seconds) {
+            best.compile_seconds = run.compile_seconds;
+        }
+        if (i == 0 || run.run_seconds < best.run_seconds) {
+            best.run_seconds = run.run_seconds;
+        }
+    }
+    // counting goes through the instrumented run loop and phase timing scans twice, so they get
+    // a run of their own
+    Profile_t profile;
+    init_profile(&profile);
+    VmStats_t phases = measure(workload, &source, options, null_out, &profile).stats;
+    uint64_t instructions = count_instructions(&profile);
+    free_profile(&profile);
+    fclose(null_out);
+    uint64_t codegen_ns =
+        phases.compile_ns > phases.scan_ns ? phases.compile_ns - phases.scan_ns : 0;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("{\"label\":\"%s\",\"workload\":\"%s\",\"optimize\":%s,\"source_bytes\":%d,"
+           "\"compile_ms\":%.3f,\"run_ms\":%.3f,\"instructions\":%llu,"
+           "\"instructions_per_sec\":%.0f,\"scan_ms\":%.3f,\"tokens_per_sec\":%.0f,"
+           "\"codegen_ms\":%.3f,\"bytes_per_sec\":%.0f,\"peak_rss_kb\":%ld}\n",
+           options->label, workload->name, options->optimize ? "true" : "false", source.count,
+           best.compile_seconds * 1e3, best.run_seconds * 1e3, (unsigned long long)instructions,
+           best.run_seconds > 0 ? instructions / best.run_seconds : 0.0, phases.scan_ns / 1e6,
+           phases.scan_ns > 0 ? phases.tokens * 1e9 / phases.scan_ns : 0.0, codegen_ns / 1e6,
+           codegen_ns > 0 ? phases.bytes_emitted * 1e9 / codegen_ns : 0.0, usage.ru_maxrss);
+    free(source.data);
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: bench [-O] [--repeat n] [--scale f] [--label name] [workload...]\n");
+    fprintf(stderr, "Workloads:");
+    for (int i = 0; i < NUM_WORKLOADS; i++) {
+        fprintf(stderr, " %s", workloads[i].name);
+    }
+    fprintf(stderr, "\n");
+    exit(64);
+}
+
+static const Workload_t *find_workload(const char *name) {
+    for (int i = 0; i < NUM_WORKLOADS; i++) {
+        if (strcmp(workloads[i].name, name) == 0) {
+            return &workloads[i];
+        }
+    }
+    usage();
+    return NULL;
+}
+
+int main(int argc, const char *argv[]) {
+    BenchOptions_t options = {.repeat = BENCH_REPEAT, .scale = 1.0, .optimize = false, .label = ""};
+    const Workload_t **selected = ALLOCATE(const Workload_t *, argc + NUM_WORKLOADS);
+    int num_selected = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-O") == 0) {
+            options.optimize = true;
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            options.repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            options.scale = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc) {
+            options.label = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage();
+        } else {
+            selected[num_selected++] = find_workload(argv[i]);
+        }
+    }
+    if (options.repeat < 1 || options.scale <= 0) {
+        usage();
+    }
+    if (num_selected == 0) {
+        for (int i = 0; i < NUM_WORKLOADS; i++) {
+            selected[num_selected++] = &workloads[i];
+        }
+    }
+
+    int status = 0;
+    for (int i = 0; i < num_selected; i++) {
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            exit(bench_workload(selected[i], &options));
+        }
+        int child_status;
+        if (child < 0 || waitpid(child, &child_status, 0) < 0 || !WIFEXITED(child_status) ||
+            WEXITSTATUS(child_status) != 0) {
+            fprintf(stderr, "bench: %s did not finish\n", selected[i]->name);
+            status = 1;
+        }
+    }
+    free(selected);
+    return status;
+}
@@ -0,0 +1,48 @@
+#include "../includes/chunk.h"
+#include "../includes/verifier.h"
+
+// make verify-check: hand written chunks the compiler never emits, verify_chunk() has to reject the
+// bad ones (images are only checked by it) and accept the good ones
+
+typedef struct {
+    const char *name;
+    bool valid;
+    int loop_distance; // OP_NONE, OP_POP, OP_LOOP loop_distance, OP_RETURN
+} Case_t;
+
+static const Case_t cases[] = {
+    {"loop back to offset 0", true, 7},
+    {"loop back into an operand", false, 4},
+    {"loop back before offset 0", false, 8},
+    {"loop far before offset 0", false, 1000},
+};
+
+static void build(Chunk_t *chunk, int loop_distance) {
+    init_chunk(chunk);
+    chunk->max_stack = 1;
+    write_chunk(chunk, OP_NONE, 1);
+    write_chunk(chunk, OP_POP, 1);
+    int at = write_jump(chunk, OP_LOOP, 1);
+    patch_jump_operand(chunk, at, loop_distance);
+    write_chunk(chunk, OP_RETURN, 1);
+}
+
+int main(void) {
+    int failed = 0;
+    for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+        Chunk_t chunk;
+        build(&chunk, cases[i].loop_distance);
+        FILE *err = fopen("/dev/null", "w");
+        bool valid = verify_chunk(&chunk, err);
+        fclose(err);
+        // the compilers size the stack with this, it must not follow the bad jump either
+        int depth = max_stack_depth(&chunk);
+        if (valid != cases[i].valid || depth != 1) {
+            fprintf(stderr, "verify-check: %s: %s, max stack %d\n", cases[i].name,
+                    valid ? "accepted" : "rejected", depth);
+            failed++;
+        }
+        free_chunk(&chunk);
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+#ifndef AST_H
+#define AST_H
+
+#include "chunk.h"
+#include "object.h"
+#include "utility.h"
+#include "value.h"
+
+// tree form of a program for the -O pipeline: parse_ast() builds it, the passes in optimizer.c
+// rewrite it and generate_code() lowers it to a chunk. every node keeps the line the single pass
+// compiler would have given its instruction so runtime errors read the same either way
+
+typedef enum {
+    AST_CONSTANT,   // value (none / bool / number / string)
+    AST_GET_GLOBAL, // name
+    AST_SET_GLOBAL, // name = left
+    AST_UNARY,      // op left (OP_NOT, OP_NEGATE)
+    AST_BINARY,     // left op right
+    AST_SET_TEMP,   // left, also copied into temp slot (first use of a common subexpression)
+    AST_GET_TEMP,   // temp slot (every later use)
+} AstKind_t;
+
+typedef struct AstNode_t {
+    AstKind_t kind;
+    int line;
+    OpCode_t op;
+    Value_t value;
+    ObjectStr_t *name;
+    int slot;
+    struct AstNode_t *left;
+    struct AstNode_t *right;
+} AstNode_t;
+
+typedef enum {
+    STMT_PRINT,  // print expr;
+    STMT_EXPR,   // expr;
+    STMT_LET,    // let name = expr;
+    STMT_RESULT, // trailing expr without ';' that is left on the stack as the chunk's result
+} StmtKind_t;
+
+typedef struct {
+    StmtKind_t kind;
+    int line; // of the instruction that ends the statement (print / pop / define)
+    ObjectStr_t *name;
+    AstNode_t *expr;
+    int num_temps; // temp slots the statement reserves below its own values
+} AstStmt_t;
+
+typedef struct {
+    vm_t *vm; // strings made while parsing / folding are interned here
+    int count;
+    int capacity;
+    AstStmt_t *stmts;
+    int num_nodes;
+    int node_capacity;
+    AstNode_t **nodes; // every node allocated for this tree, for free_ast()
+    int end_line;      // line of the final OP_RETURN
+} Ast_t;
+
+bool parse_ast(vm_t *vm, const char *code, bool tail_result, Ast_t *ast);
+void free_ast(Ast_t *ast);
+AstNode_t *new_node(Ast_t *ast, AstKind_t kind, int line);
+void generate_code(Ast_t *ast, Chunk_t *chunk);
+
+#endif
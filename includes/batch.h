@@ -0,0 +1,25 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "vm.h"
+
+// outcome of one script in a batch, stored at the same idx as its source
+typedef struct {
+    InterpretResult_t result;
+    char *out; // everything the script printed
+    size_t out_length;
+    char *err; // compile / runtime error reports
+    size_t err_length;
+} BatchResult_t;
+
+// engine settings every worker vm runs its scripts with
+typedef struct {
+    bool optimize; // -O
+    bool use_jit;  // --jit
+} BatchFlags_t;
+
+int default_thread_count();
+BatchResult_t *run_batch(const char **sources, int count, int num_threads, BatchFlags_t flags);
+void free_batch_results(BatchResult_t *results, int count);
+
+#endif
@@ -10,13 +10,15 @@
 // OpCodes
 typedef enum {
     OP_CONSTANT,
-    OP_CONSTANT_LONG,
     OP_NONE,
     OP_TRUE,
     OP_FALSE,
     OP_NOT,
     OP_NEGATE,
     OP_ADD,
+    OP_ADD_NUM, // OP_ADD after it has only seen numbers
+    OP_ADD_STR, // OP_ADD after it has only seen strings
+    OP_ADD_ANY, // a quickened add whose guard failed, never specialized again
     OP_SUB,
     OP_MUL,
     OP_DIV,
@@ -25,20 +27,101 @@ typedef enum {
     OP_LESS_THAN,
     OP_PRINT,
     OP_POP,
+    OP_DUP, // push a copy of the top of the stack
     OP_DEFINE_GLOBAL,
-    OP_DEFINE_GLOBAL_LONG, // if global id > 255
     OP_GET_GLOBAL,
-    OP_GET_GLOBAL_LONG, // if global id > 255
     OP_SET_GLOBAL,
-    OP_SET_GLOBAL_LONG, // if globa id > 255
+    OP_GET_SLOT, // push a copy of stack slot n, counted from where the chunk's stack starts
+    OP_SET_SLOT, // copy the top of the stack into slot n, leaving it on the stack
+    OP_JUMP,                 // pc += n
+    OP_JUMP_IF_FALSE,        // pop a value, pc += n if it's falsey
+    OP_JUMP_IF_TRUE,         // pop a value, pc += n if it's truthy
+    OP_LOOP,                 // pc -= n
+    OP_JUMP_IF_FALSE_OR_POP, // pc += n leaving the value if it's falsey, pop it otherwise (and)
+    OP_JUMP_IF_TRUE_OR_POP,  // pc += n leaving the value if it's truthy, pop it otherwise (or)
+    OP_JUMP_IF_NOT_LESS,     // pop b and a, pc += n unless a < b (fused OP_LESS_THAN + jump)
+    OP_JUMP_IF_NOT_GREATER,  // pop b and a, pc += n unless a > b
+    OP_JUMP_IF_LESS,         // pop b and a, pc += n if a < b (fused >= + jump)
+    OP_JUMP_IF_GREATER,      // pop b and a, pc += n if a > b (fused <= + jump)
+    OP_CALL,      // call the value under the top n (the arguments), leaves what it returns
+    OP_TAIL_CALL, // OP_CALL + OP_RETURN, the callee takes over the caller's frame
     OP_RETURN,
+    OP_COUNT, // not an opcode, the number of opcodes
 } OpCode_t;
 
+// static shape of an instruction. pushes happen after pops, so OP_SET_GLOBAL (which leaves the
+// assigned value where it was) pops one and pushes one
+typedef struct {
+    bool has_operand;      // followed by one variable length operand, see read_operand()
+    bool constant_operand; // operand is a constants idx
+    int pops;
+    int pushes;
+    const char *name;
+    int jump; // 1: operand is a forward distance from the next instruction, -1: backward, 0: none
+} OpInfo_t;
+
+extern const OpInfo_t op_info[OP_COUNT];
+
+// operands are unsigned LEB128: 7 bits per byte, low bits first, the high bit set on every byte
+// but the last. idxs below 128 take a single byte and there's no fixed limit on a chunk's constants
+#define OPERAND_MAX_BYTES 4 // caps operands at 28 bits so they always fit an int
+#define OPERAND_MAX ((1 << (7 * OPERAND_MAX_BYTES)) - 1)
+
+static inline int read_operand(uint8_t **pc) {
+    int operand = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = *(*pc)++;
+        operand |= (byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return operand;
+}
+
+// jumps are written before their target is known, so their operand is always padded out to
+// OPERAND_MAX_BYTES (continuation bytes with no payload are still valid LEB128) and patched in
+// place once it is. a fixed width also lets the run loop decode it without a loop
+static inline int read_jump(uint8_t **pc) {
+    uint8_t *bytes = *pc;
+    *pc += OPERAND_MAX_BYTES;
+    return (bytes[0] & 0x7F) | (bytes[1] & 0x7F) << 7 | (bytes[2] & 0x7F) << 14 | bytes[3] << 21;
+}
+
+// control never reaches the next instruction
+static inline bool ends_block(uint8_t op) {
+    return op == OP_JUMP || op == OP_LOOP || op == OP_TAIL_CALL || op == OP_RETURN;
+}
+
+// values an instruction pops, a call's depend on its argument count
+static inline int op_pops(uint8_t op, int operand) {
+    return op == OP_CALL || op == OP_TAIL_CALL ? operand + 1 : op_info[op].pops;
+}
+
+// op_pops() of the encoded instruction at code
+static inline int instruction_pops(uint8_t *code) {
+    uint8_t *pc = code + 1;
+    return op_pops(*code, op_info[*code].has_operand ? read_operand(&pc) : 0);
+}
+
+// stack depth at a jump's target, given the depth before the jump. the short circuit jumps only
+// pop when they fall through
+static inline int jump_depth(uint8_t op, int depth) {
+    if (op == OP_JUMP_IF_FALSE_OR_POP || op == OP_JUMP_IF_TRUE_OR_POP) {
+        return depth;
+    }
+    return depth - op_info[op].pops + op_info[op].pushes;
+}
+
 // Data
 typedef struct {
     int capacity;
     int count;
     uint8_t *code;
+    int max_stack; // deepest the value stack gets while running this chunk, set by the compiler
+    int arity;     // a function's parameters, on the stack before it starts. -1 for a script
+    int cache_base; // first global cache entry of its constants, see lookup_global()
+    bool verified; // passed verify_chunk(), only verified chunks are run
     ValueArray_t constants;
     LineRunArray_t line_runs;
 } Chunk_t;
@@ -47,6 +130,13 @@ void init_chunk(Chunk_t *chunk);
 void write_chunk(Chunk_t *chunk, uint8_t byte, int line);
 void free_chunk(Chunk_t *chunk);
 int add_constant(Chunk_t *chunk, Value_t value);
+void write_operand(Chunk_t *chunk, int operand, int line);
 void write_constant(Chunk_t *chunk, Value_t value, int line);
+int write_jump(Chunk_t *chunk, OpCode_t op, int line);
+void patch_jump_operand(Chunk_t *chunk, int at, int distance);
+void truncate_chunk(Chunk_t *chunk, int count);
+int instruction_length(uint8_t *code);
+int jump_target(Chunk_t *chunk, int offset);
+int max_stack_depth(Chunk_t *chunk);
 
 #endif
@@ -0,0 +1,20 @@
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include "vm.h"
+
+// rows processed per pass through the chunk; columns of this size stay in L1
+#define COLUMN_BLOCK 256
+
+// one input column per program param. give nums when every row is a number (no boxing at all),
+// otherwise values
+typedef struct {
+    const Value_t *values;
+    const double *nums;
+} Column_t;
+
+InterpretResult_t run_program_columns(vm_t *vm, Program_t *program, const Column_t *columns,
+                                      int num_rows, Value_t *results,
+                                      InterpretResult_t *statuses);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "chunk.h"
 #include "debug.h"
+#include "hash_table.h"
 #include "object.h"
 #include "scanner.h"
 #include "value.h"
@@ -20,8 +21,39 @@ typedef enum {
     PREC_ACCESSOR  // . () function calls and accesses
 } Precedence_t;
 
-typedef void (*ParseFunc_t)(
-    bool can_assign); // used to "store" the parse function we need for each token
+#define LOCALS_MAX 256
+
+typedef struct {
+    Token_t name;
+    int depth; // scope depth it was declared at, -1 while its initializer compiles
+} Local_t;
+
+// the chunk being written: the script's, or a function's while its body compiles
+typedef struct FuncState {
+    struct FuncState *enclosing;
+    ObjectFunc_t *function; // NULL for the script
+    Chunk_t *chunk;
+    HashTable_t ids;  // global name -> constant idx so each name is only stored once
+    int last_op;      // offset of the last instruction written, -1 before the first
+    int prev_op;      // and of the one before it
+    int last_target;  // highest offset a forward jump lands on, nothing before it can be fused
+    int landing;      // chain of jumps landing on the next instruction written, see land_jumps()
+    Local_t locals[LOCALS_MAX]; // idx is the stack slot, parameters first
+    int num_locals;
+    int scope_depth;
+} FuncState_t;
+
+// everything a single compilation needs; lives on the caller's stack so compiles are reentrant
+typedef struct {
+    vm_t *vm; // owner of the strings interned while compiling
+    Scanner_t scanner;
+    Parser_t parser;
+    bool tail_result; // last expression may omit its ';' and becomes the chunk's result
+    FuncState_t *func;
+} Compiler_t;
+
+// used to "store" the parse function we need for each token
+typedef void (*ParseFunc_t)(Compiler_t *compiler, bool can_assign);
 
 typedef struct {
     ParseFunc_t prefix_rule;
@@ -29,6 +61,7 @@ typedef struct {
     Precedence_t precedence; // prefix precedence
 } ParseRule_t;
 
-bool compile(const char *code, Chunk_t *chunk);
+bool compile(vm_t *vm, const char *code, Chunk_t *chunk);
+bool compile_with_result(vm_t *vm, const char *code, Chunk_t *chunk);
 
 #endif
@@ -2,8 +2,9 @@
 #define DEBUG_H
 
 #include "../includes/chunk.h"
+#include "../includes/writer.h"
 
-void disassemble_chunk(Chunk_t *chunk, const char *name);
-int disassemble_instruction(Chunk_t *chunk, int offset);
+void disassemble_chunk(Writer_t *out, Chunk_t *chunk, const char *name);
+int disassemble_instruction(Writer_t *out, Chunk_t *chunk, int offset);
 
 #endif
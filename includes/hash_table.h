@@ -7,6 +7,7 @@
 #include "value.h"
 
 #define TABLE_MAX_LOAD 0.75
+#define TABLE_PROBE_BUCKETS 8 // probe length histogram: 1, 2, 3, 4, 5-8, 9-16, 17-32, 33+
 
 typedef struct {
     ObjectStr_t *key;
@@ -14,16 +15,41 @@ typedef struct {
 } Node_t;
 
 typedef struct {
-    int num_elems;
+    int num_elems; // keys and tombstones, both count towards TABLE_MAX_LOAD
+    int num_tombstones;
     int capacity;
+    uint32_t version; // bumped whenever nodes move or are dropped, so Node_t pointers go stale
     Node_t *table;
+    uint64_t lookups; // probe sequences walked (finds, inserts, drops, rehashing), for --stats
+    uint64_t probes;  // slots they looked at
+    uint32_t resizes;
+    uint32_t rehashes;          // in place, to clear out tombstones
+    double max_tombstone_ratio; // drop() rehashes once tombstones pass this share of slots, 0 never
 } HashTable_t;
 
+// snapshot of a table's shape, see get_table_stats()
+typedef struct {
+    int keys;
+    int tombstones;
+    int capacity;
+    double load_factor;     // (keys + tombstones) / capacity, what resizing goes by
+    double tombstone_ratio; // tombstones / capacity
+    double avg_probe;       // slots a lookup of each key looks at, averaged over the keys
+    int max_probe;
+    int probe_histogram[TABLE_PROBE_BUCKETS];
+    uint32_t resizes;
+    uint32_t rehashes;
+} HashTableStats_t;
+
 void init_hash_table(HashTable_t *table);
 void free_hash_table(HashTable_t *table);
+void reserve(HashTable_t *hash_table, int count);
 bool insert(HashTable_t *hash_table, ObjectStr_t *key, Value_t value);
 Value_t *get(HashTable_t *hash_table, ObjectStr_t *key);
+Node_t *get_node(HashTable_t *hash_table, ObjectStr_t *key);
 bool drop(HashTable_t *hash_table, ObjectStr_t *key);
 ObjectStr_t *find_str(HashTable_t *hash_table, const char *chars, int length, uint32_t hash);
+HashTableStats_t get_table_stats(HashTable_t *hash_table);
+void dump_table_stats(const char *name, HashTable_t *hash_table, FILE *fp);
 
 #endif
@@ -0,0 +1,17 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "vm.h"
+
+// heap images: a vm's interned strings, its globals and the functions and natives they hold,
+// written once a prelude has run so later processes start from there instead of running it again.
+// an image has no pointers in it, only file offsets and idxs, and its strings are stored as
+// ready made ObjectStr_t records: load_image() maps the file and interns them where they are.
+// natives are bound by name to the ones the loading vm already defined. an image is tied to the
+// build that wrote it, and to vms with their own intern table
+
+bool save_image(vm_t *vm, const char *path);
+bool load_image(vm_t *vm, const char *path);
+void unmap_image(vm_t *vm);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <pthread.h>
+
+#include "object.h"
+#include "utility.h"
+
+// open addressed array of interned strings. never shrinks and never has keys removed so a reader
+// only needs the slot array it loaded to probe safely
+typedef struct InternSlots_t {
+    int capacity;
+    struct InternSlots_t *retired; // older arrays kept alive for readers still probing them
+    ObjectStr_t *keys[];           // Flexible array member
+} InternSlots_t;
+
+// intern table for the literals and identifiers of any number of vms (across threads). lookups are
+// lock-free, inserts are serialized by the lock. strings interned here belong to the table, not to
+// a vm, so a literal is allocated once per process. strings made at runtime stay on their vm's heap
+// (see allocate_runtime_str()), equals() compares those by contents
+typedef struct {
+    InternSlots_t *slots;
+    int count;
+    Object_t *objects;
+    pthread_mutex_t lock;
+} InternTable_t;
+
+void init_intern_table(InternTable_t *intern_table);
+void free_intern_table(InternTable_t *intern_table);
+ObjectStr_t *find_shared_str(InternTable_t *intern_table, const char *chars, int length,
+                            uint32_t hash);
+ObjectStr_t *intern_str(InternTable_t *intern_table, const char *chars, int length, uint32_t hash);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "chunk.h"
+#include "utility.h"
+#include "value.h"
+
+// programs are compiled to native code once they've run this many times, functions once they've
+// been called this many times
+#define JIT_HOT_THRESHOLD 8
+
+typedef enum {
+    JIT_DONE,  // hit OP_RETURN
+    JIT_DEOPT, // a type guard failed, vm->pc / vm->stack_top are set for the interpreter to resume
+    JIT_ERROR, // runtime error, already reported
+    JIT_TAIL_CALL, // a tail call replaced the frame, vm->chunk / vm->pc are the callee's
+} JitStatus_t;
+
+typedef struct JitCode_t JitCode_t;
+
+bool jit_supported();
+JitCode_t *jit_compile(Chunk_t *chunk);
+JitStatus_t jit_enter(vm_t *vm, JitCode_t *code);
+void jit_free(JitCode_t *code);
+
+#endif
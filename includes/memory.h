@@ -5,11 +5,14 @@
 #include "utility.h"
 
 // convenience macros so don't have to cast (void *) over and over again
-#define ALLOCATE(type, count) (type *)malloc(sizeof(type) * count)
-#define ALLOCATE_OBJ(type, object_type) (type *)(allocate_object(sizeof(type), object_type))
+#define ALLOCATE(type, count) (type *)malloc(sizeof(type) * (count))
+#define ALLOCATE_OBJ(vm, type, object_type)                                                        \
+    (type *)(allocate_object(vm, sizeof(type), object_type))
 
 int grow_capacity(int old_capacity);
 void *resize(void *ptr, size_t type_size, int new_capacity);
-void free_objects();
+void free_object_list(Object_t *head);
+void free_objects(vm_t *vm);
+void free_objects_since(vm_t *vm, Object_t *mark);
 
 #endif
@@ -0,0 +1,13 @@
+#ifndef NATIVES_H
+#define NATIVES_H
+
+#include "object.h"
+#include "vm.h"
+
+// builtins written in C, called like any other function. a vm starts without them: embedders
+// that intern through a shared table set vm->shared_strings first, then call define_natives()
+
+void define_native(vm_t *vm, const char *name, int arity, NativeFn_t function);
+void define_natives(vm_t *vm);
+
+#endif
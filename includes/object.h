@@ -1,17 +1,25 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+#include "chunk.h"
+#include "jit.h"
 #include "utility.h"
 #include "value.h"
 
 #define OBJ_TYPE(value) (GET_OBJ_VAL(value)->type)
 #define IS_STR(value) is_obj_type(value, OBJ_STR)
+#define IS_FUNC(value) is_obj_type(value, OBJ_FUNC)
+#define IS_NATIVE(value) is_obj_type(value, OBJ_NATIVE)
 
 #define GET_STR_VAL(value) ((ObjectStr_t *)GET_OBJ_VAL(value))
 #define GET_CSTR_VAL(value) (((ObjectStr_t *)GET_OBJ_VAL(value))->chars)
+#define GET_FUNC_VAL(value) ((ObjectFunc_t *)GET_OBJ_VAL(value))
+#define GET_NATIVE_VAL(value) ((ObjectNative_t *)GET_OBJ_VAL(value))
 
 typedef enum {
     OBJ_STR,
+    OBJ_FUNC,
+    OBJ_NATIVE,
 } ObjectType_t;
 
 // Object_t* can safely cast to ObjectStr_t* if Object_t* pts to ObjectStr_t field
@@ -28,10 +36,34 @@ struct ObjectStr_t {
     char chars[]; // Flexible array member
 };
 
+// a compiled function. its chunk's arity is how many arguments it takes
+typedef struct {
+    Object_t object;
+    ObjectStr_t *name;
+    Chunk_t chunk;
+    int calls;           // only touched atomically, decides when the function is hot (--jit)
+    JitCode_t *jit_code; // native code, installed once after JIT_HOT_THRESHOLD calls
+} ObjectFunc_t;
+
+// a builtin written in C. args are the call's arguments where they sit on the stack, the result
+// goes in *result. false after reporting a runtime error with throw_runtime_error()
+typedef bool (*NativeFn_t)(vm_t *vm, int argc, Value_t *args, Value_t *result);
+
+typedef struct {
+    Object_t object;
+    ObjectStr_t *name;
+    int arity; // -1 takes any number of arguments, the native checks them itself
+    NativeFn_t function;
+} ObjectNative_t;
+
 static inline bool is_obj_type(Value_t value, ObjectType_t type) {
     return IS_OBJ_VAL(value) && GET_OBJ_VAL(value)->type == type;
 }
 
-ObjectStr_t *allocate_str(const char *chars, int length);
+ObjectStr_t *allocate_str(vm_t *vm, const char *chars, int length);
+ObjectStr_t *allocate_runtime_str(vm_t *vm, const char *chars, int length);
+ObjectStr_t *allocate_unowned_str(const char *chars, int length, uint32_t hash);
+ObjectFunc_t *allocate_func(vm_t *vm, ObjectStr_t *name);
+ObjectNative_t *allocate_native(vm_t *vm, ObjectStr_t *name, int arity, NativeFn_t function);
 
 #endif
@@ -0,0 +1,9 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "ast.h"
+
+bool compile_optimized(vm_t *vm, const char *code, Chunk_t *chunk, bool tail_result);
+void optimize_chunk(Chunk_t *chunk);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "chunk.h"
+#include "utility.h"
+
+// --profile: how often every opcode and every source line ran and how many cycles went to them.
+// the clock is read once per instruction and the time since the last read is charged to the
+// instruction that just finished. only run_instrumented() calls into here, run() has no profiling
+// code in it at all, so profiling off costs nothing
+
+typedef struct {
+    uint64_t runs;
+    uint64_t cycles;
+} ProfileCounter_t;
+
+// a chunk's line_runs expanded to the source line of every byte, built the first time it runs
+typedef struct {
+    Chunk_t *chunk;
+    int *lines;
+} ProfileChunk_t;
+
+typedef struct {
+    ProfileCounter_t ops[OP_COUNT];
+    ProfileCounter_t *lines; // idx is the source line
+    int line_capacity;
+    ProfileChunk_t *chunks; // open addressed on the chunk pointer, so calls don't rebuild tables
+    int num_chunks;
+    int chunk_capacity;
+    int *offset_lines; // the running chunk's table, calls and returns switch it
+    Chunk_t *chunk;
+    int cur_op; // instruction being timed, -1 outside of a chunk
+    int cur_line;
+    uint64_t started;
+} Profile_t;
+
+void init_profile(Profile_t *profile);
+void free_profile(Profile_t *profile);
+void profile_enter(Profile_t *profile, Chunk_t *chunk);
+void profile_step(Profile_t *profile, Chunk_t *chunk, int op, int offset);
+void profile_exit(Profile_t *profile);
+void dump_profile(Profile_t *profile, FILE *fp);
+void write_collapsed_profile(Profile_t *profile, const char *name, FILE *fp);
+
+#endif
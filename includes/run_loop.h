@@ -0,0 +1,253 @@
+// the dispatch loop. vm.c includes this twice: as run(), and with RUN_INSTRUMENTED defined as
+// run_instrumented(), which traces / profiles every instruction before running it. there's one
+// copy of the loop to maintain and the plain one has no instrumentation checks at all
+#ifdef RUN_INSTRUMENTED
+static InterpretResult_t run_instrumented(vm_t *vm) {
+#else
+static InterpretResult_t run(vm_t *vm) {
+#endif
+    while (true) {
+#ifdef RUN_INSTRUMENTED
+        instrument(vm);
+#endif
+
+        uint8_t instruction;
+        switch (instruction = *vm->pc++) {
+            case OP_CONSTANT: {
+                Value_t constant = vm->chunk->constants.values[read_operand(&vm->pc)];
+                push(vm, constant);
+                break;
+            }
+            case OP_NONE: {
+                push(vm, DECL_NONE_VAL);
+                break;
+            }
+            case OP_TRUE: {
+                push(vm, DECL_BOOL_VAL(true));
+                break;
+            }
+            case OP_FALSE: {
+                push(vm, DECL_BOOL_VAL(false));
+                break;
+            }
+            case OP_EQUAL: {
+                Value_t b = pop(vm);
+                Value_t a = pop(vm);
+                push(vm, DECL_BOOL_VAL(equals(a, b)));
+                break;
+            }
+            case OP_GREATER_THAN: {
+                COMPARE_OP(>);
+                break;
+            }
+            case OP_LESS_THAN: {
+                COMPARE_OP(<);
+                break;
+            }
+            case OP_NOT: {
+                push(vm, DECL_BOOL_VAL(is_falsey(pop(vm))));
+                break;
+            }
+            case OP_ADD: {
+                // first run of this site: specialize it for the operand types it sees
+                if (IS_NUMBER_VAL(peek(vm, 0)) && IS_NUMBER_VAL(peek(vm, 1))) {
+                    rewrite_op(vm->pc - 1, OP_ADD_NUM);
+                } else if (IS_STR(peek(vm, 0)) && IS_STR(peek(vm, 1))) {
+                    rewrite_op(vm->pc - 1, OP_ADD_STR);
+                }
+                if (!add(vm)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_ADD_NUM: {
+                if (IS_NUM_VAL(peek(vm, 0)) && IS_NUM_VAL(peek(vm, 1))) {
+                    double b = GET_NUM_VAL(pop(vm));
+                    vm->stack_top[-1].data.num += b;
+                    break;
+                }
+                if (IS_NUMBER_VAL(peek(vm, 0)) && IS_NUMBER_VAL(peek(vm, 1))) {
+                    ARITH_OP(__builtin_add_overflow, +); // ints, or an int and a double
+                    break;
+                }
+                rewrite_op(vm->pc - 1, OP_ADD_ANY);
+                if (!add(vm)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_ADD_STR: {
+                if (IS_STR(peek(vm, 0)) && IS_STR(peek(vm, 1))) {
+                    concatenate(vm);
+                    break;
+                }
+                rewrite_op(vm->pc - 1, OP_ADD_ANY);
+                if (!add(vm)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_ADD_ANY: {
+                if (!add(vm)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_SUB: {
+                ARITH_OP(__builtin_sub_overflow, -);
+                break;
+            }
+            case OP_MUL: {
+                ARITH_OP(__builtin_mul_overflow, *);
+                break;
+            }
+            case OP_DIV: {
+                ARITH_OP(div_ints, /);
+                break;
+            }
+            case OP_NEGATE: {
+                if (!IS_NUMBER_VAL(peek(vm, 0))) {
+                    throw_runtime_error(vm, "Operand is not a number ");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                push(vm, negate_number(pop(vm)));
+                break;
+            }
+            case OP_PRINT: {
+                write_value(&vm->out, pop(vm));
+                end_line(&vm->out);
+                break;
+            }
+            case OP_POP: {
+                pop(vm);
+                break;
+            }
+            case OP_DUP: {
+                push(vm, peek(vm, 0));
+                break;
+            }
+            case OP_DEFINE_GLOBAL: {
+                int idx = read_operand(&vm->pc);
+                ObjectStr_t *global_name = GET_STR_VAL(vm->chunk->constants.values[idx]);
+                insert(&vm->globals, global_name, peek(vm, 0));
+                pop(vm);
+                break;
+            }
+            case OP_GET_GLOBAL: {
+                if (!get_global(vm, read_operand(&vm->pc))) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_SET_GLOBAL: {
+                if (!set_global(vm, read_operand(&vm->pc))) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_GET_SLOT: {
+                push(vm, vm->stack_base[read_operand(&vm->pc)]);
+                break;
+            }
+            case OP_SET_SLOT: {
+                vm->stack_base[read_operand(&vm->pc)] = peek(vm, 0);
+                break;
+            }
+            case OP_JUMP: {
+                int distance = read_jump(&vm->pc);
+                vm->pc += distance;
+                break;
+            }
+            case OP_JUMP_IF_FALSE: {
+                int distance = read_jump(&vm->pc);
+                if (is_falsey(pop(vm))) {
+                    vm->pc += distance;
+                }
+                break;
+            }
+            case OP_JUMP_IF_TRUE: {
+                int distance = read_jump(&vm->pc);
+                if (!is_falsey(pop(vm))) {
+                    vm->pc += distance;
+                }
+                break;
+            }
+            case OP_LOOP: {
+                int distance = read_jump(&vm->pc);
+                vm->pc -= distance;
+                break;
+            }
+            case OP_JUMP_IF_FALSE_OR_POP: {
+                int distance = read_jump(&vm->pc);
+                if (is_falsey(peek(vm, 0))) {
+                    vm->pc += distance;
+                } else {
+                    pop(vm);
+                }
+                break;
+            }
+            case OP_JUMP_IF_TRUE_OR_POP: {
+                int distance = read_jump(&vm->pc);
+                if (!is_falsey(peek(vm, 0))) {
+                    vm->pc += distance;
+                } else {
+                    pop(vm);
+                }
+                break;
+            }
+            case OP_JUMP_IF_NOT_LESS: {
+                COMPARE_JUMP(<, false);
+                break;
+            }
+            case OP_JUMP_IF_NOT_GREATER: {
+                COMPARE_JUMP(>, false);
+                break;
+            }
+            case OP_JUMP_IF_LESS: {
+                COMPARE_JUMP(<, true);
+                break;
+            }
+            case OP_JUMP_IF_GREATER: {
+                COMPARE_JUMP(>, true);
+                break;
+            }
+            case OP_CALL: {
+                int frames = vm->frame_count;
+                if (!call_value(vm, read_operand(&vm->pc))) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                // with --jit a hot function runs as native code, unless every instruction has to go
+                // through instrument(): native code has no hook for it
+                if (vm->use_jit && vm->frame_count > frames && !instrumented(vm) &&
+                    !call_natively(vm)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_TAIL_CALL: {
+                int argc = read_operand(&vm->pc);
+                Value_t callee = vm->stack_top[-1 - argc];
+                if (takes_args(callee, argc)) {
+                    if (!tail_call_value(vm, argc)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    break;
+                }
+                if (!slow_call(vm, callee, argc)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                // a native returns right away, so this frame returns its result
+            }
+            // fall through
+            case OP_RETURN:
+                if (vm->frame_count == vm->base_frame) {
+                    return INTERPRET_OK;
+                }
+                return_from_call(vm);
+                break;
+            default:
+                // only verified chunks get here, so no range check on the opcode
+                __builtin_unreachable();
+        }
+    }
+}
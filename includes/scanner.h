@@ -75,8 +75,8 @@ typedef struct {
     bool is_panicking;
 } Parser_t;
 
-void init_scanner(const char *file);
-Token_t scan_token();
-bool check_next(const char expected);
+void init_scanner(Scanner_t *scanner, const char *file);
+Token_t scan_token(Scanner_t *scanner);
+bool check_next(Scanner_t *scanner, const char expected);
 
 #endif
@@ -0,0 +1,32 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <stddef.h>
+
+#include "utility.h"
+#include "value.h"
+
+// address space reserved per vm stack; only the part a chunk needs is ever backed by memory
+#define STACK_MAX_VALUES (1 << 20)
+
+// value stack in its own mapping: [values, values + committed) is read/write and everything after
+// it is PROT_NONE, so running off the end faults on the very next push instead of corrupting
+// whatever lives next to it. push / pop never check bounds
+typedef struct {
+    Value_t *values;
+    size_t committed; // in values, always a whole number of pages
+} ValueStack_t;
+
+// the stack and jump target for overflows on the calling thread
+typedef struct {
+    ValueStack_t *stack;
+    void *jump; // sigjmp_buf *, kept opaque so this header needs no posix feature macros
+} StackGuard_t;
+
+void init_value_stack(ValueStack_t *stack);
+void free_value_stack(ValueStack_t *stack);
+bool commit_value_stack(ValueStack_t *stack, size_t values);
+StackGuard_t arm_stack_guard(ValueStack_t *stack, void *jump);
+void restore_stack_guard(StackGuard_t previous);
+
+#endif
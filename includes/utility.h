@@ -9,8 +9,4 @@
 #include <stdlib.h>
 #include <string.h>
 
-// if flag defined -> vm disassembles and prints instructions before execution
-// #define DEBUG_TRACE_EXECUTION
-// #define DEBUG_PRINT_CODE
-
 #endif
@@ -2,33 +2,45 @@
 #define VALUE_H
 
 #include "utility.h"
+#include "writer.h"
 
 // declaration in object.h; needed to avoid circular includes leading to errors
 typedef struct Object_t Object_t;
 typedef struct ObjectStr_t ObjectStr_t;
+// declaration in vm.h; allocators and the compiler take the vm they work on explicitly
+typedef struct vm_t vm_t;
 
-typedef enum { VAL_BOOL, VAL_NONE, VAL_NUM, VAL_OBJ } ValueType_t;
+// VAL_NUM is a double, VAL_INT a 64 bit integer (integer literals). int arithmetic that overflows
+// and anything mixing the two is done in doubles
+typedef enum { VAL_BOOL, VAL_NONE, VAL_NUM, VAL_INT, VAL_OBJ } ValueType_t;
 
 typedef struct {
     ValueType_t type;
     union {
         bool boolean;
         double num;
+        int64_t integer;
         Object_t *object;
     } data;
 } Value_t;
 
 #define IS_BOOL_VAL(value) ((value).type == VAL_BOOL)
 #define IS_NUM_VAL(value) ((value).type == VAL_NUM)
+#define IS_INT_VAL(value) ((value).type == VAL_INT)
+#define IS_NUMBER_VAL(value) (IS_NUM_VAL(value) || IS_INT_VAL(value)) // either kind of number
 #define IS_NONE_VAL(value) ((value).type == VAL_NONE)
 #define IS_OBJ_VAL(value) ((value).type == VAL_OBJ)
 
 #define GET_BOOL_VAL(value) ((value).data.boolean)
 #define GET_NUM_VAL(value) ((value).data.num)
+#define GET_INT_VAL(value) ((value).data.integer)
+// any number as a double
+#define GET_NUMBER_VAL(value) (IS_INT_VAL(value) ? (double)GET_INT_VAL(value) : GET_NUM_VAL(value))
 #define GET_OBJ_VAL(value) ((value).data.object)
 
 #define DECL_BOOL_VAL(value) ((Value_t){.type = VAL_BOOL, .data.boolean = value})
 #define DECL_NUM_VAL(value) ((Value_t){.type = VAL_NUM, .data.num = value})
+#define DECL_INT_VAL(value) ((Value_t){.type = VAL_INT, .data.integer = value})
 #define DECL_OBJ_VAL(obj) ((Value_t){.type = VAL_OBJ, .data.object = (Object_t *)obj})
 #define DECL_NONE_VAL ((Value_t){.type = VAL_NONE, .data.num = 0})
 
@@ -41,8 +53,18 @@ typedef struct {
 void init_value_array(ValueArray_t *array);
 void write_value_array(ValueArray_t *array, Value_t value);
 void free_value_array(ValueArray_t *array);
-void print_value(Value_t value);
+void write_value(Writer_t *writer, Value_t value);
 
+bool is_falsey(Value_t value);
 bool equals(Value_t a, Value_t b);
 
+Value_t number_literal(const char *chars, int length);
+bool div_ints(int64_t a, int64_t b, int64_t *result);
+Value_t add_numbers(Value_t a, Value_t b);
+Value_t sub_numbers(Value_t a, Value_t b);
+Value_t mul_numbers(Value_t a, Value_t b);
+Value_t div_numbers(Value_t a, Value_t b);
+Value_t negate_number(Value_t a);
+bool less_than(Value_t a, Value_t b);
+
 #endif
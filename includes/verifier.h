@@ -0,0 +1,8 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include "chunk.h"
+
+bool verify_chunk(Chunk_t *chunk, FILE *err);
+
+#endif
@@ -4,25 +4,110 @@
 #include "chunk.h"
 #include "compiler.h"
 #include "hash_table.h"
+#include "intern.h"
+#include "jit.h"
+#include "profiler.h"
+#include "stack.h"
+#include "writer.h"
 
+// inline cache entry for global accesses, see lookup_global()
 typedef struct {
+    ObjectStr_t *key;
+    Node_t *node;
+    uint32_t version; // globals.version when node was looked up
+} GlobalCache_t;
+
+#define FRAMES_MAX 4096 // calls deep a vm can go, tail calls don't count
+#define GLOBALS_MAX_TOMBSTONE_RATIO 0.25 // undefine() rehashes globals once a quarter are tombstones
+
+// where a call returns to: the caller's registers from vm_t. the callee and its arguments are the
+// values just below the callee's stack_base
+typedef struct {
+    Chunk_t *chunk;
+    uint8_t *pc;
+    Value_t *stack_base;
+} CallFrame_t;
+
+// --stats counters. the counts are always kept, the phase times only with time_phases set
+typedef struct {
+    uint64_t global_hits;
+    uint64_t global_misses;
+    uint64_t intern_hits; // the string was already interned, in strings or the shared table
+    uint64_t intern_misses;
+    uint64_t tokens;     // scanned by the timed scan pass, see timed_compile()
+    uint64_t scan_ns;    // that pass on its own
+    uint64_t compile_ns; // whole compiles, scanning included
+    uint64_t bytes_emitted;
+    uint64_t run_ns;
+} VmStats_t;
+
+// one interpreter instance; every vm owns its own heap, intern table and globals so any number
+// of them can live side by side (one per thread)
+struct vm_t {
     Chunk_t *chunk;
     uint8_t *pc;
-    Value_t stack[256];
+    ValueStack_t stack; // sized from the chunk's max_stack before it runs
     Value_t *stack_top;
+    Value_t *stack_base; // where the running chunk's part of the stack starts, slots count from here
+    CallFrame_t *frames; // the calls in progress, FRAMES_MAX of them
+    int frame_count;     // 0 while the script itself runs
+    int base_frame;      // OP_RETURN with this many frames leaves run(), see run_native_frame()
     HashTable_t strings;
+    InternTable_t *shared_strings; // when set, literals and identifiers are interned here
     HashTable_t globals;
     Object_t *objects;
-} vm_t;
+    Writer_t out; // where OP_PRINT writes, buffered (stdout unless redirected with set_output())
+    FILE *err; // where compile and runtime errors are reported
+    bool use_jit;  // run chunks as native code where the jit supports them
+    bool optimize; // compile through the ast pipeline (-O)
+    GlobalCache_t *global_cache; // one entry per constant of the running chunk
+    int global_cache_capacity;
+    VmStats_t stats;
+    bool time_phases; // time scanning, compiling and running into stats (--stats)
+    Profile_t *profile; // counts every instruction executed when set (--profile)
+    Writer_t *trace;    // every instruction and the stack before it is written here when set
+    Writer_t *listing;  // every compiled chunk is disassembled here when set
+    void *image;        // the heap image mapped by load_image(), its strings are interned in place
+    size_t image_size;
+};
 
 typedef enum { INTERPRET_OK, INTERPRET_COMPILE_ERROR, INTERPRET_RUNTIME_ERROR } InterpretResult_t;
 
-extern vm_t vm;
+// compiled once, run many times. the only writes after compile_program() are atomic (quickened
+// opcodes, installing jit code) so one program can be run by several vms at once, as long as they
+// intern through the vm it was compiled with (or the same shared intern table). its strings and
+// function objects live on the compiling vm's heap and are freed with it, so that vm has to
+// outlive every run of the program
+typedef struct {
+    Chunk_t chunk;
+    int num_params;
+    ObjectStr_t **params; // bindings[i] passed to run_program() is stored in global params[i]
+    Node_t **param_nodes; // where params live in the compiling vm's globals, see run_program()
+    HashTable_t *param_table;
+    uint32_t param_version; // param_table->version when param_nodes were looked up
+    int runs;             // only touched atomically, decides when the program is hot
+    JitCode_t *jit_code;  // native code, installed once after JIT_HOT_THRESHOLD runs
+} Program_t;
+
+void init_vm(vm_t *vm);
+void free_vm(vm_t *vm);
+void reset_vm(vm_t *vm, Object_t *mark);
+void push(vm_t *vm, Value_t value);
+Value_t pop(vm_t *vm);
+void set_output(vm_t *vm, FILE *fp, FlushMode_t mode);
+void throw_runtime_error(vm_t *vm, const char *format, ...);
+Node_t *lookup_global(vm_t *vm, int idx);
+void dump_stats(vm_t *vm, FILE *fp);
+InterpretResult_t interpret(vm_t *vm, const char *code);
+Program_t *compile_program(vm_t *vm, const char *code, const char **params, int num_params);
+InterpretResult_t run_program(vm_t *vm, Program_t *program, const Value_t *bindings,
+                              Value_t *result);
+void free_program(Program_t *program);
 
-void init_vm();
-void free_vm();
-void push(Value_t value);
-Value_t pop();
-InterpretResult_t interpret(const char *code);
+// OP_CALL / OP_TAIL_CALL from native code (jit.c). a call returns with its result in place of the
+// callee; a tail call reports how the frame went on: JIT_DONE (a native returned its result),
+// JIT_TAIL_CALL (a function took the frame over) or JIT_ERROR
+bool call_from_native(vm_t *vm, int argc);
+JitStatus_t tail_call_from_native(vm_t *vm, int argc);
 
 #endif
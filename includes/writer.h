@@ -0,0 +1,33 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "utility.h"
+
+// buffered output for script output (OP_PRINT) and diagnostics (traces, listings): bytes collect
+// in memory and reach the stream in one fwrite instead of a locked stdio call per value
+#define WRITER_CAPACITY (64 * 1024)
+
+// when buffered bytes are written to the stream, besides explicit flush_writer() calls
+typedef enum {
+    FLUSH_LINE, // after every end_line(), for terminals
+    FLUSH_SIZE, // when the buffer fills up
+    FLUSH_EXIT, // never on its own, the buffer grows until flushed or freed
+} FlushMode_t;
+
+typedef struct {
+    FILE *fp;
+    char *data;
+    int count;
+    int capacity;
+    FlushMode_t mode;
+} Writer_t;
+
+void init_writer(Writer_t *writer, FILE *fp, FlushMode_t mode);
+void free_writer(Writer_t *writer);
+void flush_writer(Writer_t *writer);
+void write_bytes(Writer_t *writer, const char *bytes, int length);
+void write_str(Writer_t *writer, const char *str);
+void write_format(Writer_t *writer, const char *format, ...);
+void end_line(Writer_t *writer);
+
+#endif
@@ -0,0 +1,292 @@
+#include "../includes/ast.h"
+#include "../includes/compiler.h"
+#include "../includes/memory.h"
+
+// same grammar as the single pass compiler, but this parser never reports anything: on the first
+// error it gives up and the caller falls back to compiler.c, which then reports the errors
+
+typedef struct {
+    Scanner_t scanner;
+    Token_t cur;
+    Token_t prev;
+    bool has_error;
+    bool tail_result;
+    Ast_t *ast;
+} AstParser_t;
+
+static AstNode_t *expression(AstParser_t *parser);
+
+AstNode_t *new_node(Ast_t *ast, AstKind_t kind, int line) {
+    if (ast->num_nodes + 1 > ast->node_capacity) {
+        ast->node_capacity = grow_capacity(ast->node_capacity);
+        ast->nodes = resize(ast->nodes, sizeof(AstNode_t *), ast->node_capacity);
+    }
+    AstNode_t *node = ALLOCATE(AstNode_t, 1);
+    *node = (AstNode_t){.kind = kind, .line = line, .value = DECL_NONE_VAL};
+    ast->nodes[ast->num_nodes++] = node;
+    return node;
+}
+
+void free_ast(Ast_t *ast) {
+    for (int i = 0; i < ast->num_nodes; i++) {
+        free(ast->nodes[i]);
+    }
+    free(ast->nodes);
+    free(ast->stmts);
+    ast->nodes = NULL;
+    ast->stmts = NULL;
+    ast->num_nodes = 0;
+    ast->count = 0;
+}
+
+static void add_stmt(Ast_t *ast, AstStmt_t stmt) {
+    if (ast->count + 1 > ast->capacity) {
+        ast->capacity = grow_capacity(ast->capacity);
+        ast->stmts = resize(ast->stmts, sizeof(AstStmt_t), ast->capacity);
+    }
+    ast->stmts[ast->count++] = stmt;
+}
+
+// ------------------------ Tokens ------------------------ //
+
+static AstNode_t *fail(AstParser_t *parser) {
+    parser->has_error = true;
+    return NULL;
+}
+
+static void go_next(AstParser_t *parser) {
+    parser->prev = parser->cur;
+    parser->cur = scan_token(&parser->scanner);
+    if (parser->cur.type == TOKEN_ERROR) {
+        parser->has_error = true;
+    }
+}
+
+static bool match(AstParser_t *parser, TokenType_t type) {
+    if (parser->cur.type == type) {
+        go_next(parser);
+        return true;
+    }
+    return false;
+}
+
+static bool consume(AstParser_t *parser, TokenType_t type) {
+    if (!match(parser, type)) {
+        parser->has_error = true;
+    }
+    return !parser->has_error;
+}
+
+// ------------------------ Expressions ------------------------ //
+
+static Precedence_t infix_precedence(TokenType_t type) {
+    switch (type) {
+        case TOKEN_ADD:
+        case TOKEN_SUB:
+            return PREC_ADD_SUB;
+        case TOKEN_MUL:
+        case TOKEN_DIV:
+            return PREC_MUL_DIV;
+        case TOKEN_EQUAL_EQUAL:
+        case TOKEN_NOT_EQUAL:
+            return PREC_EQUALITY;
+        case TOKEN_GREATER_THAN:
+        case TOKEN_GREATER_THAN_EQUAL:
+        case TOKEN_LESS_THAN:
+        case TOKEN_LESS_THAN_EQUAL:
+            return PREC_COMPARE;
+        default:
+            return PREC_NONE;
+    }
+}
+
+static AstNode_t *unary_node(AstParser_t *parser, OpCode_t op, AstNode_t *operand, int line) {
+    AstNode_t *node = new_node(parser->ast, AST_UNARY, line);
+    node->op = op;
+    node->left = operand;
+    return node;
+}
+
+static AstNode_t *binary_node(AstParser_t *parser, OpCode_t op, AstNode_t *left,
+                              AstNode_t *right, int line) {
+    AstNode_t *node = new_node(parser->ast, AST_BINARY, line);
+    node->op = op;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+static AstNode_t *constant_node(AstParser_t *parser, Value_t value, int line) {
+    AstNode_t *node = new_node(parser->ast, AST_CONSTANT, line);
+    node->value = value;
+    return node;
+}
+
+static AstNode_t *parse_precedence(AstParser_t *parser, Precedence_t prec);
+
+static AstNode_t *named(AstParser_t *parser, bool can_assign) {
+    Token_t name = parser->prev;
+    ObjectStr_t *global_name = allocate_str(parser->ast->vm, name.start, name.length);
+    if (can_assign && match(parser, TOKEN_EQUAL)) {
+        AstNode_t *value = expression(parser);
+        if (value == NULL) {
+            return NULL;
+        }
+        AstNode_t *node = new_node(parser->ast, AST_SET_GLOBAL, parser->prev.line);
+        node->name = global_name;
+        node->left = value;
+        return node;
+    }
+    AstNode_t *node = new_node(parser->ast, AST_GET_GLOBAL, name.line);
+    node->name = global_name;
+    return node;
+}
+
+static AstNode_t *prefix(AstParser_t *parser, bool can_assign) {
+    Token_t token = parser->prev;
+    switch (token.type) {
+        case TOKEN_OPEN_PAREN: {
+            AstNode_t *inner = expression(parser);
+            return inner != NULL && consume(parser, TOKEN_CLOSE_PAREN) ? inner : NULL;
+        }
+        case TOKEN_SUB:
+        case TOKEN_NOT: {
+            AstNode_t *operand = parse_precedence(parser, PREC_UNARY);
+            if (operand == NULL) {
+                return NULL;
+            }
+            OpCode_t op = token.type == TOKEN_NOT ? OP_NOT : OP_NEGATE;
+            return unary_node(parser, op, operand, parser->prev.line);
+        }
+        case TOKEN_IDENTIFIER:
+            return named(parser, can_assign);
+        case TOKEN_STR: {
+            ObjectStr_t *str = allocate_str(parser->ast->vm, token.start + 1, token.length - 2);
+            return constant_node(parser, DECL_OBJ_VAL(str), token.line);
+        }
+        case TOKEN_NUM:
+            return constant_node(parser, number_literal(token.start, token.length), token.line);
+        case TOKEN_TRUE:
+            return constant_node(parser, DECL_BOOL_VAL(true), token.line);
+        case TOKEN_FALSE:
+            return constant_node(parser, DECL_BOOL_VAL(false), token.line);
+        case TOKEN_NONE:
+            return constant_node(parser, DECL_NONE_VAL, token.line);
+        default:
+            return fail(parser);
+    }
+}
+
+// !=, <= and >= become the negated opposite, like the bytecode the single pass compiler writes
+static AstNode_t *binary(AstParser_t *parser, AstNode_t *left) {
+    TokenType_t op_type = parser->prev.type;
+    AstNode_t *right = parse_precedence(parser, (Precedence_t)(infix_precedence(op_type) + 1));
+    if (right == NULL) {
+        return NULL;
+    }
+    int line = parser->prev.line;
+    switch (op_type) {
+        case TOKEN_NOT_EQUAL:
+            return unary_node(parser, OP_NOT, binary_node(parser, OP_EQUAL, left, right, line),
+                              line);
+        case TOKEN_LESS_THAN_EQUAL:
+            return unary_node(parser, OP_NOT,
+                              binary_node(parser, OP_GREATER_THAN, left, right, line), line);
+        case TOKEN_GREATER_THAN_EQUAL:
+            return unary_node(parser, OP_NOT, binary_node(parser, OP_LESS_THAN, left, right, line),
+                              line);
+        case TOKEN_LESS_THAN:
+            return binary_node(parser, OP_LESS_THAN, left, right, line);
+        case TOKEN_GREATER_THAN:
+            return binary_node(parser, OP_GREATER_THAN, left, right, line);
+        case TOKEN_EQUAL_EQUAL:
+            return binary_node(parser, OP_EQUAL, left, right, line);
+        case TOKEN_ADD:
+            return binary_node(parser, OP_ADD, left, right, line);
+        case TOKEN_SUB:
+            return binary_node(parser, OP_SUB, left, right, line);
+        case TOKEN_MUL:
+            return binary_node(parser, OP_MUL, left, right, line);
+        case TOKEN_DIV:
+            return binary_node(parser, OP_DIV, left, right, line);
+        default:
+            return fail(parser);
+    }
+}
+
+static AstNode_t *parse_precedence(AstParser_t *parser, Precedence_t prec) {
+    go_next(parser);
+    bool can_assign = prec <= PREC_ASSIGN;
+    AstNode_t *node = parser->has_error ? NULL : prefix(parser, can_assign);
+    while (node != NULL && !parser->has_error && prec <= infix_precedence(parser->cur.type)) {
+        go_next(parser);
+        node = binary(parser, node);
+    }
+    if (node == NULL || parser->has_error) {
+        return fail(parser);
+    } else if (can_assign && parser->cur.type == TOKEN_EQUAL) {
+        return fail(parser); // invalid assignment target
+    }
+    return node;
+}
+
+static AstNode_t *expression(AstParser_t *parser) {
+    return parse_precedence(parser, PREC_ASSIGN);
+}
+
+// ------------------------ Statements ------------------------ //
+
+static bool let_declaration(AstParser_t *parser) {
+    if (!consume(parser, TOKEN_IDENTIFIER)) {
+        return false;
+    }
+    Token_t name = parser->prev;
+    AstNode_t *value = match(parser, TOKEN_EQUAL)
+                           ? expression(parser)
+                           : constant_node(parser, DECL_NONE_VAL, parser->prev.line);
+    if (value == NULL || !consume(parser, TOKEN_SEMICOLON)) {
+        return false;
+    }
+    add_stmt(parser->ast, (AstStmt_t){.kind = STMT_LET,
+                                      .line = parser->prev.line,
+                                      .name = allocate_str(parser->ast->vm, name.start,
+                                                           name.length),
+                                      .expr = value});
+    return true;
+}
+
+static bool statement(AstParser_t *parser) {
+    bool is_print = match(parser, TOKEN_PRINT);
+    AstNode_t *expr = expression(parser);
+    if (expr == NULL) {
+        return false;
+    }
+    StmtKind_t kind = is_print ? STMT_PRINT : STMT_EXPR;
+    if (!is_print && parser->tail_result && parser->cur.type == TOKEN_END_FILE) {
+        kind = STMT_RESULT;
+    } else if (!consume(parser, TOKEN_SEMICOLON)) {
+        return false;
+    }
+    add_stmt(parser->ast, (AstStmt_t){.kind = kind, .line = parser->prev.line, .expr = expr});
+    return true;
+}
+
+// false on any syntax error, nothing is reported and ast is left empty
+bool parse_ast(vm_t *vm, const char *code, bool tail_result, Ast_t *ast) {
+    *ast = (Ast_t){.vm = vm};
+    AstParser_t parser = {.has_error = false, .tail_result = tail_result, .ast = ast};
+    init_scanner(&parser.scanner, code);
+    go_next(&parser);
+    while (!parser.has_error && !match(&parser, TOKEN_END_FILE)) {
+        bool ok = match(&parser, TOKEN_LET) ? let_declaration(&parser) : statement(&parser);
+        if (!ok) {
+            parser.has_error = true;
+        }
+    }
+    if (parser.has_error) {
+        free_ast(ast);
+        return false;
+    }
+    ast->end_line = parser.prev.line;
+    return true;
+}
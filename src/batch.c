@@ -0,0 +1,165 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../includes/batch.h"
+#include "../includes/natives.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+// every worker owns a deque of job idxs. the owner pops from the front, idle workers steal from
+// the back so a worker stuck on a long script doesn't hold the rest of its share hostage
+typedef struct {
+    pthread_mutex_t lock;
+    int front;
+    int back; // one past the last job still queued
+} JobQueue_t;
+
+typedef struct {
+    const char **sources;
+    BatchResult_t *results;
+    JobQueue_t *queues;
+    int num_workers;
+    BatchFlags_t flags;
+    InternTable_t strings; // identifiers and literals common to the scripts are interned once
+} Batch_t;
+
+typedef struct {
+    Batch_t *batch;
+    int id;
+} Worker_t;
+
+int default_thread_count() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1 : (int)cpus;
+}
+
+static bool pop_front(JobQueue_t *queue, int *job) {
+    pthread_mutex_lock(&queue->lock);
+    bool found = queue->front < queue->back;
+    if (found) {
+        *job = queue->front++;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static bool steal_back(JobQueue_t *queue, int *job) {
+    pthread_mutex_lock(&queue->lock);
+    bool found = queue->front < queue->back;
+    if (found) {
+        *job = --queue->back;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+// jobs are never added once the batch starts so one empty sweep over every queue means we're done
+static bool next_job(Worker_t *worker, int *job) {
+    Batch_t *batch = worker->batch;
+    if (pop_front(&batch->queues[worker->id], job)) {
+        return true;
+    }
+    for (int i = 1; i < batch->num_workers; i++) {
+        int victim = (worker->id + i) % batch->num_workers;
+        if (steal_back(&batch->queues[victim], job)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// natives are the only objects a job starts with, mark is vm->objects right after defining them
+static void run_job(vm_t *vm, Object_t *mark, const char *source, BatchResult_t *result) {
+    FILE *out = open_memstream(&result->out, &result->out_length);
+    FILE *err = open_memstream(&result->err, &result->err_length);
+
+    set_output(vm, out, FLUSH_EXIT); // written to out in one go below
+    vm->err = err;
+    result->result = interpret(vm, source);
+    // back to stdout before out is closed, the writer flushes its stream even when it's empty
+    set_output(vm, stdout, FLUSH_EXIT);
+    vm->err = stderr;
+    // jobs can't see each other's variables, the next one starts from the natives again
+    reset_vm(vm, mark);
+
+    fclose(out);
+    fclose(err);
+}
+
+// one vm per worker for all of its jobs. literals live in the batch's shared table, so they
+// outlive every job and are freed with the batch
+static void *worker_loop(void *arg) {
+    Worker_t *worker = (Worker_t *)arg;
+    Batch_t *batch = worker->batch;
+    vm_t vm;
+    init_vm(&vm);
+    vm.shared_strings = &batch->strings;
+    define_natives(&vm);
+    vm.optimize = batch->flags.optimize;
+    vm.use_jit = batch->flags.use_jit;
+    Object_t *mark = vm.objects;
+
+    int job;
+    while (next_job(worker, &job)) {
+        run_job(&vm, mark, batch->sources[job], &batch->results[job]);
+    }
+    free_vm(&vm);
+    return NULL;
+}
+
+// runs every source from a clean vm across num_threads workers, results are in input order
+BatchResult_t *run_batch(const char **sources, int count, int num_threads, BatchFlags_t flags) {
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    if (num_threads > count) {
+        num_threads = count > 0 ? count : 1;
+    }
+
+    Batch_t batch;
+    batch.sources = sources;
+    batch.results = ALLOCATE(BatchResult_t, count);
+    batch.queues = ALLOCATE(JobQueue_t, num_threads);
+    batch.num_workers = num_threads;
+    batch.flags = flags;
+    init_intern_table(&batch.strings);
+
+    // hand out contiguous slices up front, stealing evens out whatever imbalance is left
+    for (int i = 0; i < num_threads; i++) {
+        pthread_mutex_init(&batch.queues[i].lock, NULL);
+        batch.queues[i].front = (int)((long)count * i / num_threads);
+        batch.queues[i].back = (int)((long)count * (i + 1) / num_threads);
+    }
+
+    pthread_t *threads = ALLOCATE(pthread_t, num_threads);
+    Worker_t *workers = ALLOCATE(Worker_t, num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].batch = &batch;
+        workers[i].id = i;
+        if (pthread_create(&threads[i], NULL, worker_loop, &workers[i]) != 0) {
+            fprintf(stderr, "Error: could not start batch worker %d\n", i);
+            exit(71);
+        }
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    // only safe once every worker is gone, a late thief may still be sweeping any queue
+    for (int i = 0; i < num_threads; i++) {
+        pthread_mutex_destroy(&batch.queues[i].lock);
+    }
+    free_intern_table(&batch.strings);
+
+    free(threads);
+    free(workers);
+    free(batch.queues);
+    return batch.results;
+}
+
+void free_batch_results(BatchResult_t *results, int count) {
+    for (int i = 0; i < count; i++) {
+        free(results[i].out);
+        free(results[i].err);
+    }
+    free(results);
+}
@@ -1,11 +1,55 @@
 #include "../includes/chunk.h"
 #include "../includes/memory.h"
 
+const OpInfo_t op_info[OP_COUNT] = {
+    [OP_CONSTANT] = {true, true, 0, 1, "OP_CONSTANT"},
+    [OP_NONE] = {false, false, 0, 1, "OP_NONE"},
+    [OP_TRUE] = {false, false, 0, 1, "OP_TRUE"},
+    [OP_FALSE] = {false, false, 0, 1, "OP_FALSE"},
+    [OP_NOT] = {false, false, 1, 1, "OP_NOT"},
+    [OP_NEGATE] = {false, false, 1, 1, "OP_NEGATE"},
+    [OP_ADD] = {false, false, 2, 1, "OP_ADD"},
+    [OP_ADD_NUM] = {false, false, 2, 1, "OP_ADD_NUM"},
+    [OP_ADD_STR] = {false, false, 2, 1, "OP_ADD_STR"},
+    [OP_ADD_ANY] = {false, false, 2, 1, "OP_ADD_ANY"},
+    [OP_SUB] = {false, false, 2, 1, "OP_SUB"},
+    [OP_MUL] = {false, false, 2, 1, "OP_MUL"},
+    [OP_DIV] = {false, false, 2, 1, "OP_DIV"},
+    [OP_EQUAL] = {false, false, 2, 1, "OP_EQUAL"},
+    [OP_GREATER_THAN] = {false, false, 2, 1, "OP_GREATER_THAN"},
+    [OP_LESS_THAN] = {false, false, 2, 1, "OP_LESS_THAN"},
+    [OP_PRINT] = {false, false, 1, 0, "OP_PRINT"},
+    [OP_POP] = {false, false, 1, 0, "OP_POP"},
+    [OP_DUP] = {false, false, 1, 2, "OP_DUP"},
+    [OP_DEFINE_GLOBAL] = {true, true, 1, 0, "OP_DEFINE_GLOBAL"},
+    [OP_GET_GLOBAL] = {true, true, 0, 1, "OP_GET_GLOBAL"},
+    [OP_SET_GLOBAL] = {true, true, 1, 1, "OP_SET_GLOBAL"},
+    [OP_GET_SLOT] = {true, false, 0, 1, "OP_GET_SLOT"},
+    [OP_SET_SLOT] = {true, false, 1, 1, "OP_SET_SLOT"},
+    [OP_JUMP] = {true, false, 0, 0, "OP_JUMP", 1},
+    [OP_JUMP_IF_FALSE] = {true, false, 1, 0, "OP_JUMP_IF_FALSE", 1},
+    [OP_JUMP_IF_TRUE] = {true, false, 1, 0, "OP_JUMP_IF_TRUE", 1},
+    [OP_LOOP] = {true, false, 0, 0, "OP_LOOP", -1},
+    [OP_JUMP_IF_FALSE_OR_POP] = {true, false, 1, 0, "OP_JUMP_IF_FALSE_OR_POP", 1},
+    [OP_JUMP_IF_TRUE_OR_POP] = {true, false, 1, 0, "OP_JUMP_IF_TRUE_OR_POP", 1},
+    [OP_JUMP_IF_NOT_LESS] = {true, false, 2, 0, "OP_JUMP_IF_NOT_LESS", 1},
+    [OP_JUMP_IF_NOT_GREATER] = {true, false, 2, 0, "OP_JUMP_IF_NOT_GREATER", 1},
+    [OP_JUMP_IF_LESS] = {true, false, 2, 0, "OP_JUMP_IF_LESS", 1},
+    [OP_JUMP_IF_GREATER] = {true, false, 2, 0, "OP_JUMP_IF_GREATER", 1},
+    [OP_CALL] = {true, false, 1, 1, "OP_CALL"}, // pops the arguments too, see op_pops()
+    [OP_TAIL_CALL] = {true, false, 1, 1, "OP_TAIL_CALL"},
+    [OP_RETURN] = {false, false, 0, 0, "OP_RETURN"},
+};
+
 // init method for a new chunk
 void init_chunk(Chunk_t *chunk) {
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
+    chunk->max_stack = 0;
+    chunk->arity = -1;
+    chunk->cache_base = 0;
+    chunk->verified = false;
     init_value_array(&chunk->constants);
     init_line_run_array(&chunk->line_runs);
 }
@@ -37,16 +81,106 @@ int add_constant(Chunk_t *chunk, Value_t value) {
     return chunk->constants.count - 1;
 }
 
+void write_operand(Chunk_t *chunk, int operand, int line) {
+    do {
+        uint8_t byte = operand & 0x7F;
+        operand >>= 7;
+        write_chunk(chunk, operand == 0 ? byte : (byte | 0x80), line);
+    } while (operand != 0);
+}
+
 // helper method to write constants so we don't need to do separate write_chunk() calls
 void write_constant(Chunk_t *chunk, Value_t value, int line) {
     int idx = add_constant(chunk, value);
-    if (idx <= 255) {
-        write_chunk(chunk, OP_CONSTANT, line);
-        write_chunk(chunk, idx, line);
-    } else {
-        write_chunk(chunk, OP_CONSTANT_LONG, line);
-        write_chunk(chunk, idx & 0xFF, line);         // lowest 8 bits
-        write_chunk(chunk, (idx >> 8) & 0xFF, line);  // middle 8 bits
-        write_chunk(chunk, (idx >> 16) & 0xFF, line); // front 8 bits
+    write_chunk(chunk, OP_CONSTANT, line);
+    write_operand(chunk, idx, line);
+}
+
+// writes op with a placeholder distance, returns where the distance goes for patch_jump_operand()
+int write_jump(Chunk_t *chunk, OpCode_t op, int line) {
+    write_chunk(chunk, op, line);
+    int at = chunk->count;
+    for (int i = 0; i < OPERAND_MAX_BYTES; i++) {
+        write_chunk(chunk, i + 1 < OPERAND_MAX_BYTES ? 0x80 : 0, line);
+    }
+    return at;
+}
+
+void patch_jump_operand(Chunk_t *chunk, int at, int distance) {
+    for (int i = 0; i < OPERAND_MAX_BYTES; i++) {
+        uint8_t byte = (distance >> (7 * i)) & 0x7F;
+        chunk->code[at + i] = i + 1 < OPERAND_MAX_BYTES ? (byte | 0x80) : byte;
+    }
+}
+
+// drops every byte from count on, for compilers replacing the instructions they just wrote
+void truncate_chunk(Chunk_t *chunk, int count) {
+    LineRunArray_t *runs = &chunk->line_runs;
+    while (chunk->count > count) {
+        chunk->count--;
+        if (--runs->line_runs[runs->count - 1].count == 0) {
+            runs->count--;
+        }
+    }
+}
+
+// opcode plus operand bytes
+int instruction_length(uint8_t *code) {
+    uint8_t *pc = code + 1;
+    if (op_info[*code].has_operand) {
+        read_operand(&pc);
+    }
+    return (int)(pc - code);
+}
+
+// offset the jump at offset lands on, -1 if it isn't a jump. a bad backward jump can come out
+// negative too, check op_info[op].jump to tell jumps apart
+int jump_target(Chunk_t *chunk, int offset) {
+    int direction = op_info[chunk->code[offset]].jump;
+    if (direction == 0) {
+        return -1;
+    }
+    uint8_t *pc = &chunk->code[offset + 1];
+    int distance = read_operand(&pc);
+    return (int)(pc - chunk->code) + direction * distance;
+}
+
+// follows every path through the chunk once, jumps included. the compilers only join paths at the
+// same depth (verify_chunk() checks that), so the first depth seen at an instruction is its depth.
+// code with compile errors can pop more than it pushed, paths are followed no further from there
+int max_stack_depth(Chunk_t *chunk) {
+    int *depths = ALLOCATE(int, chunk->count);
+    int *pending = ALLOCATE(int, chunk->count);
+    for (int i = 0; i < chunk->count; i++) {
+        depths[i] = -1;
+    }
+    int num_pending = 0;
+    int entry_depth = chunk->arity > 0 ? chunk->arity : 0;
+    int max_depth = entry_depth;
+    if (chunk->count > 0) {
+        depths[0] = entry_depth;
+        pending[num_pending++] = 0;
+    }
+    while (num_pending > 0) {
+        int offset = pending[--num_pending];
+        uint8_t op = chunk->code[offset];
+        int depth = depths[offset] - instruction_pops(&chunk->code[offset]) + op_info[op].pushes;
+        max_depth = depth > max_depth ? depth : max_depth;
+
+        int next = offset + instruction_length(&chunk->code[offset]);
+        int targets[2] = {next, jump_target(chunk, offset)};
+        bool taken[2] = {!ends_block(op), op_info[op].jump != 0};
+        int target_depths[2] = {depth, jump_depth(op, depths[offset])};
+        for (int i = 0; i < 2; i++) {
+            // -1 from jump_target() can also be a backward jump off the front, never follow it
+            if (taken[i] && targets[i] >= 0 && targets[i] < chunk->count &&
+                depths[targets[i]] < 0 && target_depths[i] >= 0) {
+                depths[targets[i]] = target_depths[i];
+                pending[num_pending++] = targets[i];
+            }
+        }
     }
+    free(depths);
+    free(pending);
+    return max_depth;
 }
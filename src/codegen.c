@@ -0,0 +1,107 @@
+#include "../includes/ast.h"
+#include "../includes/hash_table.h"
+
+// lowers an (optimized) ast to bytecode. the result is the same shape the single pass compiler
+// writes, plus OP_GET_SLOT / OP_SET_SLOT for common subexpressions kept in temp slots
+
+typedef struct {
+    Chunk_t *chunk;
+    HashTable_t ids; // global name -> constant idx so each name is only stored once
+} CodeGen_t;
+
+static void emit_byte(CodeGen_t *gen, uint8_t byte, int line) {
+    write_chunk(gen->chunk, byte, line);
+}
+
+static void emit_operand_op(CodeGen_t *gen, OpCode_t op, int operand, int line) {
+    write_chunk(gen->chunk, op, line);
+    write_operand(gen->chunk, operand, line);
+}
+
+static int name_constant(CodeGen_t *gen, ObjectStr_t *name) {
+    Value_t *existing = get(&gen->ids, name);
+    if (existing != NULL) {
+        return (int)GET_NUM_VAL(*existing);
+    }
+    int idx = add_constant(gen->chunk, DECL_OBJ_VAL(name));
+    insert(&gen->ids, name, DECL_NUM_VAL(idx));
+    return idx;
+}
+
+static void generate_expr(CodeGen_t *gen, AstNode_t *node) {
+    switch (node->kind) {
+        case AST_CONSTANT:
+            if (IS_NONE_VAL(node->value)) {
+                emit_byte(gen, OP_NONE, node->line);
+            } else if (IS_BOOL_VAL(node->value)) {
+                emit_byte(gen, GET_BOOL_VAL(node->value) ? OP_TRUE : OP_FALSE, node->line);
+            } else {
+                write_constant(gen->chunk, node->value, node->line);
+            }
+            break;
+        case AST_GET_GLOBAL:
+            emit_operand_op(gen, OP_GET_GLOBAL, name_constant(gen, node->name), node->line);
+            break;
+        case AST_SET_GLOBAL:
+            generate_expr(gen, node->left);
+            emit_operand_op(gen, OP_SET_GLOBAL, name_constant(gen, node->name), node->line);
+            break;
+        case AST_UNARY:
+            generate_expr(gen, node->left);
+            emit_byte(gen, node->op, node->line);
+            break;
+        case AST_BINARY:
+            generate_expr(gen, node->left);
+            generate_expr(gen, node->right);
+            emit_byte(gen, node->op, node->line);
+            break;
+        case AST_SET_TEMP:
+            generate_expr(gen, node->left);
+            emit_operand_op(gen, OP_SET_SLOT, node->slot, node->line);
+            break;
+        case AST_GET_TEMP:
+            emit_operand_op(gen, OP_GET_SLOT, node->slot, node->line);
+            break;
+    }
+}
+
+// temps are reserved below everything the statement pushes; statements start on an empty stack so
+// temp k lives in slot k
+static void generate_stmt(CodeGen_t *gen, AstStmt_t *stmt) {
+    for (int i = 0; i < stmt->num_temps; i++) {
+        emit_byte(gen, OP_NONE, stmt->line);
+    }
+    generate_expr(gen, stmt->expr);
+    switch (stmt->kind) {
+        case STMT_PRINT:
+            emit_byte(gen, OP_PRINT, stmt->line);
+            break;
+        case STMT_EXPR:
+            emit_byte(gen, OP_POP, stmt->line);
+            break;
+        case STMT_LET:
+            emit_operand_op(gen, OP_DEFINE_GLOBAL, name_constant(gen, stmt->name), stmt->line);
+            break;
+        case STMT_RESULT:
+            // the result has to end up where the temps started
+            if (stmt->num_temps > 0) {
+                emit_operand_op(gen, OP_SET_SLOT, 0, stmt->line);
+            }
+            break;
+    }
+    for (int i = 0; i < stmt->num_temps; i++) {
+        emit_byte(gen, OP_POP, stmt->line);
+    }
+}
+
+void generate_code(Ast_t *ast, Chunk_t *chunk) {
+    CodeGen_t gen;
+    gen.chunk = chunk;
+    init_hash_table(&gen.ids);
+    for (int i = 0; i < ast->count; i++) {
+        generate_stmt(&gen, &ast->stmts[i]);
+    }
+    emit_byte(&gen, OP_RETURN, ast->end_line);
+    chunk->max_stack = max_stack_depth(chunk);
+    free_hash_table(&gen.ids);
+}
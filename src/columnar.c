@@ -0,0 +1,486 @@
+#include "../includes/columnar.h"
+#include "../includes/memory.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// columnar ("vector") execution of a program: every opcode runs once per block of rows instead of
+// once per row. only straight-line expression chunks qualify, anything else (prints, stores,
+// strings) runs row by row through run_program()
+
+// one stack slot: an unboxed double column when every lane is a number, boxed values otherwise.
+// int lanes are unboxed too, flagged in ints with the exact value in int_vals and the nearest double
+// in nums: an int mixed with a double is done in doubles, int op int runs the int kernels
+typedef struct {
+    bool is_num;
+    bool any_ints; // false when no lane is flagged in ints, while is_num
+    double nums[COLUMN_BLOCK];
+    bool ints[COLUMN_BLOCK];        // while is_num
+    int64_t int_vals[COLUMN_BLOCK]; // 0 in lanes that aren't ints
+    Value_t values[COLUMN_BLOCK];
+} VecSlot_t;
+
+typedef struct {
+    int count;                   // rows in the current block
+    bool failed[COLUMN_BLOCK];   // lanes that hit a type error, rerun on the scalar path
+    bool overflow[COLUMN_BLOCK]; // scratch for the int kernels
+    VecSlot_t *stack;
+    VecSlot_t *top;
+} VecMachine_t;
+
+// ------------------------ Kernels ------------------------ //
+#ifdef __SSE2__
+#define ARITH_KERNEL(name, simd_op, op)                                                            \
+    static void name(const double *a, const double *b, double *out, int count) {                   \
+        int i = 0;                                                                                 \
+        for (; i + 2 <= count; i += 2) {                                                           \
+            _mm_storeu_pd(out + i, simd_op(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));             \
+        }                                                                                          \
+        for (; i < count; i++) {                                                                   \
+            out[i] = a[i] op b[i];                                                                 \
+        }                                                                                          \
+    }
+
+#define COMPARE_KERNEL(name, simd_op, op)                                                          \
+    static void name(const double *a, const double *b, Value_t *out, int count) {                  \
+        int i = 0;                                                                                 \
+        for (; i + 2 <= count; i += 2) {                                                           \
+            int mask = _mm_movemask_pd(simd_op(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));         \
+            out[i] = DECL_BOOL_VAL((mask & 1) != 0);                                               \
+            out[i + 1] = DECL_BOOL_VAL((mask & 2) != 0);                                           \
+        }                                                                                          \
+        for (; i < count; i++) {                                                                   \
+            out[i] = DECL_BOOL_VAL(a[i] op b[i]);                                                  \
+        }                                                                                          \
+    }
+#else
+#define ARITH_KERNEL(name, simd_op, op)                                                            \
+    static void name(const double *a, const double *b, double *out, int count) {                   \
+        for (int i = 0; i < count; i++) {                                                          \
+            out[i] = a[i] op b[i];                                                                 \
+        }                                                                                          \
+    }
+
+#define COMPARE_KERNEL(name, simd_op, op)                                                          \
+    static void name(const double *a, const double *b, Value_t *out, int count) {                  \
+        for (int i = 0; i < count; i++) {                                                          \
+            out[i] = DECL_BOOL_VAL(a[i] op b[i]);                                                  \
+        }                                                                                          \
+    }
+#endif
+
+// int op int, with the same overflow checks as the scalar path. overflow[i] is set where the result
+// isn't an int, out[i] is garbage there and the lane keeps the double result. out may be a, so the
+// scalar loops go through a local: the overflow builtins misreport when the result aliases an input
+#define SCALAR_INT_KERNEL(name, int_op)                                                            \
+    static void name(const int64_t *a, const int64_t *b, int64_t *out, bool *overflow,             \
+                     int count) {                                                                  \
+        for (int i = 0; i < count; i++) {                                                          \
+            int64_t result;                                                                        \
+            overflow[i] = int_op(a[i], b[i], &result);                                             \
+            out[i] = result;                                                                       \
+        }                                                                                          \
+    }
+
+#ifdef __SSE2__
+// 64-bit lanes add and sub in SSE2 but only compare in SSE4.2, so overflow is read off the sign bits
+// of overflow_bits (a function of x, y and the wrapped result r) with movmskpd
+#define INT_KERNEL(name, simd_op, overflow_bits, int_op)                                           \
+    static void name(const int64_t *a, const int64_t *b, int64_t *out, bool *overflow,             \
+                     int count) {                                                                  \
+        int i = 0;                                                                                 \
+        for (; i + 2 <= count; i += 2) {                                                           \
+            __m128i x = _mm_loadu_si128((const __m128i *)(a + i));                                 \
+            __m128i y = _mm_loadu_si128((const __m128i *)(b + i));                                 \
+            __m128i r = simd_op(x, y);                                                             \
+            _mm_storeu_si128((__m128i *)(out + i), r);                                             \
+            int mask = _mm_movemask_pd(_mm_castsi128_pd(overflow_bits));                           \
+            overflow[i] = (mask & 1) != 0;                                                         \
+            overflow[i + 1] = (mask & 2) != 0;                                                     \
+        }                                                                                          \
+        for (; i < count; i++) {                                                                   \
+            int64_t result;                                                                        \
+            overflow[i] = int_op(a[i], b[i], &result);                                             \
+            out[i] = result;                                                                       \
+        }                                                                                          \
+    }
+#else
+#define INT_KERNEL(name, simd_op, overflow_bits, int_op) SCALAR_INT_KERNEL(name, int_op)
+#endif
+
+ARITH_KERNEL(add_kernel, _mm_add_pd, +)
+ARITH_KERNEL(sub_kernel, _mm_sub_pd, -)
+ARITH_KERNEL(mul_kernel, _mm_mul_pd, *)
+ARITH_KERNEL(div_kernel, _mm_div_pd, /)
+COMPARE_KERNEL(greater_kernel, _mm_cmpgt_pd, >)
+COMPARE_KERNEL(less_kernel, _mm_cmplt_pd, <)
+// a sum overflowed when it has the opposite sign of both operands, a difference when the operands
+// differ in sign and the result's sign differs from the minuend's
+INT_KERNEL(add_int_kernel, _mm_add_epi64, _mm_and_si128(_mm_xor_si128(x, r), _mm_xor_si128(y, r)),
+           __builtin_add_overflow)
+INT_KERNEL(sub_int_kernel, _mm_sub_epi64, _mm_and_si128(_mm_xor_si128(x, y), _mm_xor_si128(x, r)),
+           __builtin_sub_overflow)
+SCALAR_INT_KERNEL(mul_int_kernel, __builtin_mul_overflow) // no 64-bit multiply before AVX-512
+SCALAR_INT_KERNEL(div_int_kernel, div_ints)
+
+typedef void (*ArithKernel_t)(const double *a, const double *b, double *out, int count);
+typedef void (*IntKernel_t)(const int64_t *a, const int64_t *b, int64_t *out, bool *overflow,
+                            int count);
+typedef void (*CompareKernel_t)(const double *a, const double *b, Value_t *out, int count);
+
+// ------------------------ Slot Helpers ------------------------ //
+
+static Value_t box_lane(VecSlot_t *slot, int i) {
+    return slot->ints[i] ? DECL_INT_VAL(slot->int_vals[i]) : DECL_NUM_VAL(slot->nums[i]);
+}
+
+static void unbox_lane(VecSlot_t *slot, int i, Value_t value) {
+    slot->nums[i] = GET_NUMBER_VAL(value);
+    slot->ints[i] = IS_INT_VAL(value);
+    slot->int_vals[i] = slot->ints[i] ? GET_INT_VAL(value) : 0;
+    slot->any_ints = slot->any_ints || slot->ints[i];
+}
+
+// lanes that aren't numbers are marked failed and read as 0 so the kernels can run branch free
+static const double *as_nums(VecMachine_t *machine, VecSlot_t *slot) {
+    if (!slot->is_num) {
+        slot->any_ints = false;
+        for (int i = 0; i < machine->count; i++) {
+            Value_t value = slot->values[i];
+            if (IS_NUMBER_VAL(value)) {
+                unbox_lane(slot, i, value);
+            } else {
+                unbox_lane(slot, i, DECL_NUM_VAL(0));
+                machine->failed[i] = true;
+            }
+        }
+        slot->is_num = true;
+    }
+    return slot->nums;
+}
+
+static const Value_t *as_values(VecMachine_t *machine, VecSlot_t *slot) {
+    if (slot->is_num) {
+        for (int i = 0; i < machine->count; i++) {
+            slot->values[i] = box_lane(slot, i);
+        }
+        slot->is_num = false;
+    }
+    return slot->values;
+}
+
+static void broadcast(VecMachine_t *machine, Value_t value) {
+    VecSlot_t *slot = machine->top++;
+    slot->is_num = IS_NUMBER_VAL(value);
+    slot->any_ints = false;
+    for (int i = 0; i < machine->count; i++) {
+        if (slot->is_num) {
+            unbox_lane(slot, i, value);
+        } else {
+            slot->values[i] = value;
+        }
+    }
+}
+
+// int op int has int semantics: exact where the int kernel didn't overflow, otherwise the double
+// result the double kernel already left in a->nums (same as the scalar path)
+static void int_lanes(VecMachine_t *machine, VecSlot_t *a, VecSlot_t *b, IntKernel_t kernel) {
+    if (!a->any_ints || !b->any_ints) {
+        memset(a->ints, 0, sizeof(bool) * machine->count);
+        memset(a->int_vals, 0, sizeof(int64_t) * machine->count);
+        a->any_ints = false;
+        return;
+    }
+    kernel(a->int_vals, b->int_vals, a->int_vals, machine->overflow, machine->count);
+    a->any_ints = false;
+    for (int i = 0; i < machine->count; i++) {
+        a->ints[i] = a->ints[i] && b->ints[i] && !machine->overflow[i];
+        a->int_vals[i] = a->ints[i] ? a->int_vals[i] : 0;
+        if (a->ints[i]) {
+            a->nums[i] = (double)a->int_vals[i];
+            a->any_ints = true;
+        }
+    }
+}
+
+static void load_column(VecMachine_t *machine, const Column_t *column, int first_row) {
+    VecSlot_t *slot = machine->top++;
+    if (column->nums != NULL) {
+        memcpy(slot->nums, column->nums + first_row, sizeof(double) * machine->count);
+        memset(slot->ints, 0, sizeof(bool) * machine->count);
+        memset(slot->int_vals, 0, sizeof(int64_t) * machine->count);
+        slot->is_num = true;
+        slot->any_ints = false;
+        return;
+    }
+    memcpy(slot->values, column->values + first_row, sizeof(Value_t) * machine->count);
+    slot->is_num = false;
+
+    // unbox up front when the whole block happens to be numeric so the kernels can take it
+    for (int i = 0; i < machine->count; i++) {
+        if (!IS_NUMBER_VAL(slot->values[i])) {
+            return;
+        }
+    }
+    as_nums(machine, slot);
+}
+
+static void arith(VecMachine_t *machine, ArithKernel_t kernel, IntKernel_t int_kernel) {
+    VecSlot_t *b = --machine->top;
+    VecSlot_t *a = machine->top - 1;
+    const double *b_nums = as_nums(machine, b);
+    const double *a_nums = as_nums(machine, a);
+    kernel(a_nums, b_nums, a->nums, machine->count);
+    int_lanes(machine, a, b, int_kernel);
+}
+
+// ints past 2^53 don't survive the trip through doubles, so int pairs are redone exactly
+static void compare(VecMachine_t *machine, CompareKernel_t kernel, bool greater) {
+    VecSlot_t *b = --machine->top;
+    VecSlot_t *a = machine->top - 1;
+    const double *b_nums = as_nums(machine, b);
+    const double *a_nums = as_nums(machine, a);
+    kernel(a_nums, b_nums, a->values, machine->count);
+    if (a->any_ints && b->any_ints) {
+        for (int i = 0; i < machine->count; i++) {
+            if (a->ints[i] && b->ints[i]) {
+                a->values[i] = DECL_BOOL_VAL(greater ? a->int_vals[i] > b->int_vals[i]
+                                                     : a->int_vals[i] < b->int_vals[i]);
+            }
+        }
+    }
+    a->is_num = false;
+}
+
+// ------------------------ Planning ------------------------ //
+
+// the vector machine only knows straight-line expression code; also works out how deep it gets
+static bool can_vectorize(Chunk_t *chunk, int *max_depth) {
+    int depth = 0;
+    *max_depth = 0;
+    uint8_t *pc = chunk->code;
+    while (true) {
+        switch (*pc) {
+            case OP_CONSTANT:
+            case OP_GET_GLOBAL:
+            case OP_NONE:
+            case OP_TRUE:
+            case OP_FALSE:
+                depth++;
+                break;
+            case OP_NOT:
+            case OP_NEGATE:
+                break;
+            case OP_ADD:
+            case OP_ADD_NUM:
+            case OP_ADD_STR:
+            case OP_ADD_ANY:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_EQUAL:
+            case OP_GREATER_THAN:
+            case OP_LESS_THAN:
+                depth--;
+                break;
+            case OP_RETURN:
+                return true;
+            default:
+                return false;
+        }
+        pc += instruction_length(pc);
+        if (depth > *max_depth) {
+            *max_depth = depth;
+        }
+    }
+}
+
+static int param_slot(Program_t *program, ObjectStr_t *name) {
+    for (int i = 0; i < program->num_params; i++) {
+        if (program->params[i] == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// globals that aren't params can't change during the batch (vector code has no stores) so they are
+// read once up front. false if one isn't defined, the scalar path reports that error per row
+static bool resolve_global(vm_t *vm, Program_t *program, ObjectStr_t *name) {
+    return param_slot(program, name) >= 0 || get(&vm->globals, name) != NULL;
+}
+
+static bool resolve_globals(vm_t *vm, Program_t *program) {
+    Chunk_t *chunk = &program->chunk;
+    uint8_t *pc = chunk->code;
+    while (*pc != OP_RETURN) {
+        if (*pc == OP_GET_GLOBAL) {
+            uint8_t *operand = pc + 1;
+            int idx = read_operand(&operand);
+            if (!resolve_global(vm, program, GET_STR_VAL(chunk->constants.values[idx]))) {
+                return false;
+            }
+        }
+        pc += instruction_length(pc);
+    }
+    return true;
+}
+
+// ------------------------ Execution ------------------------ //
+
+static void load_global(vm_t *vm, VecMachine_t *machine, Program_t *program,
+                        const Column_t *columns, int first_row, int idx) {
+    ObjectStr_t *name = GET_STR_VAL(program->chunk.constants.values[idx]);
+    int slot = param_slot(program, name);
+    if (slot >= 0) {
+        load_column(machine, &columns[slot], first_row);
+    } else {
+        broadcast(machine, *get(&vm->globals, name));
+    }
+}
+
+static void run_block(vm_t *vm, VecMachine_t *machine, Program_t *program,
+                      const Column_t *columns, int first_row) {
+    Chunk_t *chunk = &program->chunk;
+    uint8_t *pc = chunk->code;
+    machine->top = machine->stack;
+
+    while (true) {
+        uint8_t instruction;
+        switch (instruction = *pc++) {
+            case OP_CONSTANT:
+                broadcast(machine, chunk->constants.values[read_operand(&pc)]);
+                break;
+            case OP_NONE:
+                broadcast(machine, DECL_NONE_VAL);
+                break;
+            case OP_TRUE:
+                broadcast(machine, DECL_BOOL_VAL(true));
+                break;
+            case OP_FALSE:
+                broadcast(machine, DECL_BOOL_VAL(false));
+                break;
+            case OP_GET_GLOBAL:
+                load_global(vm, machine, program, columns, first_row, read_operand(&pc));
+                break;
+            case OP_ADD:
+            case OP_ADD_NUM:
+            case OP_ADD_STR:
+            case OP_ADD_ANY:
+                // strings end up as failed lanes and get concatenated by the scalar rerun
+                arith(machine, add_kernel, add_int_kernel);
+                break;
+            case OP_SUB:
+                arith(machine, sub_kernel, sub_int_kernel);
+                break;
+            case OP_MUL:
+                arith(machine, mul_kernel, mul_int_kernel);
+                break;
+            case OP_DIV:
+                arith(machine, div_kernel, div_int_kernel);
+                break;
+            case OP_GREATER_THAN:
+                compare(machine, greater_kernel, true);
+                break;
+            case OP_LESS_THAN:
+                compare(machine, less_kernel, false);
+                break;
+            case OP_EQUAL: {
+                VecSlot_t *b = --machine->top;
+                VecSlot_t *a = machine->top - 1;
+                const Value_t *b_values = as_values(machine, b);
+                const Value_t *a_values = as_values(machine, a);
+                for (int i = 0; i < machine->count; i++) {
+                    a->values[i] = DECL_BOOL_VAL(equals(a_values[i], b_values[i]));
+                }
+                break;
+            }
+            case OP_NOT: {
+                VecSlot_t *a = machine->top - 1;
+                const Value_t *a_values = as_values(machine, a);
+                for (int i = 0; i < machine->count; i++) {
+                    a->values[i] = DECL_BOOL_VAL(is_falsey(a_values[i]));
+                }
+                break;
+            }
+            case OP_NEGATE: {
+                VecSlot_t *a = machine->top - 1;
+                const double *a_nums = as_nums(machine, a);
+                for (int i = 0; i < machine->count; i++) {
+                    a->nums[i] = -a_nums[i];
+                    // -INT64_MIN isn't an int, it stays the negated double like negate_number()
+                    if (a->ints[i] && a->int_vals[i] != INT64_MIN) {
+                        a->int_vals[i] = -a->int_vals[i];
+                    } else {
+                        a->ints[i] = false;
+                        a->int_vals[i] = 0;
+                    }
+                }
+                break;
+            }
+            case OP_RETURN:
+                return;
+        }
+    }
+}
+
+static InterpretResult_t run_row(vm_t *vm, Program_t *program, const Column_t *columns, int row,
+                                 Value_t *bindings, Value_t *result) {
+    for (int i = 0; i < program->num_params; i++) {
+        bindings[i] = columns[i].nums != NULL ? DECL_NUM_VAL(columns[i].nums[row])
+                                              : columns[i].values[row];
+    }
+    return run_program(vm, program, bindings, result);
+}
+
+// evaluates program once per row with params bound from columns (one column per param, in param
+// order). results[row] gets each row's value; statuses (optional) each row's outcome
+InterpretResult_t run_program_columns(vm_t *vm, Program_t *program, const Column_t *columns,
+                                      int num_rows, Value_t *results,
+                                      InterpretResult_t *statuses) {
+    InterpretResult_t overall = INTERPRET_OK;
+    Value_t *bindings = ALLOCATE(Value_t, program->num_params);
+
+    int max_depth;
+    bool vectorize = can_vectorize(&program->chunk, &max_depth) && resolve_globals(vm, program);
+    VecMachine_t machine;
+    machine.stack = vectorize ? ALLOCATE(VecSlot_t, max_depth > 0 ? max_depth : 1) : NULL;
+    machine.top = machine.stack;
+
+    for (int first_row = 0; first_row < num_rows; first_row += COLUMN_BLOCK) {
+        int count = num_rows - first_row < COLUMN_BLOCK ? num_rows - first_row : COLUMN_BLOCK;
+        machine.count = count;
+        for (int i = 0; i < count; i++) {
+            machine.failed[i] = !vectorize;
+        }
+
+        if (vectorize) {
+            run_block(vm, &machine, program, columns, first_row);
+        }
+
+        for (int i = 0; i < count; i++) {
+            int row = first_row + i;
+            InterpretResult_t status = INTERPRET_OK;
+            if (machine.failed[i]) {
+                status = run_row(vm, program, columns, row, bindings, &results[row]);
+            } else if (machine.top == machine.stack) {
+                results[row] = DECL_NONE_VAL;
+            } else {
+                VecSlot_t *top = machine.top - 1;
+                results[row] = top->is_num ? box_lane(top, i) : top->values[i];
+            }
+
+            if (statuses != NULL) {
+                statuses[row] = status;
+            }
+            if (status != INTERPRET_OK) {
+                overall = status;
+            }
+        }
+    }
+
+    free(machine.stack);
+    free(bindings);
+    return overall;
+}
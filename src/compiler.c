@@ -1,76 +1,346 @@
 #include "../includes/compiler.h"
 #include "../includes/hash_table.h"
 #include "../includes/object.h"
+#include "../includes/optimizer.h"
+#include "../includes/vm.h"
+
+static void go_next(Compiler_t *compiler);
+static void expression(Compiler_t *compiler);
+static void consume(Compiler_t *compiler, TokenType_t type, const char *msg);
+static void report_error(Compiler_t *compiler, Token_t *token, const char *msg);
+static void stop_compiler(Compiler_t *compiler);
+
+static void number(Compiler_t *compiler, bool can_assign);
+static void grouping(Compiler_t *compiler, bool can_assign);
+static void unary(Compiler_t *compiler, bool can_assign);
+static void binary(Compiler_t *compiler, bool can_assign);
+static void and_(Compiler_t *compiler, bool can_assign);
+static void or_(Compiler_t *compiler, bool can_assign);
+static void literal(Compiler_t *compiler, bool can_assign);
+static void string(Compiler_t *compiler, bool can_assign);
+static void let(Compiler_t *compiler, bool can_assign);
+static void call(Compiler_t *compiler, bool can_assign);
+static void parse_precedence(Compiler_t *compiler, Precedence_t prec);
+
+static bool match(Compiler_t *compiler, TokenType_t type);
+static bool check(Compiler_t *compiler, TokenType_t type);
+static void statement(Compiler_t *compiler);
+static void declaration(Compiler_t *compiler);
+static void let_declaration(Compiler_t *compiler);
+static int parse_let(Compiler_t *compiler, const char *msg);
+
+static void init_func_state(Compiler_t *compiler, FuncState_t *func, ObjectFunc_t *function,
+                            Chunk_t *chunk) {
+    func->enclosing = compiler->func;
+    func->function = function;
+    func->chunk = chunk;
+    init_hash_table(&func->ids);
+    func->last_op = -1;
+    func->prev_op = -1;
+    func->last_target = 0;
+    func->landing = -1;
+    func->num_locals = 0;
+    func->scope_depth = 0;
+    compiler->func = func;
+}
+
+static bool compile_single_pass(vm_t *vm, const char *code, Chunk_t *chunk, bool tail_result) {
+    Compiler_t compiler;
+    compiler.vm = vm;
+    compiler.tail_result = tail_result;
+    compiler.func = NULL;
+    FuncState_t script;
+    init_func_state(&compiler, &script, NULL, chunk);
+    init_scanner(&compiler.scanner, code);
+    compiler.parser.has_error = false;
+    compiler.parser.is_panicking = false;
+    go_next(&compiler);
+    while (!match(&compiler, TOKEN_END_FILE)) {
+        declaration(&compiler);
+    }
+    stop_compiler(&compiler);
+    return !compiler.parser.has_error;
+}
+
+// functions are declared at the top level only, so they're all constants of the script's chunk
+static ObjectFunc_t *function_constant(Chunk_t *chunk, int idx) {
+    Value_t value = chunk->constants.values[idx];
+    return IS_FUNC(value) ? GET_FUNC_VAL(value) : NULL;
+}
+
+// the script and its functions share the vm's global cache, each gets its own range of it
+static void assign_cache_bases(Chunk_t *chunk) {
+    int base = 0;
+    for (int i = 0; i < chunk->constants.count; i++) {
+        ObjectFunc_t *function = function_constant(chunk, i);
+        if (function != NULL) {
+            function->chunk.cache_base = base;
+            base += function->chunk.constants.count;
+        }
+    }
+    chunk->cache_base = base;
+}
+
+static bool compile_source(vm_t *vm, const char *code, Chunk_t *chunk, bool tail_result) {
+    // -O goes through the ast pipeline. it silently gives up on anything it can't parse, so
+    // programs with errors still get compiled (and reported) by the single pass compiler
+    bool compiled = vm->optimize && compile_optimized(vm, code, chunk, tail_result);
+    if (!compiled) {
+        compiled = compile_single_pass(vm, code, chunk, tail_result);
+        if (compiled && vm->optimize) {
+            optimize_chunk(chunk);
+            for (int i = 0; i < chunk->constants.count; i++) {
+                ObjectFunc_t *function = function_constant(chunk, i);
+                if (function != NULL) {
+                    optimize_chunk(&function->chunk);
+                }
+            }
+        }
+    }
+    if (!compiled) {
+        return false;
+    }
+    assign_cache_bases(chunk);
+    if (vm->listing != NULL) {
+        const char *title = vm->optimize ? "Optimized code" : "Code";
+        for (int i = 0; i < chunk->constants.count; i++) {
+            ObjectFunc_t *function = function_constant(chunk, i);
+            if (function != NULL) {
+                char name[64];
+                snprintf(name, sizeof(name), "%s %.40s()", title, function->name->chars);
+                disassemble_chunk(vm->listing, &function->chunk, name);
+            }
+        }
+        disassemble_chunk(vm->listing, chunk, title);
+        flush_writer(vm->listing);
+    }
+    return true;
+}
+
+bool compile(vm_t *vm, const char *code, Chunk_t *chunk) {
+    return compile_source(vm, code, chunk, false);
+}
 
-Parser_t parser;
-Chunk_t *cur_chunk;
-
-static void go_next();
-static void expression();
-static void consume(TokenType_t type, const char *msg);
-static void report_error(Token_t *token, const char *msg);
-static void stop_compiler();
-
-static void number(bool can_assign);
-static void grouping(bool can_assign);
-static void unary(bool can_assign);
-static void binary(bool can_assign);
-static void literal(bool can_assign);
-static void string(bool can_assign);
-static void let(bool can_assign);
-static void parse_precedence(Precedence_t prec);
-
-static bool match(TokenType_t type);
-static void statement();
-static void declaration();
-static int parse_let(const char *msg);
-
-HashTable_t compiler_ids;
-
-bool compile(const char *code, Chunk_t *chunk) {
-    init_scanner(code);
-    init_hash_table(&compiler_ids);
-    cur_chunk = chunk;
-    parser.has_error = false;
-    parser.is_panicking = false;
-    go_next();
-    while (!match(TOKEN_END_FILE)) {
-        declaration();
-    }
-    stop_compiler();
-    return !parser.has_error;
+// same as compile() but a trailing expression without ';' is left on the stack as the result
+bool compile_with_result(vm_t *vm, const char *code, Chunk_t *chunk) {
+    return compile_source(vm, code, chunk, true);
 }
 
 // ===================================================================================================
 
-static Chunk_t *get_cur_chunk() {
-    return cur_chunk;
+static Chunk_t *get_cur_chunk(Compiler_t *compiler) {
+    return compiler->func->chunk;
 }
 
-static void emit_byte(uint8_t byte) {
-    write_chunk(get_cur_chunk(), byte, parser.prev.line);
+static void patch_jump(Compiler_t *compiler, int chain);
+
+// called right before an instruction's opcode is written, jumps waiting to land land on it
+static void start_op(Compiler_t *compiler) {
+    int landing = compiler->func->landing;
+    compiler->func->landing = -1;
+    patch_jump(compiler, landing);
+    compiler->func->prev_op = compiler->func->last_op;
+    compiler->func->last_op = get_cur_chunk(compiler)->count;
+}
+
+// only ever writes opcodes, operands go through write_operand()
+static void emit_byte(Compiler_t *compiler, uint8_t byte) {
+    start_op(compiler);
+    write_chunk(get_cur_chunk(compiler), byte, compiler->parser.prev.line);
+}
+
+// convenience function for writing two opcodes back to back
+static void emit_bytes(Compiler_t *compiler, uint8_t byte_1, uint8_t byte_2) {
+    emit_byte(compiler, byte_1);
+    emit_byte(compiler, byte_2);
 }
 
-// convenience function for writing opcode followed by 1-byte operand
-static void emit_bytes(uint8_t byte_1, uint8_t byte_2) {
-    emit_byte(byte_1);
-    emit_byte(byte_2);
+// convenience function for writing opcode followed by its variable length operand
+static void emit_operand_op(Compiler_t *compiler, OpCode_t op, int operand) {
+    emit_byte(compiler, op);
+    write_operand(get_cur_chunk(compiler), operand, compiler->parser.prev.line);
 }
 
-static void stop_compiler() {
-    emit_byte(OP_RETURN);
-#ifdef DEBUG_PRINT_CODE
-    if (!parser.has_error) {
-        disassemble_chunk(get_cur_chunk(), "Code");
+static void emit_constant(Compiler_t *compiler, Value_t value) {
+    emit_operand_op(compiler, OP_CONSTANT, add_constant(get_cur_chunk(compiler), value));
+}
+
+// jumps that still need a target are chained through their distance operands: each holds 1 + where
+// the next one's operand is, 0 ends the chain. a chain is named by its first jump's operand, -1 is
+// the empty chain
+static int next_jump(Chunk_t *chunk, int at) {
+    uint8_t *operand = &chunk->code[at];
+    return read_jump(&operand) - 1;
+}
+
+// puts the jump at `at`, which must not be chained, in front of chain
+static int chain_jump(Chunk_t *chunk, int at, int chain) {
+    patch_jump_operand(chunk, at, chain + 1);
+    return at;
+}
+
+static int join_jumps(Chunk_t *chunk, int chain, int other) {
+    while (other >= 0) {
+        int next = next_jump(chunk, other);
+        chain = chain_jump(chunk, other, chain);
+        other = next;
     }
-#endif
-    free_hash_table(&compiler_ids);
+    return chain;
+}
+
+// returns the new jump's chain, see patch_jump()
+static int emit_jump(Compiler_t *compiler, OpCode_t op) {
+    start_op(compiler);
+    return write_jump(get_cur_chunk(compiler), op, compiler->parser.prev.line);
+}
+
+// lands every jump in chain on the next instruction written
+static void patch_jump(Compiler_t *compiler, int chain) {
+    Chunk_t *chunk = get_cur_chunk(compiler);
+    while (chain >= 0) {
+        int next = next_jump(chunk, chain);
+        int distance = chunk->count - (chain + OPERAND_MAX_BYTES);
+        if (distance > OPERAND_MAX) {
+            report_error(compiler, &compiler->parser.prev, "Too much code to jump over");
+        }
+        patch_jump_operand(chunk, chain, distance);
+        compiler->func->last_target = chunk->count;
+        chain = next;
+    }
+}
+
+// like patch_jump() but waits for the next instruction to be written, so a jump written next can
+// send these on to its own target instead of having them land on it (jump threading)
+static void land_jumps(Compiler_t *compiler, int chain) {
+    compiler->func->landing = join_jumps(get_cur_chunk(compiler), compiler->func->landing, chain);
+}
+
+static bool keeps_value(uint8_t op) {
+    return op == OP_JUMP_IF_FALSE_OR_POP || op == OP_JUMP_IF_TRUE_OR_POP;
+}
+
+static bool jumps_if_truthy(uint8_t op) {
+    return op == OP_JUMP_IF_TRUE || op == OP_JUMP_IF_TRUE_OR_POP;
+}
+
+// an unconditional jump takes everything waiting to land on it along
+static int emit_jump_over(Compiler_t *compiler) {
+    int landing = compiler->func->landing;
+    compiler->func->landing = -1;
+    return join_jumps(get_cur_chunk(compiler), emit_jump(compiler, OP_JUMP), landing);
+}
+
+// forward jumps waiting to land on the OP_LOOP go straight to loop_start instead
+static void emit_loop(Compiler_t *compiler, int loop_start) {
+    Chunk_t *chunk = get_cur_chunk(compiler);
+    int backward = -1;
+    int landing = -1;
+    for (int at = compiler->func->landing; at >= 0;) {
+        int next = next_jump(chunk, at);
+        if (chunk->code[at - 1] == OP_JUMP && at > loop_start) {
+            backward = chain_jump(chunk, at, backward);
+        } else {
+            landing = chain_jump(chunk, at, landing);
+        }
+        at = next;
+    }
+    compiler->func->landing = landing;
+
+    int distance = chunk->count + 1 + OPERAND_MAX_BYTES - loop_start;
+    if (distance > OPERAND_MAX) {
+        report_error(compiler, &compiler->parser.prev, "Loop body is too large");
+    }
+    patch_jump_operand(chunk, emit_jump(compiler, OP_LOOP), distance);
+    while (backward >= 0) {
+        int next = next_jump(chunk, backward);
+        chunk->code[backward - 1] = OP_LOOP;
+        patch_jump_operand(chunk, backward, backward + OPERAND_MAX_BYTES - loop_start);
+        backward = next;
+    }
+}
+
+// a condition that ends in a comparison branches on it directly: the compare (and the OP_NOT
+// after it for <= and >=) becomes one compare-and-branch instruction. only when nothing jumps in
+// between them, the fused instruction takes the compare's offset and line
+static int emit_jump_if_false(Compiler_t *compiler) {
+    Chunk_t *chunk = get_cur_chunk(compiler);
+    int compare = compiler->func->last_op;
+    bool negated = false;
+    if (compare >= 0 && compare == chunk->count - 1 && chunk->code[compare] == OP_NOT &&
+        compiler->func->prev_op == compare - 1) {
+        compare = compiler->func->prev_op;
+        negated = true;
+    }
+    uint8_t compare_op = compare >= 0 ? chunk->code[compare] : OP_RETURN;
+    bool fusable = compare >= compiler->func->last_target &&
+                   compare == chunk->count - 1 - negated &&
+                   (compare_op == OP_LESS_THAN || compare_op == OP_GREATER_THAN);
+    if (!fusable) {
+        return emit_jump(compiler, OP_JUMP_IF_FALSE);
+    }
+
+    OpCode_t op;
+    if (compare_op == OP_LESS_THAN) {
+        op = negated ? OP_JUMP_IF_LESS : OP_JUMP_IF_NOT_LESS;
+    } else {
+        op = negated ? OP_JUMP_IF_GREATER : OP_JUMP_IF_NOT_GREATER;
+    }
+    int line = get_line(chunk->line_runs, compare);
+    truncate_chunk(chunk, compare);
+    compiler->func->last_op = -1;
+    start_op(compiler);
+    return write_jump(chunk, op, line);
+}
+
+// emits a jump on the truthiness of the top of the stack. short circuit jumps waiting to land on it
+// already know what it will do with their value: the ones jumping on the same truthiness go where
+// it goes, the others pop and go on past it. the rest still land on it
+static int emit_branch(Compiler_t *compiler, OpCode_t op) {
+    Chunk_t *chunk = get_cur_chunk(compiler);
+    int same = -1;
+    int past = -1;
+    int rest = -1;
+    for (int at = compiler->func->landing; at >= 0;) {
+        int next = next_jump(chunk, at);
+        uint8_t *jump_op = &chunk->code[at - 1];
+        if (!keeps_value(*jump_op)) {
+            rest = chain_jump(chunk, at, rest);
+        } else if (jumps_if_truthy(*jump_op) == jumps_if_truthy(op)) {
+            if (!keeps_value(op)) {
+                *jump_op = jumps_if_truthy(op) ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE;
+            }
+            same = chain_jump(chunk, at, same);
+        } else {
+            *jump_op = jumps_if_truthy(op) ? OP_JUMP_IF_FALSE : OP_JUMP_IF_TRUE;
+            past = chain_jump(chunk, at, past);
+        }
+        at = next;
+    }
+    compiler->func->landing = -1;
+    patch_jump(compiler, rest);
+
+    int chain = op == OP_JUMP_IF_FALSE ? emit_jump_if_false(compiler) : emit_jump(compiler, op);
+    land_jumps(compiler, past);
+    return join_jumps(chunk, chain, same);
+}
+
+// finishes the chunk being written and goes back to the enclosing one
+static void end_func_state(Compiler_t *compiler) {
+    FuncState_t *func = compiler->func;
+    func->chunk->max_stack = max_stack_depth(func->chunk);
+    free_hash_table(&func->ids);
+    compiler->func = func->enclosing;
+}
+
+static void stop_compiler(Compiler_t *compiler) {
+    emit_byte(compiler, OP_RETURN);
+    end_func_state(compiler);
 }
 
 // ===================================================================================================
 
-ParseRule_t rules[] = {
-    [TOKEN_OPEN_PAREN] = {grouping, NULL, PREC_NONE},
+static ParseRule_t rules[] = {
+    [TOKEN_OPEN_PAREN] = {grouping, call, PREC_ACCESSOR},
     [TOKEN_CLOSE_PAREN] = {NULL, NULL, PREC_NONE},
     [TOKEN_OPEN_CURLY] = {NULL, NULL, PREC_NONE},
     [TOKEN_CLOSE_CURLY] = {NULL, NULL, PREC_NONE},
@@ -92,7 +362,7 @@ ParseRule_t rules[] = {
     [TOKEN_IDENTIFIER] = {let, NULL, PREC_NONE},
     [TOKEN_STR] = {string, NULL, PREC_NONE},
     [TOKEN_NUM] = {number, NULL, PREC_NONE},
-    [TOKEN_AND] = {NULL, NULL, PREC_NONE},
+    [TOKEN_AND] = {NULL, and_, PREC_AND},
     [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
     [TOKEN_ELSE] = {NULL, NULL, PREC_NONE},
     [TOKEN_FALSE] = {literal, NULL, PREC_NONE},
@@ -100,7 +370,7 @@ ParseRule_t rules[] = {
     [TOKEN_FUNC] = {NULL, NULL, PREC_NONE},
     [TOKEN_IF] = {NULL, NULL, PREC_NONE},
     [TOKEN_NONE] = {literal, NULL, PREC_NONE},
-    [TOKEN_OR] = {NULL, NULL, PREC_NONE},
+    [TOKEN_OR] = {NULL, or_, PREC_OR},
     [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
     [TOKEN_RETURN] = {NULL, NULL, PREC_NONE},
     [TOKEN_SUPER] = {NULL, NULL, PREC_NONE},
@@ -112,101 +382,343 @@ ParseRule_t rules[] = {
     [TOKEN_END_FILE] = {NULL, NULL, PREC_NONE},
 };
 
-static void expression() {
-    parse_precedence(PREC_ASSIGN);
+static void expression(Compiler_t *compiler) {
+    parse_precedence(compiler, PREC_ASSIGN);
+}
+
+static void print_statement(Compiler_t *compiler) {
+    expression(compiler);
+    consume(compiler, TOKEN_SEMICOLON, "Expected ';'. Got empty :(");
+    emit_byte(compiler, OP_PRINT);
 }
 
-static void print_statement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expected ';'. Got empty :(");
-    emit_byte(OP_PRINT);
+static void expression_statement(Compiler_t *compiler) {
+    expression(compiler);
+    if (compiler->tail_result && compiler->parser.cur.type == TOKEN_END_FILE) {
+        return; // value stays on the stack for whoever runs the chunk
+    }
+    consume(compiler, TOKEN_SEMICOLON, "Expected ';'. Put the semicolon please!");
+    emit_byte(compiler, OP_POP);
+}
+
+static void define_let(Compiler_t *compiler, int global_id) {
+    emit_operand_op(compiler, OP_DEFINE_GLOBAL, global_id);
+}
+
+// ------------------------ Locals ------------------------ //
+
+// only functions have locals, the script's variables are all globals
+static bool in_function(Compiler_t *compiler) {
+    return compiler->func->function != NULL;
 }
 
-static void expression_statement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expected ';'. Put the semicolon please!");
-    emit_byte(OP_POP);
+static bool same_name(Token_t *a, Token_t *b) {
+    return a->length == b->length && memcmp(a->start, b->start, a->length) == 0;
 }
 
-void define_let(int global_id) {
-    if (global_id <= 255) {
-        emit_bytes(OP_DEFINE_GLOBAL, global_id);
+static void begin_scope(Compiler_t *compiler) {
+    compiler->func->scope_depth++;
+}
+
+// the scope's locals are the values on top of the stack
+static void end_scope(Compiler_t *compiler) {
+    FuncState_t *func = compiler->func;
+    func->scope_depth--;
+    while (func->num_locals > 0 && func->locals[func->num_locals - 1].depth > func->scope_depth) {
+        emit_byte(compiler, OP_POP);
+        func->num_locals--;
+    }
+}
+
+// the local's slot is wherever its initializer leaves its value, the next one up the stack
+static void add_local(Compiler_t *compiler, Token_t name) {
+    FuncState_t *func = compiler->func;
+    for (int i = func->num_locals - 1; i >= 0 && func->locals[i].depth >= func->scope_depth; i--) {
+        if (same_name(&name, &func->locals[i].name)) {
+            report_error(compiler, &name, "Already a variable with this name in this scope");
+        }
+    }
+    if (func->num_locals == LOCALS_MAX) {
+        report_error(compiler, &name, "Too many local variables in function");
+        return;
+    }
+    func->locals[func->num_locals++] = (Local_t){.name = name, .depth = -1};
+}
+
+static void mark_initialized(Compiler_t *compiler) {
+    compiler->func->locals[compiler->func->num_locals - 1].depth = compiler->func->scope_depth;
+}
+
+// slot of the innermost local called name, -1 for a global
+static int resolve_local(Compiler_t *compiler, Token_t *name) {
+    FuncState_t *func = compiler->func;
+    for (int i = func->num_locals - 1; i >= 0; i--) {
+        if (same_name(name, &func->locals[i].name)) {
+            if (func->locals[i].depth == -1) {
+                report_error(compiler, name, "Can't read local variable in its own initializer");
+            }
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void block(Compiler_t *compiler) {
+    while (!check(compiler, TOKEN_CLOSE_CURLY) && !check(compiler, TOKEN_END_FILE)) {
+        declaration(compiler);
+    }
+    consume(compiler, TOKEN_CLOSE_CURLY, "Expected '}' after block. Close those curlies :)");
+}
+
+// ------------------------ Functions ------------------------ //
+
+// a call in tail position becomes OP_TAIL_CALL unless something jumps past it to the return
+static void emit_return(Compiler_t *compiler) {
+    FuncState_t *func = compiler->func;
+    Chunk_t *chunk = get_cur_chunk(compiler);
+    if (func->last_op >= 0 && chunk->code[func->last_op] == OP_CALL && func->landing < 0 &&
+        func->last_target <= func->last_op) {
+        chunk->code[func->last_op] = OP_TAIL_CALL;
+    } else {
+        emit_byte(compiler, OP_RETURN);
+    }
+}
+
+// true if the last instruction written returns and nothing jumps past it
+static bool ends_in_return(Compiler_t *compiler) {
+    FuncState_t *func = compiler->func;
+    if (func->last_op < 0 || func->landing >= 0 || func->last_target > func->last_op) {
+        return false;
+    }
+    uint8_t op = get_cur_chunk(compiler)->code[func->last_op];
+    return op == OP_RETURN || op == OP_TAIL_CALL;
+}
+
+// parameters are the first locals: the caller leaves the arguments right where their slots are
+static void function(Compiler_t *compiler, Token_t name) {
+    ObjectFunc_t *function =
+        allocate_func(compiler->vm, allocate_str(compiler->vm, name.start, name.length));
+    FuncState_t func;
+    init_func_state(compiler, &func, function, &function->chunk);
+
+    consume(compiler, TOKEN_OPEN_PAREN, "Expected '(' after function name");
+    int arity = 0;
+    if (!check(compiler, TOKEN_CLOSE_PAREN)) {
+        do {
+            if (arity == 255) {
+                report_error(compiler, &compiler->parser.cur,
+                             "Can't have more than 255 parameters");
+            }
+            arity++;
+            consume(compiler, TOKEN_IDENTIFIER, "Expected parameter name");
+            add_local(compiler, compiler->parser.prev);
+            mark_initialized(compiler);
+        } while (match(compiler, TOKEN_COMMA));
+    }
+    consume(compiler, TOKEN_CLOSE_PAREN, "Expected ')' after parameters");
+    function->chunk.arity = arity;
+
+    consume(compiler, TOKEN_OPEN_CURLY, "Expected '{' before function body");
+    block(compiler);
+    if (!ends_in_return(compiler)) {
+        emit_bytes(compiler, OP_NONE, OP_RETURN);
+    }
+    end_func_state(compiler);
+    emit_constant(compiler, DECL_OBJ_VAL(function));
+}
+
+static void func_declaration(Compiler_t *compiler) {
+    if (in_function(compiler)) {
+        report_error(compiler, &compiler->parser.prev,
+                     "Functions can't be nested, declare it at the top level");
+    }
+    int global_id = parse_let(compiler, "Expected function name");
+    function(compiler, compiler->parser.prev);
+    define_let(compiler, global_id);
+}
+
+static void return_statement(Compiler_t *compiler) {
+    if (!in_function(compiler)) {
+        report_error(compiler, &compiler->parser.prev, "Can't return from top-level code");
+    }
+    if (match(compiler, TOKEN_SEMICOLON)) {
+        emit_bytes(compiler, OP_NONE, OP_RETURN);
+        return;
+    }
+    expression(compiler);
+    consume(compiler, TOKEN_SEMICOLON, "Expected ';' after return value");
+    emit_return(compiler);
+}
+
+// condition first, body after: the condition jumps out when it fails, the body loops back to it
+static void while_statement(Compiler_t *compiler) {
+    int loop_start = get_cur_chunk(compiler)->count;
+    consume(compiler, TOKEN_OPEN_PAREN, "Expected '(' after 'while'");
+    expression(compiler);
+    consume(compiler, TOKEN_CLOSE_PAREN, "Expected ')' after condition");
+
+    int exit_jump = emit_branch(compiler, OP_JUMP_IF_FALSE);
+    statement(compiler);
+    emit_loop(compiler, loop_start);
+    land_jumps(compiler, exit_jump);
+}
+
+// for (init; condition; increment) body. the increment comes before the body in the code, so the
+// first iteration jumps over it and the body loops back to it
+static void for_statement(Compiler_t *compiler) {
+    begin_scope(compiler);
+    consume(compiler, TOKEN_OPEN_PAREN, "Expected '(' after 'for'");
+    if (match(compiler, TOKEN_LET)) {
+        let_declaration(compiler);
+    } else if (!match(compiler, TOKEN_SEMICOLON)) {
+        expression(compiler);
+        consume(compiler, TOKEN_SEMICOLON, "Expected ';' after loop initializer");
+        emit_byte(compiler, OP_POP);
+    }
+
+    int loop_start = get_cur_chunk(compiler)->count;
+    int exit_jump = -1;
+    if (!match(compiler, TOKEN_SEMICOLON)) {
+        expression(compiler);
+        consume(compiler, TOKEN_SEMICOLON, "Expected ';' after loop condition");
+        exit_jump = emit_branch(compiler, OP_JUMP_IF_FALSE);
+    }
+
+    if (!match(compiler, TOKEN_CLOSE_PAREN)) {
+        int body_jump = emit_jump(compiler, OP_JUMP);
+        int increment_start = get_cur_chunk(compiler)->count;
+        expression(compiler);
+        emit_byte(compiler, OP_POP);
+        consume(compiler, TOKEN_CLOSE_PAREN, "Expected ')' after for clauses");
+        emit_loop(compiler, loop_start);
+        loop_start = increment_start;
+        patch_jump(compiler, body_jump);
+    }
+
+    statement(compiler);
+    emit_loop(compiler, loop_start);
+    land_jumps(compiler, exit_jump);
+    end_scope(compiler);
+}
+
+static void if_statement(Compiler_t *compiler) {
+    consume(compiler, TOKEN_OPEN_PAREN, "Expected '(' after 'if'");
+    expression(compiler);
+    consume(compiler, TOKEN_CLOSE_PAREN, "Expected ')' after condition");
+
+    int else_jump = emit_branch(compiler, OP_JUMP_IF_FALSE);
+    statement(compiler);
+    if (match(compiler, TOKEN_ELSE)) {
+        int end_jump = emit_jump_over(compiler);
+        land_jumps(compiler, else_jump);
+        statement(compiler);
+        land_jumps(compiler, end_jump);
     } else {
-        emit_byte(OP_DEFINE_GLOBAL_LONG);
-        emit_byte(global_id & 0xFF);         // lowest 8 bits
-        emit_byte((global_id >> 8) & 0xFF);  // middle 8 bits
-        emit_byte((global_id >> 16) & 0xFF); // front 8 bits
+        land_jumps(compiler, else_jump);
     }
 }
 
-static void let_declaration() {
-    int global_id = parse_let("Expected variable name. LET's put a great name :)");
+// inside a function the initializer's value stays on the stack as the local
+static void local_declaration(Compiler_t *compiler) {
+    consume(compiler, TOKEN_IDENTIFIER, "Expected variable name. LET's put a great name :)");
+    add_local(compiler, compiler->parser.prev);
+    if (match(compiler, TOKEN_EQUAL)) {
+        expression(compiler);
+    } else {
+        emit_byte(compiler, OP_NONE);
+    }
+    consume(compiler, TOKEN_SEMICOLON, "Expected ';'. Put the semicolon please!");
+    mark_initialized(compiler);
+}
 
-    if (match(TOKEN_EQUAL)) {
-        expression();
+static void let_declaration(Compiler_t *compiler) {
+    if (in_function(compiler)) {
+        local_declaration(compiler);
+        return;
+    }
+    int global_id = parse_let(compiler, "Expected variable name. LET's put a great name :)");
+
+    if (match(compiler, TOKEN_EQUAL)) {
+        expression(compiler);
     } else {
-        emit_byte(OP_NONE);
+        emit_byte(compiler, OP_NONE);
     }
-    consume(TOKEN_SEMICOLON, "Expected ';'. Put the semicolon please!");
-    define_let(global_id);
+    consume(compiler, TOKEN_SEMICOLON, "Expected ';'. Put the semicolon please!");
+    define_let(compiler, global_id);
 }
 
 // get us out of panic mode by consuming till the next semicolon
-static void synchronize() {
-    parser.is_panicking = false;
-    while (parser.cur.type != TOKEN_END_FILE) {
-        if (parser.prev.type == TOKEN_SEMICOLON) {
+static void synchronize(Compiler_t *compiler) {
+    compiler->parser.is_panicking = false;
+    while (compiler->parser.cur.type != TOKEN_END_FILE) {
+        if (compiler->parser.prev.type == TOKEN_SEMICOLON) {
             return;
         }
-        if (parser.cur.type == TOKEN_RETURN) {
-            return;
+        switch (compiler->parser.cur.type) {
+            case TOKEN_LET:
+            case TOKEN_FUNC:
+            case TOKEN_PRINT:
+            case TOKEN_IF:
+            case TOKEN_WHILE:
+            case TOKEN_FOR:
+            case TOKEN_RETURN:
+                return;
+            default:
+                break;
         }
-        go_next();
+        go_next(compiler);
     }
 }
 
-static void declaration() {
-    if (match(TOKEN_LET)) {
-        let_declaration();
+static void declaration(Compiler_t *compiler) {
+    if (match(compiler, TOKEN_FUNC)) {
+        func_declaration(compiler);
+    } else if (match(compiler, TOKEN_LET)) {
+        let_declaration(compiler);
     } else {
-        statement();
+        statement(compiler);
     }
-    if (parser.is_panicking) {
-        synchronize();
+    if (compiler->parser.is_panicking) {
+        synchronize(compiler);
     }
 }
 
-static bool match(TokenType_t type) {
-    if (parser.cur.type == type) {
-        go_next();
+static bool check(Compiler_t *compiler, TokenType_t type) {
+    return compiler->parser.cur.type == type;
+}
+
+static bool match(Compiler_t *compiler, TokenType_t type) {
+    if (check(compiler, type)) {
+        go_next(compiler);
         return true;
     }
     return false;
 }
 
-static void statement() {
-    if (match(TOKEN_PRINT)) {
-        print_statement();
+static void statement(Compiler_t *compiler) {
+    if (match(compiler, TOKEN_PRINT)) {
+        print_statement(compiler);
+    } else if (match(compiler, TOKEN_IF)) {
+        if_statement(compiler);
+    } else if (match(compiler, TOKEN_WHILE)) {
+        while_statement(compiler);
+    } else if (match(compiler, TOKEN_FOR)) {
+        for_statement(compiler);
+    } else if (match(compiler, TOKEN_RETURN)) {
+        return_statement(compiler);
+    } else if (match(compiler, TOKEN_OPEN_CURLY)) {
+        begin_scope(compiler);
+        block(compiler);
+        end_scope(compiler);
     } else {
-        expression_statement();
+        expression_statement(compiler);
     }
 }
 
-static void string(bool can_assign) {
-    write_constant(get_cur_chunk(),
-                   DECL_OBJ_VAL(allocate_str(parser.prev.start + 1, parser.prev.length - 2)),
-                   parser.prev.line);
-}
-
-static void emit_let_opcode(OpCode_t short_op, OpCode_t long_op, int operand) {
-    if (operand <= 255) {
-        emit_bytes(short_op, (uint8_t)(operand));
-    } else {
-        emit_byte(long_op);                // new opcode for long globals
-        emit_byte(operand & 0xFF);         // lowest 8 bits
-        emit_byte((operand >> 8) & 0xFF);  // middle 8 bits
-        emit_byte((operand >> 16) & 0xFF); // highest 8 bits
-    }
+static void string(Compiler_t *compiler, bool can_assign) {
+    Token_t *token = &compiler->parser.prev;
+    emit_constant(compiler,
+                  DECL_OBJ_VAL(allocate_str(compiler->vm, token->start + 1, token->length - 2)));
 }
 
 // will either get consant id if exists or add it if not
@@ -217,181 +729,226 @@ static int constant_identifier(Chunk_t *chunk, HashTable_t *ids, ObjectStr_t *na
         // alr exists so return saved idx instead of allcoating new one
         return (int)(GET_NUM_VAL(*existing));
     }
-    int idx = add_constant(get_cur_chunk(), DECL_OBJ_VAL(name));
+    int idx = add_constant(chunk, DECL_OBJ_VAL(name));
     insert(ids, name, DECL_NUM_VAL(idx));
     return idx;
 }
 
-static void named_let(Token_t name, bool can_assign) {
-    ObjectStr_t *global_name = allocate_str(parser.prev.start, parser.prev.length);
-    int operand = constant_identifier(get_cur_chunk(), &compiler_ids, global_name);
-    if (can_assign && match(TOKEN_EQUAL)) {
-        expression();
-        emit_let_opcode(OP_SET_GLOBAL, OP_SET_GLOBAL_LONG, operand);
+static void named_let(Compiler_t *compiler, Token_t name, bool can_assign) {
+    int slot = resolve_local(compiler, &name);
+    if (slot >= 0) {
+        if (can_assign && match(compiler, TOKEN_EQUAL)) {
+            expression(compiler);
+            emit_operand_op(compiler, OP_SET_SLOT, slot);
+        } else {
+            emit_operand_op(compiler, OP_GET_SLOT, slot);
+        }
+        return;
+    }
+    ObjectStr_t *global_name = allocate_str(compiler->vm, name.start, name.length);
+    int operand = constant_identifier(get_cur_chunk(compiler), &compiler->func->ids, global_name);
+    if (can_assign && match(compiler, TOKEN_EQUAL)) {
+        expression(compiler);
+        emit_operand_op(compiler, OP_SET_GLOBAL, operand);
     } else {
-        emit_let_opcode(OP_GET_GLOBAL, OP_GET_GLOBAL_LONG, operand);
+        emit_operand_op(compiler, OP_GET_GLOBAL, operand);
     }
 }
 
-static void let(bool can_assign) {
-    named_let(parser.prev, can_assign);
+static void let(Compiler_t *compiler, bool can_assign) {
+    named_let(compiler, compiler->parser.prev, can_assign);
 }
 
 // ===================================================================================================
 
-static void parse_precedence(Precedence_t prec) {
-    go_next();
-    ParseFunc_t prefix_rule = rules[parser.prev.type].prefix_rule;
+static void parse_precedence(Compiler_t *compiler, Precedence_t prec) {
+    go_next(compiler);
+    ParseFunc_t prefix_rule = rules[compiler->parser.prev.type].prefix_rule;
     if (prefix_rule == NULL) {
-        report_error(&parser.prev, "Expected expression");
+        report_error(compiler, &compiler->parser.prev, "Expected expression");
         return;
     }
 
     // only assign if we are in the lowest precedence otherwise thing like a = b * c might break
     bool can_assign = prec <= PREC_ASSIGN;
-    prefix_rule(can_assign);
+    prefix_rule(compiler, can_assign);
 
-    while (prec <= rules[parser.cur.type].precedence) {
-        go_next();
-        ParseFunc_t infix_rule = rules[parser.prev.type].infix_rule;
-        infix_rule(can_assign);
+    while (prec <= rules[compiler->parser.cur.type].precedence) {
+        go_next(compiler);
+        ParseFunc_t infix_rule = rules[compiler->parser.prev.type].infix_rule;
+        infix_rule(compiler, can_assign);
     }
 
-    if (can_assign && match(TOKEN_EQUAL)) {
-        report_error(&parser.prev, "Invalid assignment");
+    if (can_assign && match(compiler, TOKEN_EQUAL)) {
+        report_error(compiler, &compiler->parser.prev, "Invalid assignment");
     }
 }
 
-static int parse_let(const char *msg) {
+static int parse_let(Compiler_t *compiler, const char *msg) {
     // parse variable and add constant byte to chunk
-    consume(TOKEN_IDENTIFIER, msg);
-    return add_constant(get_cur_chunk(),
-                        DECL_OBJ_VAL(allocate_str(parser.prev.start, parser.prev.length)));
+    consume(compiler, TOKEN_IDENTIFIER, msg);
+    Token_t *name = &compiler->parser.prev;
+    return add_constant(get_cur_chunk(compiler),
+                        DECL_OBJ_VAL(allocate_str(compiler->vm, name->start, name->length)));
 }
 
-static void literal(bool can_assign) {
-    switch (parser.prev.type) {
+static void literal(Compiler_t *compiler, bool can_assign) {
+    switch (compiler->parser.prev.type) {
         case TOKEN_FALSE:
-            emit_byte(OP_FALSE);
+            emit_byte(compiler, OP_FALSE);
             break;
         case TOKEN_TRUE:
-            emit_byte(OP_TRUE);
+            emit_byte(compiler, OP_TRUE);
             break;
         case TOKEN_NONE:
-            emit_byte(OP_NONE);
+            emit_byte(compiler, OP_NONE);
             break;
         default:
             return;
     }
 }
 
-static void number(bool can_assign) {
-    double val = strtod(parser.prev.start, NULL);
-    write_constant(get_cur_chunk(), DECL_NUM_VAL(val), parser.prev.line);
+static void number(Compiler_t *compiler, bool can_assign) {
+    Token_t *token = &compiler->parser.prev;
+    emit_constant(compiler, number_literal(token->start, token->length));
 }
 
-static void grouping(bool can_assign) {
-    expression();
-    consume(TOKEN_CLOSE_PAREN, "Expect ')' after expression");
+static void grouping(Compiler_t *compiler, bool can_assign) {
+    expression(compiler);
+    consume(compiler, TOKEN_CLOSE_PAREN, "Expect ')' after expression");
 }
 
-static void unary(bool can_assign) {
-    TokenType_t op_type = parser.prev.type;
-    parse_precedence(PREC_UNARY);
+static void unary(Compiler_t *compiler, bool can_assign) {
+    TokenType_t op_type = compiler->parser.prev.type;
+    parse_precedence(compiler, PREC_UNARY);
 
     // negate operator emitted last bc we need value first so we have smtg to negate
     switch (op_type) {
         case TOKEN_NOT:
-            emit_byte(OP_NOT);
+            emit_byte(compiler, OP_NOT);
             break;
         case TOKEN_SUB:
-            emit_byte(OP_NEGATE);
+            emit_byte(compiler, OP_NEGATE);
             break;
         default:
             return;
     }
 }
 
-static void binary(bool can_assign) {
+static void binary(Compiler_t *compiler, bool can_assign) {
     // left operator
-    TokenType_t op_type = parser.prev.type;
+    TokenType_t op_type = compiler->parser.prev.type;
 
     // parse right expression
     ParseRule_t *rule = &rules[op_type];
-    parse_precedence((Precedence_t)(rule->precedence + 1));
+    parse_precedence(compiler, (Precedence_t)(rule->precedence + 1));
 
     // write the op instruction
     switch (op_type) {
         case TOKEN_NOT_EQUAL:
-            emit_bytes(OP_EQUAL, OP_NOT);
+            emit_bytes(compiler, OP_EQUAL, OP_NOT);
             break;
         case TOKEN_LESS_THAN:
-            emit_byte(OP_LESS_THAN);
+            emit_byte(compiler, OP_LESS_THAN);
             break;
         case TOKEN_LESS_THAN_EQUAL:
-            emit_bytes(OP_GREATER_THAN, OP_NOT);
+            emit_bytes(compiler, OP_GREATER_THAN, OP_NOT);
             break;
         case TOKEN_GREATER_THAN:
-            emit_byte(OP_GREATER_THAN);
+            emit_byte(compiler, OP_GREATER_THAN);
             break;
         case TOKEN_GREATER_THAN_EQUAL:
-            emit_bytes(OP_LESS_THAN, OP_NOT);
+            emit_bytes(compiler, OP_LESS_THAN, OP_NOT);
             break;
         case TOKEN_EQUAL_EQUAL:
-            emit_byte(OP_EQUAL);
+            emit_byte(compiler, OP_EQUAL);
             break;
         case TOKEN_ADD:
-            emit_byte(OP_ADD);
+            emit_byte(compiler, OP_ADD);
             break;
         case TOKEN_SUB:
-            emit_byte(OP_SUB);
+            emit_byte(compiler, OP_SUB);
             break;
         case TOKEN_MUL:
-            emit_byte(OP_MUL);
+            emit_byte(compiler, OP_MUL);
             break;
         case TOKEN_DIV:
-            emit_byte(OP_DIV);
+            emit_byte(compiler, OP_DIV);
             break;
         default:
             return;
     }
 }
 
+// the callee is already on the stack, the arguments go on top of it
+static void call(Compiler_t *compiler, bool can_assign) {
+    int argc = 0;
+    if (!check(compiler, TOKEN_CLOSE_PAREN)) {
+        do {
+            expression(compiler);
+            if (argc == 255) {
+                report_error(compiler, &compiler->parser.prev,
+                             "Can't have more than 255 arguments");
+            }
+            argc++;
+        } while (match(compiler, TOKEN_COMMA));
+    }
+    consume(compiler, TOKEN_CLOSE_PAREN, "Expected ')' after arguments");
+    emit_operand_op(compiler, OP_CALL, argc);
+}
+
+// a falsey left operand is the result and the right one is skipped, otherwise it's popped
+static void and_(Compiler_t *compiler, bool can_assign) {
+    int end_jump = emit_branch(compiler, OP_JUMP_IF_FALSE_OR_POP);
+    parse_precedence(compiler, PREC_AND);
+    land_jumps(compiler, end_jump);
+}
+
+// a truthy left operand is the result and the right one is skipped, otherwise it's popped
+static void or_(Compiler_t *compiler, bool can_assign) {
+    int end_jump = emit_branch(compiler, OP_JUMP_IF_TRUE_OR_POP);
+    parse_precedence(compiler, PREC_OR);
+    land_jumps(compiler, end_jump);
+}
+
 // ===================================================================================================
 
-static void consume(TokenType_t type, const char *msg) {
-    if (parser.cur.type == type) {
-        go_next();
+static void consume(Compiler_t *compiler, TokenType_t type, const char *msg) {
+    if (compiler->parser.cur.type == type) {
+        go_next(compiler);
         return;
     }
-    report_error(&parser.cur, msg);
+    report_error(compiler, &compiler->parser.cur, msg);
 }
 
-static void go_next() {
-    parser.prev = parser.cur;
+static void go_next(Compiler_t *compiler) {
+    Parser_t *parser = &compiler->parser;
+    parser->prev = parser->cur;
     while (true) {
-        parser.cur = scan_token();
-        if (parser.cur.type != TOKEN_ERROR) {
+        parser->cur = scan_token(&compiler->scanner);
+        if (parser->cur.type != TOKEN_ERROR) {
             break;
         }
-        report_error(&parser.cur, parser.cur.start);
+        report_error(compiler, &parser->cur, parser->cur.start);
     }
 }
 
-static void report_error(Token_t *token, const char *msg) {
-    if (parser.is_panicking) {
+static void report_error(Compiler_t *compiler, Token_t *token, const char *msg) {
+    Parser_t *parser = &compiler->parser;
+    if (parser->is_panicking) {
         // if parser is panicking (err was found earlier) just ignore the errors and keep going
         return;
     }
-    parser.is_panicking = true;
-    fprintf(stderr, "[line %d] Error", token->line);
+    parser->is_panicking = true;
+    FILE *err = compiler->vm->err;
+    fprintf(err, "[line %d] Error", token->line);
     if (token->type == TOKEN_END_FILE) {
-        fprintf(stderr, " end of file");
+        fprintf(err, " end of file");
     } else if (token->type != TOKEN_ERROR) {
         // error tokens are not stored in entirety so only print the lexme if token != error
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(err, " at '%.*s'", token->length, token->start);
     }
 
-    fprintf(stderr, ": %s\n", msg);
-    parser.has_error = true;
+    fprintf(err, ": %s\n", msg);
+    parser->has_error = true;
 }
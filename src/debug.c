@@ -3,106 +3,128 @@
 
 #include "../includes/debug.h"
 
-int standard_instruction(const char *name, int offset);
-int constant_instruction(const char *name, Chunk_t *chunk, int offset);
-int constant_long_instruction(const char *name, Chunk_t *chunk, int offset);
+int standard_instruction(Writer_t *out, const char *name, int offset);
+int constant_instruction(Writer_t *out, const char *name, Chunk_t *chunk, int offset);
+int slot_instruction(Writer_t *out, const char *name, Chunk_t *chunk, int offset);
+int jump_instruction(Writer_t *out, const char *name, Chunk_t *chunk, int offset);
 
 // given machine code -> output list of instructions
-void disassemble_chunk(Chunk_t *chunk, const char *name) {
-    printf("== %s ==\n", name);
+void disassemble_chunk(Writer_t *out, Chunk_t *chunk, const char *name) {
+    write_format(out, "== %s ==\n", name);
 
     int offset = 0;
     while (offset < chunk->count) {
-        offset = disassemble_instruction(chunk, offset);
+        offset = disassemble_instruction(out, chunk, offset);
     }
 }
 
-int disassemble_instruction(Chunk_t *chunk, int offset) {
-    printf("%04d ", offset);
+int disassemble_instruction(Writer_t *out, Chunk_t *chunk, int offset) {
+    write_format(out, "%04d ", offset);
     if (offset > 0 &&
         get_line(chunk->line_runs, offset) == get_line(chunk->line_runs, offset - 1)) {
-        printf("   | ");
+        write_str(out, "   | ");
     } else {
-        printf("%4d ", get_line(chunk->line_runs, offset));
+        write_format(out, "%4d ", get_line(chunk->line_runs, offset));
     }
 
     uint8_t instruction = chunk->code[offset];
     switch (instruction) {
         case OP_RETURN:
-            return standard_instruction("OP_RETURN", offset);
+            return standard_instruction(out, "OP_RETURN", offset);
         case OP_CONSTANT:
-            return constant_instruction("OP_CONSTANT", chunk, offset);
+            return constant_instruction(out, "OP_CONSTANT", chunk, offset);
         case OP_DEFINE_GLOBAL:
-            return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+            return constant_instruction(out, "OP_DEFINE_GLOBAL", chunk, offset);
         case OP_GET_GLOBAL:
-            return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+            return constant_instruction(out, "OP_GET_GLOBAL", chunk, offset);
         case OP_SET_GLOBAL:
-            return constant_instruction("OP_SET_GLOBAL", chunk, offset);
+            return constant_instruction(out, "OP_SET_GLOBAL", chunk, offset);
+        case OP_GET_SLOT:
+            return slot_instruction(out, "OP_GET_SLOT", chunk, offset);
+        case OP_SET_SLOT:
+            return slot_instruction(out, "OP_SET_SLOT", chunk, offset);
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            // operand is the argument count, printed like a slot
+            return slot_instruction(out, op_info[instruction].name, chunk, offset);
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_LESS:
+        case OP_JUMP_IF_GREATER:
+            return jump_instruction(out, op_info[instruction].name, chunk, offset);
         case OP_NONE:
-            return standard_instruction("OP_NONE", offset);
+            return standard_instruction(out, "OP_NONE", offset);
         case OP_TRUE:
-            return standard_instruction("OP_TRUE", offset);
+            return standard_instruction(out, "OP_TRUE", offset);
         case OP_FALSE:
-            return standard_instruction("OP_FALSE", offset);
+            return standard_instruction(out, "OP_FALSE", offset);
         case OP_NOT:
-            return standard_instruction("OP_NOT", offset);
+            return standard_instruction(out, "OP_NOT", offset);
         case OP_EQUAL:
-            return standard_instruction("OP_EQUAL", offset);
+            return standard_instruction(out, "OP_EQUAL", offset);
         case OP_GREATER_THAN:
-            return standard_instruction("OP_GREATER_THAN", offset);
+            return standard_instruction(out, "OP_GREATER_THAN", offset);
         case OP_LESS_THAN:
-            return standard_instruction("OP_LESS_THAN", offset);
-        case OP_CONSTANT_LONG:
-            return constant_long_instruction("OP_CONSTANT_LONG", chunk, offset);
-        case OP_DEFINE_GLOBAL_LONG:
-            return constant_long_instruction("OP_DEFINE_GLOBAL_LONG", chunk, offset);
-        case OP_GET_GLOBAL_LONG:
-            return constant_long_instruction("OP_GET_GLOBAL_LONG", chunk, offset);
-        case OP_SET_GLOBAL_LONG:
-            return constant_long_instruction("OP_SET_GLOBAL_LONG", chunk, offset);
+            return standard_instruction(out, "OP_LESS_THAN", offset);
         case OP_NEGATE:
-            return standard_instruction("OP_NEGATE", offset);
+            return standard_instruction(out, "OP_NEGATE", offset);
         case OP_ADD:
-            return standard_instruction("OP_ADD", offset);
+            return standard_instruction(out, "OP_ADD", offset);
+        case OP_ADD_NUM:
+            return standard_instruction(out, "OP_ADD_NUM", offset);
+        case OP_ADD_STR:
+            return standard_instruction(out, "OP_ADD_STR", offset);
+        case OP_ADD_ANY:
+            return standard_instruction(out, "OP_ADD_ANY", offset);
         case OP_SUB:
-            return standard_instruction("OP_SUB", offset);
+            return standard_instruction(out, "OP_SUB", offset);
         case OP_MUL:
-            return standard_instruction("OP_MUL", offset);
+            return standard_instruction(out, "OP_MUL", offset);
         case OP_DIV:
-            return standard_instruction("OP_DIV", offset);
+            return standard_instruction(out, "OP_DIV", offset);
         case OP_PRINT:
-            return standard_instruction("OP_PRINT", offset);
+            return standard_instruction(out, "OP_PRINT", offset);
         case OP_POP:
-            return standard_instruction("OP_POP", offset);
+            return standard_instruction(out, "OP_POP", offset);
+        case OP_DUP:
+            return standard_instruction(out, "OP_DUP", offset);
         default:
-            printf("Unknown OpCode %d\n", instruction);
+            write_format(out, "Unknown OpCode %d\n", instruction);
             return offset + 1;
     }
 }
 
 // ------------------------ Helper Functions ------------------------ //
-int standard_instruction(const char *name, int offset) {
-    printf("%s\n", name);
+int standard_instruction(Writer_t *out, const char *name, int offset) {
+    write_format(out, "%s\n", name);
     return offset + 1;
 }
 
-int constant_instruction(const char *name, Chunk_t *chunk, int offset) {
-    uint8_t idx = chunk->code[offset + 1];
+int constant_instruction(Writer_t *out, const char *name, Chunk_t *chunk, int offset) {
+    uint8_t *pc = &chunk->code[offset + 1];
+    int idx = read_operand(&pc);
     // print left-aligned 16 char string then minimum 4-width integer
-    printf("%-16s %4d '", name, idx);
-    print_value(chunk->constants.values[idx]);
-    printf("'\n");
-    return offset + 2;
+    write_format(out, "%-16s %4d '", name, idx);
+    write_value(out, chunk->constants.values[idx]);
+    write_str(out, "'\n");
+    return (int)(pc - chunk->code);
 }
 
-int constant_long_instruction(const char *name, Chunk_t *chunk, int offset) {
-    // long constants idxs are stored in 3 separate bytes so "merge" them back together
-    int idx = (chunk->code[offset + 1]) | (chunk->code[offset + 2] << 8) |
-              (chunk->code[offset + 3] << 16);
+int slot_instruction(Writer_t *out, const char *name, Chunk_t *chunk, int offset) {
+    uint8_t *pc = &chunk->code[offset + 1];
+    int slot = read_operand(&pc);
+    write_format(out, "%-16s %4d\n", name, slot);
+    return (int)(pc - chunk->code);
+}
 
-    // print left-aligned 16 char string then minimum 4-width integer
-    printf("%-16s %4d '", name, idx);
-    print_value(chunk->constants.values[idx]);
-    printf("'\n");
-    return offset + 4;
+// prints where the jump lands instead of its distance
+int jump_instruction(Writer_t *out, const char *name, Chunk_t *chunk, int offset) {
+    write_format(out, "%-16s %4d -> %04d\n", name, offset, jump_target(chunk, offset));
+    return offset + instruction_length(&chunk->code[offset]);
 }
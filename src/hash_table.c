@@ -3,20 +3,34 @@
 
 void init_hash_table(HashTable_t *hash_table) {
     hash_table->num_elems = 0;
+    hash_table->num_tombstones = 0;
     hash_table->capacity = 0;
+    hash_table->version = 0;
     hash_table->table = NULL;
+    hash_table->lookups = 0;
+    hash_table->probes = 0;
+    hash_table->resizes = 0;
+    hash_table->rehashes = 0;
+    hash_table->max_tombstone_ratio = 0;
 }
 
+// keeps the rehash setting, a freed table can be reused as is
 void free_hash_table(HashTable_t *hash_table) {
+    double max_tombstone_ratio = hash_table->max_tombstone_ratio;
     free(hash_table->table);
     init_hash_table(hash_table);
+    hash_table->max_tombstone_ratio = max_tombstone_ratio;
 }
 
-static Node_t *find_insertion_slot(Node_t *table, ObjectStr_t *key, int capacity) {
+static Node_t *find_insertion_slot(HashTable_t *hash_table, ObjectStr_t *key) {
+    Node_t *table = hash_table->table;
+    int capacity = hash_table->capacity;
     uint32_t idx = key->hash % capacity;
     Node_t *tombstone = NULL;
+    hash_table->lookups++;
     for (int i = 0; i < capacity; i++) {
         Node_t *potential_slot = &table[idx];
+        hash_table->probes++;
         if (potential_slot->key == key) {
             return potential_slot;
         } else if (potential_slot->key == NULL) {
@@ -44,31 +58,50 @@ static void resize_table(HashTable_t *hash_table, int new_capacity) {
         new_table[i].value = DECL_NONE_VAL;
     }
 
+    Node_t *old_table = hash_table->table;
+    int old_capacity = hash_table->capacity;
+    hash_table->table = new_table;
+    hash_table->capacity = new_capacity;
     hash_table->num_elems = 0;
+    hash_table->num_tombstones = 0;
 
-    for (int i = 0; i < hash_table->capacity; i++) {
-        Node_t *cur_slot = &hash_table->table[i];
+    for (int i = 0; i < old_capacity; i++) {
+        Node_t *cur_slot = &old_table[i];
         if (cur_slot->key == NULL) {
             continue;
         }
-        Node_t *new_slot = find_insertion_slot(new_table, cur_slot->key, new_capacity);
+        Node_t *new_slot = find_insertion_slot(hash_table, cur_slot->key);
         new_slot->key = cur_slot->key;
         new_slot->value = cur_slot->value;
         hash_table->num_elems++;
     }
 
-    free(hash_table->table);
-    hash_table->table = new_table;
-    hash_table->capacity = new_capacity;
+    free(old_table);
+    hash_table->version++;
+}
+
+// grows the table up front for count keys in total. filling a table in another table's slot order
+// (loading a heap image) clusters badly in the small tables growing one insert at a time would go
+// through, and skips every resize on the way
+void reserve(HashTable_t *hash_table, int count) {
+    int capacity = hash_table->capacity;
+    while (count > capacity * TABLE_MAX_LOAD) {
+        capacity = grow_capacity(capacity);
+    }
+    if (capacity != hash_table->capacity) {
+        resize_table(hash_table, capacity);
+        hash_table->resizes++;
+    }
 }
 
 bool insert(HashTable_t *hash_table, ObjectStr_t *key, Value_t value) {
     if (hash_table->num_elems + 1 > hash_table->capacity * TABLE_MAX_LOAD) {
         int new_capacity = grow_capacity(hash_table->capacity);
         resize_table(hash_table, new_capacity);
+        hash_table->resizes++;
     }
 
-    Node_t *new_slot = find_insertion_slot(hash_table->table, key, hash_table->capacity);
+    Node_t *new_slot = find_insertion_slot(hash_table, key);
     if (new_slot == NULL) {
         fprintf(stderr, "Error: hash table insertion failed");
         return false;
@@ -77,6 +110,8 @@ bool insert(HashTable_t *hash_table, ObjectStr_t *key, Value_t value) {
     bool res = new_slot->key == NULL;
     if (res && IS_NONE_VAL(new_slot->value)) {
         hash_table->num_elems++;
+    } else if (res) {
+        hash_table->num_tombstones--;
     }
 
     new_slot->key = key;
@@ -84,16 +119,21 @@ bool insert(HashTable_t *hash_table, ObjectStr_t *key, Value_t value) {
     return res;
 }
 
-Value_t *get(HashTable_t *hash_table, ObjectStr_t *key) {
+Node_t *get_node(HashTable_t *hash_table, ObjectStr_t *key) {
     if (hash_table->table == NULL) {
         return NULL;
     }
 
-    Node_t *node = find_insertion_slot(hash_table->table, key, hash_table->capacity);
+    Node_t *node = find_insertion_slot(hash_table, key);
     if (node->key == NULL) {
         return NULL;
     }
-    return &node->value;
+    return node;
+}
+
+Value_t *get(HashTable_t *hash_table, ObjectStr_t *key) {
+    Node_t *node = get_node(hash_table, key);
+    return node == NULL ? NULL : &node->value;
 }
 
 bool drop(HashTable_t *hash_table, ObjectStr_t *key) {
@@ -101,13 +141,22 @@ bool drop(HashTable_t *hash_table, ObjectStr_t *key) {
         return false;
     }
 
-    Node_t *node = find_insertion_slot(hash_table->table, key, hash_table->capacity);
+    Node_t *node = find_insertion_slot(hash_table, key);
     if (node->key == NULL) {
         return false;
     }
 
     node->key = NULL;
     node->value = DECL_BOOL_VAL(true);
+    hash_table->num_tombstones++;
+    hash_table->version++;
+    // tombstones keep lookups probing and count towards the load, rehashing at the same size
+    // clears them out
+    if (hash_table->max_tombstone_ratio > 0 &&
+        hash_table->num_tombstones > hash_table->capacity * hash_table->max_tombstone_ratio) {
+        resize_table(hash_table, hash_table->capacity);
+        hash_table->rehashes++;
+    }
     return true;
 }
 
@@ -116,8 +165,10 @@ ObjectStr_t *find_str(HashTable_t *hash_table, const char *chars, int length, ui
         return NULL;
     }
     uint32_t idx = hash % hash_table->capacity;
+    hash_table->lookups++;
     for (int i = 0; i < hash_table->capacity; i++) {
         Node_t *node = &hash_table->table[idx];
+        hash_table->probes++;
         if (node->key == NULL && IS_NONE_VAL(node->value)) {
             return NULL;
         } else if (node->key->length == length && node->key->hash == hash &&
@@ -128,3 +179,61 @@ ObjectStr_t *find_str(HashTable_t *hash_table, const char *chars, int length, ui
     }
     return NULL;
 }
+
+static int probe_bucket(int probe) {
+    int bucket = 0;
+    for (int limit = 1; probe > limit && bucket < 3; limit++) {
+        bucket++;
+    }
+    for (int limit = 4; probe > limit && bucket < TABLE_PROBE_BUCKETS - 1; limit *= 2) {
+        bucket++;
+    }
+    return bucket;
+}
+
+// walks the whole table: a key's probe length is how far it sits from its home slot, plus one
+HashTableStats_t get_table_stats(HashTable_t *hash_table) {
+    HashTableStats_t stats = {0};
+    stats.tombstones = hash_table->num_tombstones;
+    stats.capacity = hash_table->capacity;
+    stats.resizes = hash_table->resizes;
+    stats.rehashes = hash_table->rehashes;
+    uint64_t total_probes = 0;
+    for (int i = 0; i < hash_table->capacity; i++) {
+        ObjectStr_t *key = hash_table->table[i].key;
+        if (key == NULL) {
+            continue;
+        }
+        int home = key->hash % hash_table->capacity;
+        int probe = (i - home + hash_table->capacity) % hash_table->capacity + 1;
+        stats.keys++;
+        total_probes += probe;
+        stats.max_probe = probe > stats.max_probe ? probe : stats.max_probe;
+        stats.probe_histogram[probe_bucket(probe)]++;
+    }
+    if (stats.capacity > 0) {
+        stats.load_factor = (double)(stats.keys + stats.tombstones) / stats.capacity;
+        stats.tombstone_ratio = (double)stats.tombstones / stats.capacity;
+    }
+    stats.avg_probe = stats.keys == 0 ? 0.0 : (double)total_probes / stats.keys;
+    return stats;
+}
+
+void dump_table_stats(const char *name, HashTable_t *hash_table, FILE *fp) {
+    static const char *bucket_names[TABLE_PROBE_BUCKETS] = {"1",    "2",     "3",     "4",
+                                                            "5-8", "9-16", "17-32", "33+"};
+    HashTableStats_t stats = get_table_stats(hash_table);
+    fprintf(fp, "%s table: %d keys, %d tombstones (%.1f%% of slots), %d slots, load %.2f, "
+                "%u resizes, %u rehashes\n",
+            name, stats.keys, stats.tombstones, 100.0 * stats.tombstone_ratio, stats.capacity,
+            stats.load_factor, stats.resizes, stats.rehashes);
+    fprintf(fp, "  %llu lookups, %.2f slots probed per lookup; probe length per key %.2f avg, "
+                "%d max:",
+            (unsigned long long)hash_table->lookups,
+            hash_table->lookups == 0 ? 0.0 : (double)hash_table->probes / hash_table->lookups,
+            stats.avg_probe, stats.max_probe);
+    for (int i = 0; i < TABLE_PROBE_BUCKETS; i++) {
+        fprintf(fp, " %s:%d", bucket_names[i], stats.probe_histogram[i]);
+    }
+    fprintf(fp, "\n");
+}
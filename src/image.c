@@ -0,0 +1,492 @@
+#define _DEFAULT_SOURCE
+
+#include "../includes/image.h"
+#include "../includes/hash_table.h"
+#include "../includes/memory.h"
+#include "../includes/verifier.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IMAGE_MAGIC "EXPRIMG"
+#define IMAGE_VERSION 1
+#define IMAGE_ALIGN 8 // string records are used in place and hold a pointer (Object_t.next)
+
+// file layout: this header, the string records, the offset of every record, then the heap:
+// every function and native, then every global
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t op_count; // bytecode only means the same thing to the build that wrote it
+    uint32_t str_size; // sizeof(ObjectStr_t) there, the records are laid out like one
+    uint32_t num_strings;
+    uint32_t num_objects;
+    uint32_t num_globals;
+    uint64_t offsets; // uint64_t file offset of every string record, in idx order
+    uint64_t heap;
+    uint64_t size;
+} ImageHeader_t;
+
+// values name objects by ref: below num_strings it's a string's idx, the objects come after
+typedef struct {
+    uint32_t type; // ValueType_t
+    uint32_t ref;
+    uint64_t bits; // the bool, int64_t or double
+} ImageValue_t;
+
+// ------------------------ Saving ------------------------ //
+
+typedef struct {
+    uint8_t *data;
+    size_t count;
+    size_t capacity;
+} Buffer_t;
+
+static void put(Buffer_t *buffer, const void *bytes, size_t size) {
+    while (buffer->count + size > buffer->capacity) {
+        buffer->capacity = grow_capacity((int)buffer->capacity);
+        buffer->data = resize(buffer->data, sizeof(uint8_t), (int)buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->count, bytes, size);
+    buffer->count += size;
+}
+
+static void put_u32(Buffer_t *buffer, uint32_t value) {
+    put(buffer, &value, sizeof(value));
+}
+
+static void put_i32(Buffer_t *buffer, int32_t value) {
+    put(buffer, &value, sizeof(value));
+}
+
+typedef struct {
+    HashTable_t string_ids; // string -> its idx
+    uint32_t num_strings;
+    Object_t **objects; // functions and natives, in ref order
+    int num_objects;
+    int capacity;
+    const char *error; // why the image can't be written, NULL while it can
+} ImageWriter_t;
+
+// functions and natives get their ref the first time they're seen
+static uint32_t object_ref(ImageWriter_t *writer, Object_t *object) {
+    if (object->type == OBJ_STR) {
+        Value_t *idx = get(&writer->string_ids, (ObjectStr_t *)object);
+        if (idx == NULL) {
+            writer->error = "string outside of vm.strings";
+            return 0;
+        }
+        return (uint32_t)GET_INT_VAL(*idx);
+    }
+    for (int i = 0; i < writer->num_objects; i++) {
+        if (writer->objects[i] == object) {
+            return writer->num_strings + i;
+        }
+    }
+    if (writer->num_objects + 1 > writer->capacity) {
+        writer->capacity = grow_capacity(writer->capacity);
+        writer->objects = resize(writer->objects, sizeof(Object_t *), writer->capacity);
+    }
+    writer->objects[writer->num_objects++] = object;
+    return writer->num_strings + writer->num_objects - 1;
+}
+
+static void put_value(ImageWriter_t *writer, Buffer_t *buffer, Value_t value) {
+    ImageValue_t image = {.type = value.type, .ref = 0, .bits = 0};
+    switch (value.type) {
+        case VAL_BOOL:
+            image.bits = GET_BOOL_VAL(value);
+            break;
+        case VAL_NUM:
+            memcpy(&image.bits, &GET_NUM_VAL(value), sizeof(double));
+            break;
+        case VAL_INT:
+            image.bits = (uint64_t)GET_INT_VAL(value);
+            break;
+        case VAL_OBJ:
+            image.ref = object_ref(writer, GET_OBJ_VAL(value));
+            break;
+        case VAL_NONE:
+            break;
+    }
+    put(buffer, &image, sizeof(image));
+}
+
+// a function's constants are only ever strings and literals, so loading never waits on an object
+// that comes later
+static void put_object(ImageWriter_t *writer, Buffer_t *heap, Object_t *object) {
+    put_u32(heap, object->type);
+    if (object->type == OBJ_NATIVE) {
+        put_u32(heap, object_ref(writer, (Object_t *)((ObjectNative_t *)object)->name));
+        return;
+    }
+    ObjectFunc_t *function = (ObjectFunc_t *)object;
+    Chunk_t *chunk = &function->chunk;
+    put_u32(heap, object_ref(writer, (Object_t *)function->name));
+    put_i32(heap, chunk->arity);
+    put_i32(heap, chunk->max_stack);
+    put_i32(heap, chunk->cache_base);
+    put_i32(heap, chunk->count);
+    put_i32(heap, chunk->constants.count);
+    put_i32(heap, chunk->line_runs.count);
+    put(heap, chunk->code, chunk->count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value_t constant = chunk->constants.values[i];
+        if (IS_OBJ_VAL(constant) && !IS_STR(constant)) {
+            writer->error = "function with an object constant";
+        }
+        put_value(writer, heap, constant);
+    }
+    put(heap, chunk->line_runs.line_runs, sizeof(LineRun_t) * chunk->line_runs.count);
+}
+
+// string records are padded so the next one stays aligned
+static void put_string_record(Buffer_t *strings, ObjectStr_t *str) {
+    ObjectStr_t record;
+    memset(&record, 0, sizeof(record));
+    record.object.type = OBJ_STR;
+    record.object.next = NULL;
+    record.hash = str->hash;
+    record.length = str->length;
+    put(strings, &record, sizeof(record));
+    put(strings, str->chars, str->length + 1);
+    static const uint8_t padding[IMAGE_ALIGN] = {0};
+    put(strings, padding, (IMAGE_ALIGN - strings->count % IMAGE_ALIGN) % IMAGE_ALIGN);
+}
+
+static bool write_image(const char *path, ImageHeader_t *header, Buffer_t *sections, int count) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return false;
+    }
+    bool ok = fwrite(header, sizeof(ImageHeader_t), 1, fp) == 1;
+    for (int i = 0; ok && i < count; i++) {
+        ok = fwrite(sections[i].data, 1, sections[i].count, fp) == sections[i].count;
+    }
+    return fclose(fp) == 0 && ok;
+}
+
+bool save_image(vm_t *vm, const char *path) {
+    if (vm->shared_strings != NULL) {
+        fprintf(vm->err, "Error: can't save an image of a vm with a shared intern table\n");
+        return false;
+    }
+    ImageWriter_t writer = {.num_strings = 0, .objects = NULL, .num_objects = 0, .capacity = 0,
+                            .error = NULL};
+    init_hash_table(&writer.string_ids);
+    enum { STRINGS, OFFSETS, HEAP, NUM_SECTIONS };
+    Buffer_t sections[NUM_SECTIONS] = {{0}};
+
+    for (int i = 0; i < vm->strings.capacity; i++) {
+        ObjectStr_t *str = vm->strings.table[i].key;
+        if (str == NULL) {
+            continue;
+        }
+        insert(&writer.string_ids, str, DECL_INT_VAL(writer.num_strings++));
+        uint64_t offset = sizeof(ImageHeader_t) + sections[STRINGS].count;
+        put(&sections[OFFSETS], &offset, sizeof(offset));
+        put_string_record(&sections[STRINGS], str);
+    }
+
+    // globals first so every object they hold has a ref, they go after the objects in the file
+    Buffer_t globals = {0};
+    uint32_t num_globals = 0;
+    for (int i = 0; i < vm->globals.capacity; i++) {
+        Node_t *node = &vm->globals.table[i];
+        if (node->key != NULL) {
+            put_u32(&globals, object_ref(&writer, (Object_t *)node->key));
+            put_value(&writer, &globals, node->value);
+            num_globals++;
+        }
+    }
+    for (int i = 0; i < writer.num_objects; i++) {
+        put_object(&writer, &sections[HEAP], writer.objects[i]);
+    }
+    put(&sections[HEAP], globals.data, globals.count);
+
+    ImageHeader_t header = {.magic = IMAGE_MAGIC,
+                            .version = IMAGE_VERSION,
+                            .op_count = OP_COUNT,
+                            .str_size = sizeof(ObjectStr_t),
+                            .num_strings = writer.num_strings,
+                            .num_objects = writer.num_objects,
+                            .num_globals = num_globals};
+    header.offsets = sizeof(ImageHeader_t) + sections[STRINGS].count;
+    header.heap = header.offsets + sections[OFFSETS].count;
+    header.size = header.heap + sections[HEAP].count;
+
+    bool ok = writer.error == NULL;
+    if (!ok) {
+        fprintf(vm->err, "Error: can't save an image: %s\n", writer.error);
+    } else if (!write_image(path, &header, sections, NUM_SECTIONS)) {
+        fprintf(vm->err, "Error: can't write image to \"%s\"\n", path);
+        ok = false;
+    }
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        free(sections[i].data);
+    }
+    free(globals.data);
+    free(writer.objects);
+    free_hash_table(&writer.string_ids);
+    return ok;
+}
+
+// ------------------------ Loading ------------------------ //
+
+// everything read from the file is bounds checked, a bad read leaves ok false and zeroes
+typedef struct {
+    const uint8_t *data;
+    size_t pos;
+    size_t size;
+    bool ok;
+} Reader_t;
+
+static void take(Reader_t *reader, void *out, size_t size) {
+    if (!reader->ok || size > reader->size - reader->pos) {
+        reader->ok = false;
+        memset(out, 0, size);
+        return;
+    }
+    memcpy(out, reader->data + reader->pos, size);
+    reader->pos += size;
+}
+
+static uint32_t take_u32(Reader_t *reader) {
+    uint32_t value;
+    take(reader, &value, sizeof(value));
+    return value;
+}
+
+// a count of things of unit_size each that are still to come in the file
+static int take_count(Reader_t *reader, size_t unit_size) {
+    int32_t count;
+    take(reader, &count, sizeof(count));
+    if (count < 0 || (size_t)count > (reader->size - reader->pos) / unit_size) {
+        reader->ok = false;
+        return 0;
+    }
+    return count;
+}
+
+typedef struct {
+    vm_t *vm;
+    Reader_t reader;
+    Object_t **refs;
+    uint32_t num_refs; // resolved so far
+    uint32_t num_strings;
+} ImageLoader_t;
+
+static Object_t *resolve_ref(ImageLoader_t *loader, uint32_t ref, bool string) {
+    if (ref >= loader->num_refs || (string && ref >= loader->num_strings)) {
+        loader->reader.ok = false;
+        return NULL;
+    }
+    return loader->refs[ref];
+}
+
+static Value_t take_value(ImageLoader_t *loader, bool strings_only) {
+    ImageValue_t image;
+    take(&loader->reader, &image, sizeof(image));
+    switch (image.type) {
+        case VAL_BOOL:
+            return DECL_BOOL_VAL(image.bits != 0);
+        case VAL_NUM: {
+            double num;
+            memcpy(&num, &image.bits, sizeof(num));
+            return DECL_NUM_VAL(num);
+        }
+        case VAL_INT:
+            return DECL_INT_VAL((int64_t)image.bits);
+        case VAL_OBJ: {
+            Object_t *object = resolve_ref(loader, image.ref, strings_only);
+            return object == NULL ? DECL_NONE_VAL : DECL_OBJ_VAL(object);
+        }
+        case VAL_NONE:
+            return DECL_NONE_VAL;
+        default:
+            loader->reader.ok = false;
+            return DECL_NONE_VAL;
+    }
+}
+
+// records are interned where they sit in the mapping, unless the vm has the string already
+static bool load_strings(ImageLoader_t *loader, const ImageHeader_t *header) {
+    const uint8_t *base = loader->reader.data;
+    size_t size = loader->reader.size;
+    if (header->offsets > size || (size - header->offsets) / sizeof(uint64_t) < header->num_strings) {
+        return false;
+    }
+    reserve(&loader->vm->strings, loader->vm->strings.num_elems + header->num_strings);
+    for (uint32_t i = 0; i < header->num_strings; i++) {
+        uint64_t offset;
+        memcpy(&offset, base + header->offsets + i * sizeof(uint64_t), sizeof(offset));
+        if (offset % IMAGE_ALIGN != 0 || offset > size || size - offset < sizeof(ObjectStr_t)) {
+            return false;
+        }
+        ObjectStr_t *record = (ObjectStr_t *)(base + offset);
+        if (record->object.type != OBJ_STR || record->length < 0 ||
+            size - offset - sizeof(ObjectStr_t) < (size_t)record->length + 1 ||
+            record->chars[record->length] != '\0') {
+            return false;
+        }
+        ObjectStr_t *str =
+            find_str(&loader->vm->strings, record->chars, record->length, record->hash);
+        if (str == NULL) {
+            insert(&loader->vm->strings, record, DECL_NONE_VAL);
+            str = record;
+        }
+        loader->refs[loader->num_refs++] = (Object_t *)str;
+    }
+    return true;
+}
+
+// the natives the vm defined before loading, by name
+static Object_t *find_native(vm_t *vm, ObjectStr_t *name) {
+    for (Object_t *object = vm->objects; object != NULL; object = object->next) {
+        if (object->type == OBJ_NATIVE && ((ObjectNative_t *)object)->name == name) {
+            return object;
+        }
+    }
+    return NULL;
+}
+
+// the line runs have to cover the code exactly, the verifier takes care of the rest
+static bool load_chunk(ImageLoader_t *loader, Chunk_t *chunk) {
+    Reader_t *reader = &loader->reader;
+    int32_t fields[3];
+    take(reader, fields, sizeof(fields));
+    chunk->arity = fields[0];
+    chunk->max_stack = fields[1];
+    chunk->cache_base = fields[2];
+    int count = take_count(reader, 1);
+    int num_constants = take_count(reader, sizeof(ImageValue_t));
+    int num_line_runs = take_count(reader, sizeof(LineRun_t));
+    if (!reader->ok || chunk->arity < 0 || chunk->max_stack < 0 || chunk->cache_base < 0) {
+        return false;
+    }
+
+    chunk->code = resize(NULL, sizeof(uint8_t), count > 0 ? count : 1);
+    chunk->capacity = count;
+    chunk->count = count;
+    take(reader, chunk->code, count);
+    for (int i = 0; i < num_constants; i++) {
+        write_value_array(&chunk->constants, take_value(loader, true));
+    }
+    int covered = 0;
+    for (int i = 0; i < num_line_runs; i++) {
+        LineRun_t run;
+        take(reader, &run, sizeof(run));
+        if (run.line < 0 || run.count <= 0 || run.count > count - covered) {
+            return false;
+        }
+        covered += run.count;
+        write_line_array(&chunk->line_runs, run);
+    }
+    return reader->ok && covered == count;
+}
+
+static bool load_heap(ImageLoader_t *loader, const ImageHeader_t *header) {
+    vm_t *vm = loader->vm;
+    Reader_t *reader = &loader->reader;
+    if (header->heap > reader->size) {
+        return false;
+    }
+    reader->pos = header->heap;
+    for (uint32_t i = 0; i < header->num_objects && reader->ok; i++) {
+        uint32_t type = take_u32(reader);
+        ObjectStr_t *name = (ObjectStr_t *)resolve_ref(loader, take_u32(reader), true);
+        if (!reader->ok) {
+            return false;
+        } else if (type == OBJ_NATIVE) {
+            Object_t *native = find_native(vm, name);
+            if (native == NULL) {
+                fprintf(vm->err, "Error: image needs native %s() which isn't defined\n",
+                        name->chars);
+                return false;
+            }
+            loader->refs[loader->num_refs++] = native;
+        } else if (type == OBJ_FUNC) {
+            ObjectFunc_t *function = allocate_func(vm, name);
+            loader->refs[loader->num_refs++] = (Object_t *)function;
+            if (!load_chunk(loader, &function->chunk) ||
+                !verify_chunk(&function->chunk, vm->err)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    if (header->num_globals > (reader->size - reader->pos) / (sizeof(uint32_t) + sizeof(ImageValue_t))) {
+        return false;
+    }
+    reserve(&vm->globals, vm->globals.num_elems + header->num_globals);
+    for (uint32_t i = 0; i < header->num_globals && reader->ok; i++) {
+        ObjectStr_t *name = (ObjectStr_t *)resolve_ref(loader, take_u32(reader), true);
+        Value_t value = take_value(loader, false);
+        if (reader->ok) {
+            insert(&vm->globals, name, value);
+        }
+    }
+    return reader->ok && reader->pos == reader->size;
+}
+
+bool load_image(vm_t *vm, const char *path) {
+    if (vm->shared_strings != NULL || vm->image != NULL) {
+        fprintf(vm->err, "Error: can't load image \"%s\" into this vm\n", path);
+        return false;
+    }
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(ImageHeader_t)) {
+        fprintf(vm->err, "Error: can't read image \"%s\"\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    size_t size = (size_t)info.st_size;
+    void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(vm->err, "Error: can't map image \"%s\"\n", path);
+        return false;
+    }
+
+    ImageHeader_t header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != IMAGE_VERSION || header.op_count != OP_COUNT ||
+        header.str_size != sizeof(ObjectStr_t) || header.size != size) {
+        fprintf(vm->err, "Error: \"%s\" isn't an image this build can load\n", path);
+        munmap(base, size);
+        return false;
+    }
+
+    // from the first string interned on, the vm points into the mapping. it stays mapped until
+    // free_vm(), even when the rest of the image turns out to be bad
+    vm->image = base;
+    vm->image_size = size;
+    ImageLoader_t loader = {.vm = vm,
+                            .reader = {.data = base, .pos = 0, .size = size, .ok = true},
+                            .num_refs = 0,
+                            .num_strings = header.num_strings};
+    size_t num_refs = (size_t)header.num_strings + header.num_objects;
+    bool ok = num_refs <= size; // every string and object takes up at least a byte
+    loader.refs = ok ? ALLOCATE(Object_t *, num_refs + 1) : NULL;
+    ok = ok && load_strings(&loader, &header) && load_heap(&loader, &header);
+    free(loader.refs);
+    if (!ok) {
+        fprintf(vm->err, "Error: image \"%s\" is corrupt\n", path);
+    }
+    return ok;
+}
+
+void unmap_image(vm_t *vm) {
+    if (vm->image != NULL) {
+        munmap(vm->image, vm->image_size);
+        vm->image = NULL;
+        vm->image_size = 0;
+    }
+}
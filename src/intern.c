@@ -0,0 +1,115 @@
+#include "../includes/intern.h"
+#include "../includes/hash_table.h"
+#include "../includes/memory.h"
+
+static InternSlots_t *allocate_slots(int capacity) {
+    InternSlots_t *slots =
+        (InternSlots_t *)malloc(sizeof(InternSlots_t) + sizeof(ObjectStr_t *) * capacity);
+    if (slots == NULL) {
+        fprintf(stderr, "Error: not enough memory avaialable");
+        exit(1);
+    }
+    slots->capacity = capacity;
+    slots->retired = NULL;
+    for (int i = 0; i < capacity; i++) {
+        slots->keys[i] = NULL;
+    }
+    return slots;
+}
+
+void init_intern_table(InternTable_t *intern_table) {
+    intern_table->slots = NULL;
+    intern_table->count = 0;
+    intern_table->objects = NULL;
+    pthread_mutex_init(&intern_table->lock, NULL);
+}
+
+// caller must make sure no vm is still using the table
+void free_intern_table(InternTable_t *intern_table) {
+    InternSlots_t *slots = intern_table->slots;
+    while (slots != NULL) {
+        InternSlots_t *older = slots->retired;
+        free(slots);
+        slots = older;
+    }
+    free_object_list(intern_table->objects);
+    pthread_mutex_destroy(&intern_table->lock);
+    intern_table->slots = NULL;
+    intern_table->count = 0;
+    intern_table->objects = NULL;
+}
+
+// keys are published with release stores after the string is fully written, so an acquire load
+// that sees a key also sees its chars
+static ObjectStr_t *probe(InternSlots_t *slots, const char *chars, int length, uint32_t hash) {
+    if (slots == NULL) {
+        return NULL;
+    }
+    uint32_t idx = hash % slots->capacity;
+    for (int i = 0; i < slots->capacity; i++) {
+        ObjectStr_t *key = __atomic_load_n(&slots->keys[idx], __ATOMIC_ACQUIRE);
+        if (key == NULL) {
+            return NULL;
+        } else if (key->length == length && key->hash == hash &&
+                   memcmp(key->chars, chars, length) == 0) {
+            return key;
+        }
+        idx = (idx + 1) % slots->capacity;
+    }
+    return NULL;
+}
+
+static void place(InternSlots_t *slots, ObjectStr_t *key) {
+    uint32_t idx = key->hash % slots->capacity;
+    while (slots->keys[idx] != NULL) {
+        idx = (idx + 1) % slots->capacity;
+    }
+    __atomic_store_n(&slots->keys[idx], key, __ATOMIC_RELEASE);
+}
+
+// readers may still hold the old array so it is retired rather than freed
+static void grow(InternTable_t *intern_table) {
+    InternSlots_t *old_slots = intern_table->slots;
+    int old_capacity = old_slots == NULL ? 0 : old_slots->capacity;
+    InternSlots_t *new_slots = allocate_slots(grow_capacity(old_capacity));
+
+    for (int i = 0; i < old_capacity; i++) {
+        if (old_slots->keys[i] != NULL) {
+            place(new_slots, old_slots->keys[i]);
+        }
+    }
+    new_slots->retired = old_slots;
+    __atomic_store_n(&intern_table->slots, new_slots, __ATOMIC_RELEASE);
+}
+
+// lock-free lookup only, NULL if the string was never interned
+ObjectStr_t *find_shared_str(InternTable_t *intern_table, const char *chars, int length,
+                            uint32_t hash) {
+    return probe(__atomic_load_n(&intern_table->slots, __ATOMIC_ACQUIRE), chars, length, hash);
+}
+
+ObjectStr_t *intern_str(InternTable_t *intern_table, const char *chars, int length, uint32_t hash) {
+    // fast path: no lock, most lookups of a shared vocabulary end here
+    InternSlots_t *slots = __atomic_load_n(&intern_table->slots, __ATOMIC_ACQUIRE);
+    ObjectStr_t *interned = probe(slots, chars, length, hash);
+    if (interned != NULL) {
+        return interned;
+    }
+
+    pthread_mutex_lock(&intern_table->lock);
+    // someone may have inserted it (or grown the table) since our lookup
+    interned = probe(intern_table->slots, chars, length, hash);
+    if (interned == NULL) {
+        int capacity = intern_table->slots == NULL ? 0 : intern_table->slots->capacity;
+        if (intern_table->count + 1 > capacity * TABLE_MAX_LOAD) {
+            grow(intern_table);
+        }
+        interned = allocate_unowned_str(chars, length, hash);
+        interned->object.next = intern_table->objects;
+        intern_table->objects = (Object_t *)interned;
+        place(intern_table->slots, interned);
+        intern_table->count++;
+    }
+    pthread_mutex_unlock(&intern_table->lock);
+    return interned;
+}
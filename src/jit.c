@@ -0,0 +1,758 @@
+#define _DEFAULT_SOURCE
+
+#include "../includes/jit.h"
+#include "../includes/memory.h"
+#include "../includes/vm.h"
+
+// template jit: every opcode of a chunk is replaced by a fixed snippet of x86-64. number
+// arithmetic and comparisons are inlined behind type guards (int op int with an overflow check,
+// double op double in sse; mixed operands deopt, except in division which converts them like the
+// interpreter), everything else calls a small helper.
+// a failed guard deoptimizes: the snippet hands vm->pc / vm->stack_top back and the interpreter
+// finishes the chunk from that instruction.
+// scripts and programs are compiled when they have a loop / once they're hot, functions after
+// JIT_HOT_THRESHOLD calls. a call runs the callee to completion inside its helper (natively when
+// the callee has native code) and comes back; a tail call leaves the chunk with JIT_TAIL_CALL and
+// vm.c enters the callee's code in its place, so tail recursion doesn't grow the C stack
+//
+// registers while jitted code runs:
+//   rbx = vm_t *vm
+//   r12 = vm->stack_top (written back before helpers run and whenever we leave)
+// jumps are native jumps between the instructions' snippets, so loops never leave native code
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+struct JitCode_t {
+    JitStatus_t (*entry)(vm_t *vm);
+    void *memory;
+    size_t size;
+};
+
+typedef struct {
+    int code_offset;     // where the rel32 of the guard's jne lives
+    uint8_t *resume_pc;  // instruction the interpreter restarts from
+} Deopt_t;
+
+typedef struct {
+    int code_offset; // rel32 of a jmp / jcc to another instruction of the chunk
+    int target;      // bytecode offset of that instruction
+} JumpFixup_t;
+
+typedef struct {
+    int capacity;
+    int count;
+    uint8_t *bytes;
+    int num_deopts;
+    int deopt_capacity;
+    Deopt_t *deopts;
+    int *error_jumps; // rel32 spots that jump to the error exit
+    int num_error_jumps;
+    int error_jump_capacity;
+    JumpFixup_t *jumps; // patched once every instruction's native offset is known
+    int num_jumps;
+    int jump_capacity;
+} Assembler_t;
+
+// ------------------------ Emission ------------------------ //
+
+static void emit(Assembler_t *as, uint8_t byte) {
+    if (as->count + 1 > as->capacity) {
+        as->capacity = grow_capacity(as->capacity);
+        as->bytes = resize(as->bytes, sizeof(uint8_t), as->capacity);
+    }
+    as->bytes[as->count++] = byte;
+}
+
+static void emit_n(Assembler_t *as, const uint8_t *bytes, int n) {
+    for (int i = 0; i < n; i++) {
+        emit(as, bytes[i]);
+    }
+}
+
+static void emit_32(Assembler_t *as, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        emit(as, (value >> (8 * i)) & 0xFF);
+    }
+}
+
+static void emit_64(Assembler_t *as, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        emit(as, (value >> (8 * i)) & 0xFF);
+    }
+}
+
+static void patch_32(Assembler_t *as, int at, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        as->bytes[at + i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+// rel32 jump target fixups once the destination is known
+static void patch_jump(Assembler_t *as, int rel_at, int target) {
+    patch_32(as, rel_at, (uint32_t)(target - (rel_at + 4)));
+}
+
+// mov rax, imm64
+static void mov_rax_imm(Assembler_t *as, uint64_t imm) {
+    emit_n(as, (uint8_t[]){0x48, 0xB8}, 2);
+    emit_64(as, imm);
+}
+
+// mov [rbx + disp32], rax / r12 and back
+static void store_rax_vm(Assembler_t *as, int disp) {
+    emit_n(as, (uint8_t[]){0x48, 0x89, 0x83}, 3);
+    emit_32(as, disp);
+}
+
+static void store_r12_vm(Assembler_t *as, int disp) {
+    emit_n(as, (uint8_t[]){0x4C, 0x89, 0xA3}, 3);
+    emit_32(as, disp);
+}
+
+static void load_r12_vm(Assembler_t *as, int disp) {
+    emit_n(as, (uint8_t[]){0x4C, 0x8B, 0xA3}, 3);
+    emit_32(as, disp);
+}
+
+// add / sub r12, imm8 (stack pointer bumps by whole Value_ts)
+static void bump_stack(Assembler_t *as, int values) {
+    int bytes = values * (int)sizeof(Value_t);
+    if (bytes >= 0) {
+        emit_n(as, (uint8_t[]){0x49, 0x83, 0xC4, (uint8_t)bytes}, 4);
+    } else {
+        emit_n(as, (uint8_t[]){0x49, 0x83, 0xEC, (uint8_t)(-bytes)}, 4);
+    }
+}
+
+#define CC_OVERFLOW 0x80 // condition codes of the 0x0F 0x8? jcc rel32 forms
+#define CC_EQUAL 0x84
+#define CC_NOT_EQUAL 0x85
+
+// jcc deopt
+static void deopt_if(Assembler_t *as, uint8_t cc, uint8_t *resume_pc) {
+    emit_n(as, (uint8_t[]){0x0F, cc}, 2);
+    if (as->num_deopts + 1 > as->deopt_capacity) {
+        as->deopt_capacity = grow_capacity(as->deopt_capacity);
+        as->deopts = resize(as->deopts, sizeof(Deopt_t), as->deopt_capacity);
+    }
+    as->deopts[as->num_deopts++] = (Deopt_t){.code_offset = as->count, .resume_pc = resume_pc};
+    emit_32(as, 0);
+}
+
+// cmp dword [r12 + disp8], type
+static void cmp_type(Assembler_t *as, int disp, ValueType_t type) {
+    emit_n(as, (uint8_t[]){0x41, 0x83, 0x7C, 0x24, (uint8_t)disp, (uint8_t)type}, 6);
+}
+
+// cmp dword [r12 + disp8], VAL_NUM ; jne deopt
+static void guard_num(Assembler_t *as, int disp, uint8_t *resume_pc) {
+    cmp_type(as, disp, VAL_NUM);
+    deopt_if(as, CC_NOT_EQUAL, resume_pc);
+}
+
+// jcc / jmp rel32 to a spot in the snippet, patched with patch_jump() once it's emitted
+static int jump_forward(Assembler_t *as, uint8_t cc) {
+    if (cc == 0) {
+        emit(as, 0xE9);
+    } else {
+        emit_n(as, (uint8_t[]){0x0F, cc}, 2);
+    }
+    emit_32(as, 0);
+    return as->count - 4;
+}
+
+// jcc / jmp rel32 to the code of the instruction at bytecode offset target
+static void jump_to(Assembler_t *as, uint8_t cc, int target) {
+    if (as->num_jumps + 1 > as->jump_capacity) {
+        as->jump_capacity = grow_capacity(as->jump_capacity);
+        as->jumps = resize(as->jumps, sizeof(JumpFixup_t), as->jump_capacity);
+    }
+    as->jumps[as->num_jumps++] = (JumpFixup_t){.code_offset = jump_forward(as, cc),
+                                               .target = target};
+}
+
+// <sse op> xmm0, [r12 + disp8] with the given prefix / opcode (movsd, addsd, ucomisd ...)
+static void sse_r12(Assembler_t *as, uint8_t prefix, uint8_t opcode, int disp) {
+    emit_n(as, (uint8_t[]){prefix, 0x41, 0x0F, opcode, 0x44, 0x24, (uint8_t)disp}, 7);
+}
+
+// top two stack values (offsets from r12) as laid out in a Value_t
+#define TYPE_AT(slot) (-(slot) * (int)sizeof(Value_t) + (int)offsetof(Value_t, type))
+#define DATA_AT(slot) (-(slot) * (int)sizeof(Value_t) + (int)offsetof(Value_t, data))
+
+// both operands ints: falls into the int code. an int next to anything else deopts, so does an
+// int result that overflows. returns the jump to the double path (taken when the top isn't an int)
+static int guard_ints(Assembler_t *as, uint8_t *resume_pc) {
+    cmp_type(as, TYPE_AT(1), VAL_INT);
+    int not_int = jump_forward(as, CC_NOT_EQUAL);
+    cmp_type(as, TYPE_AT(2), VAL_INT);
+    deopt_if(as, CC_NOT_EQUAL, resume_pc);
+    emit_n(as, (uint8_t[]){0x49, 0x8B, 0x44, 0x24, (uint8_t)DATA_AT(2)}, 5); // mov rax, a
+    return not_int;
+}
+
+// int_op is the rax, [r12 + disp8] form of add / sub / imul
+static void binary_num(Assembler_t *as, const uint8_t *int_op, int int_op_length,
+                       uint8_t sse_opcode, uint8_t *resume_pc) {
+    int not_int = guard_ints(as, resume_pc);
+    emit_n(as, int_op, int_op_length);
+    emit(as, (uint8_t)DATA_AT(1));
+    deopt_if(as, CC_OVERFLOW, resume_pc);
+    emit_n(as, (uint8_t[]){0x49, 0x89, 0x44, 0x24, (uint8_t)DATA_AT(2)}, 5); // mov a, rax
+    int done = jump_forward(as, 0);
+    patch_jump(as, not_int, as->count);
+
+    guard_num(as, TYPE_AT(1), resume_pc);
+    guard_num(as, TYPE_AT(2), resume_pc);
+    sse_r12(as, 0xF2, 0x10, DATA_AT(2)); // movsd xmm0, a
+    sse_r12(as, 0xF2, sse_opcode, DATA_AT(1));
+    sse_r12(as, 0xF2, 0x11, DATA_AT(2)); // movsd a, xmm0
+    patch_jump(as, done, as->count);
+    bump_stack(as, -1);
+}
+
+// xmm0 / xmm1 (xmm) = the number at slot, an int goes through cvtsi2sd like GET_NUMBER_VAL().
+// anything else deopts
+static void load_number(Assembler_t *as, int xmm, int slot, uint8_t *resume_pc) {
+    uint8_t modrm = (uint8_t)(0x44 | xmm << 3);
+    cmp_type(as, TYPE_AT(slot), VAL_INT);
+    int not_int = jump_forward(as, CC_NOT_EQUAL);
+    emit_n(as, (uint8_t[]){0xF2, 0x49, 0x0F, 0x2A, modrm, 0x24, (uint8_t)DATA_AT(slot)}, 7);
+    int done = jump_forward(as, 0);
+    patch_jump(as, not_int, as->count);
+    guard_num(as, TYPE_AT(slot), resume_pc);
+    emit_n(as, (uint8_t[]){0xF2, 0x41, 0x0F, 0x10, modrm, 0x24, (uint8_t)DATA_AT(slot)}, 7);
+    patch_jump(as, done, as->count);
+}
+
+// same as div_ints() in the interpreter: two ints stay an int when b divides a exactly, every
+// other pair of numbers (zero divisors and INT64_MIN / -1 included) is divided as doubles
+static void divide_num(Assembler_t *as, uint8_t *resume_pc) {
+    int to_double[5];
+    cmp_type(as, TYPE_AT(1), VAL_INT);
+    to_double[0] = jump_forward(as, CC_NOT_EQUAL);
+    cmp_type(as, TYPE_AT(2), VAL_INT);
+    to_double[1] = jump_forward(as, CC_NOT_EQUAL);
+    emit_n(as, (uint8_t[]){0x49, 0x8B, 0x44, 0x24, (uint8_t)DATA_AT(2)}, 5); // mov rax, a
+    emit_n(as, (uint8_t[]){0x49, 0x8B, 0x4C, 0x24, (uint8_t)DATA_AT(1)}, 5); // mov rcx, b
+    emit_n(as, (uint8_t[]){0x48, 0x85, 0xC9}, 3);                            // test rcx, rcx
+    to_double[2] = jump_forward(as, CC_EQUAL);
+    // idiv faults on INT64_MIN / -1, -1 is a neg instead and overflows on exactly that
+    emit_n(as, (uint8_t[]){0x48, 0x83, 0xF9, 0xFF}, 4); // cmp rcx, -1
+    int not_minus_one = jump_forward(as, CC_NOT_EQUAL);
+    emit_n(as, (uint8_t[]){0x48, 0xF7, 0xD8}, 3); // neg rax
+    to_double[3] = jump_forward(as, CC_OVERFLOW);
+    int store = jump_forward(as, 0);
+    patch_jump(as, not_minus_one, as->count);
+    emit_n(as, (uint8_t[]){0x48, 0x99, 0x48, 0xF7, 0xF9}, 5); // cqo ; idiv rcx
+    emit_n(as, (uint8_t[]){0x48, 0x85, 0xD2}, 3);             // test rdx, rdx
+    to_double[4] = jump_forward(as, CC_NOT_EQUAL);
+    patch_jump(as, store, as->count);
+    emit_n(as, (uint8_t[]){0x49, 0x89, 0x44, 0x24, (uint8_t)DATA_AT(2)}, 5); // mov a, rax
+    int done = jump_forward(as, 0);
+
+    for (int i = 0; i < 5; i++) {
+        patch_jump(as, to_double[i], as->count);
+    }
+    load_number(as, 0, 2, resume_pc);
+    load_number(as, 1, 1, resume_pc);
+    emit_n(as, (uint8_t[]){0xF2, 0x0F, 0x5E, 0xC1}, 4); // divsd xmm0, xmm1
+    sse_r12(as, 0xF2, 0x11, DATA_AT(2));                // movsd a, xmm0
+    emit_n(as, (uint8_t[]){0x41, 0xC7, 0x44, 0x24, (uint8_t)TYPE_AT(2)}, 5);
+    emit_32(as, VAL_NUM);
+    patch_jump(as, done, as->count);
+    bump_stack(as, -1);
+}
+
+// al = first > second (or <), stack untouched: ints with cmp + setg / setl, doubles with ucomisd +
+// seta so NaN compares false like in C
+static void compare_flags(Assembler_t *as, bool greater, uint8_t *resume_pc) {
+    int not_int = guard_ints(as, resume_pc);
+    emit_n(as, (uint8_t[]){0x49, 0x3B, 0x44, 0x24, (uint8_t)DATA_AT(1)}, 5); // cmp rax, b
+    emit_n(as, (uint8_t[]){0x0F, greater ? 0x9F : 0x9C, 0xC0}, 3);          // setg / setl al
+    int done = jump_forward(as, 0);
+    patch_jump(as, not_int, as->count);
+
+    guard_num(as, TYPE_AT(1), resume_pc);
+    guard_num(as, TYPE_AT(2), resume_pc);
+    sse_r12(as, 0xF2, 0x10, greater ? DATA_AT(2) : DATA_AT(1));
+    sse_r12(as, 0x66, 0x2E, greater ? DATA_AT(1) : DATA_AT(2));
+    emit_n(as, (uint8_t[]){0x0F, 0x97, 0xC0}, 3); // seta al
+    patch_jump(as, done, as->count);
+}
+
+static void compare_num(Assembler_t *as, bool greater, uint8_t *resume_pc) {
+    compare_flags(as, greater, resume_pc);
+    emit_n(as, (uint8_t[]){0x0F, 0xB6, 0xC0}, 3); // movzx eax, al
+    emit_n(as, (uint8_t[]){0x41, 0xC7, 0x44, 0x24, (uint8_t)TYPE_AT(2)}, 5);
+    emit_32(as, VAL_BOOL);
+    emit_n(as, (uint8_t[]){0x49, 0x89, 0x44, 0x24, (uint8_t)DATA_AT(2)}, 5);
+    bump_stack(as, -1);
+}
+
+// fused compare and branch: jumps to target when the comparison's outcome is taken
+static void compare_jump(Assembler_t *as, bool greater, bool taken, int target,
+                         uint8_t *resume_pc) {
+    compare_flags(as, greater, resume_pc);
+    bump_stack(as, -2);
+    emit_n(as, (uint8_t[]){0x84, 0xC0}, 2); // test al, al
+    jump_to(as, taken ? CC_NOT_EQUAL : CC_EQUAL, target);
+}
+
+// pops the condition, jumps to target when it's none or false
+// jumps to target if the value at slot is falsey (none or false), or truthy with on_truthy set
+static void jump_on_truth(Assembler_t *as, int slot, bool on_truthy, int target) {
+    cmp_type(as, TYPE_AT(slot), VAL_NONE);
+    int none = -1;
+    if (on_truthy) {
+        none = jump_forward(as, CC_EQUAL);
+    } else {
+        jump_to(as, CC_EQUAL, target);
+    }
+    cmp_type(as, TYPE_AT(slot), VAL_BOOL);
+    int not_bool = -1;
+    if (on_truthy) {
+        jump_to(as, CC_NOT_EQUAL, target);
+    } else {
+        not_bool = jump_forward(as, CC_NOT_EQUAL);
+    }
+    emit_n(as, (uint8_t[]){0x41, 0x80, 0x7C, 0x24, (uint8_t)DATA_AT(slot), 0x00}, 6); // cmp byte
+    jump_to(as, on_truthy ? CC_NOT_EQUAL : CC_EQUAL, target);
+    patch_jump(as, on_truthy ? none : not_bool, as->count);
+}
+
+// OP_JUMP_IF_FALSE / OP_JUMP_IF_TRUE pop before testing, the short circuit jumps only pop when
+// they fall through
+static void branch(Assembler_t *as, bool on_truthy, bool keep_value, int target) {
+    if (keep_value) {
+        jump_on_truth(as, 1, on_truthy, target);
+        bump_stack(as, -1);
+    } else {
+        bump_stack(as, -1);
+        jump_on_truth(as, 0, on_truthy, target);
+    }
+}
+
+// rax = vm->stack_base, then movups between xmm0 and [rax + slot * 16]
+static void slot_access(Assembler_t *as, uint8_t movups_opcode, int slot) {
+    emit_n(as, (uint8_t[]){0x48, 0x8B, 0x83}, 3);
+    emit_32(as, offsetof(vm_t, stack_base));
+    emit_n(as, (uint8_t[]){0x0F, movups_opcode, 0x80}, 3);
+    emit_32(as, slot * (int)sizeof(Value_t));
+}
+
+static const uint8_t add_rax[] = {0x49, 0x03, 0x44, 0x24};        // add rax, [r12 + disp8]
+static const uint8_t sub_rax[] = {0x49, 0x2B, 0x44, 0x24};        // sub rax, [r12 + disp8]
+static const uint8_t imul_rax[] = {0x49, 0x0F, 0xAF, 0x44, 0x24}; // imul rax, [r12 + disp8]
+
+// a push is the only write that can land on the guard page. vm->pc is set first so a stack
+// overflow in native code reports the instruction's line like the interpreter does
+static void save_pc(Assembler_t *as, uint8_t *next_pc) {
+    mov_rax_imm(as, (uint64_t)(uintptr_t)next_pc);
+    store_rax_vm(as, offsetof(vm_t, pc));
+}
+
+static void push_literal(Assembler_t *as, ValueType_t type, uint32_t data) {
+    emit_n(as, (uint8_t[]){0x41, 0xC7, 0x44, 0x24, (uint8_t)offsetof(Value_t, type)}, 5);
+    emit_32(as, type);
+    emit_n(as, (uint8_t[]){0x49, 0xC7, 0x44, 0x24, (uint8_t)offsetof(Value_t, data)}, 5);
+    emit_32(as, data);
+    bump_stack(as, 1);
+}
+
+static void push_constant(Assembler_t *as, Value_t *constant) {
+    mov_rax_imm(as, (uint64_t)(uintptr_t)constant);
+    emit_n(as, (uint8_t[]){0x0F, 0x10, 0x00}, 3);             // movups xmm0, [rax]
+    emit_n(as, (uint8_t[]){0x41, 0x0F, 0x11, 0x04, 0x24}, 5); // movups [r12], xmm0
+    bump_stack(as, 1);
+}
+
+static void push_top(Assembler_t *as) {
+    uint8_t disp = (uint8_t)(-(int)sizeof(Value_t));
+    emit_n(as, (uint8_t[]){0x41, 0x0F, 0x10, 0x44, 0x24, disp}, 6); // movups xmm0, [r12 - 16]
+    emit_n(as, (uint8_t[]){0x41, 0x0F, 0x11, 0x04, 0x24}, 5);       // movups [r12], xmm0
+    bump_stack(as, 1);
+}
+
+// helpers run with the same vm state the interpreter would have after decoding the instruction.
+// the helper's result is left in eax
+static void emit_helper_call(Assembler_t *as, int (*helper)(vm_t *, int), int operand,
+                             uint8_t *next_pc) {
+    store_r12_vm(as, offsetof(vm_t, stack_top));
+    mov_rax_imm(as, (uint64_t)(uintptr_t)next_pc);
+    store_rax_vm(as, offsetof(vm_t, pc));
+    emit_n(as, (uint8_t[]){0x48, 0x89, 0xDF}, 3); // mov rdi, rbx
+    emit(as, 0xBE);                               // mov esi, imm32
+    emit_32(as, operand);
+    mov_rax_imm(as, (uint64_t)(uintptr_t)helper);
+    emit_n(as, (uint8_t[]){0xFF, 0xD0}, 2); // call rax
+    load_r12_vm(as, offsetof(vm_t, stack_top));
+}
+
+static void call_helper(Assembler_t *as, int (*helper)(vm_t *, int), int operand,
+                        uint8_t *next_pc) {
+    emit_helper_call(as, helper, operand, next_pc);
+    emit_n(as, (uint8_t[]){0x85, 0xC0, 0x0F, 0x85}, 4); // test eax, eax ; jnz error
+    if (as->num_error_jumps + 1 > as->error_jump_capacity) {
+        as->error_jump_capacity = grow_capacity(as->error_jump_capacity);
+        as->error_jumps = resize(as->error_jumps, sizeof(int), as->error_jump_capacity);
+    }
+    as->error_jumps[as->num_error_jumps++] = as->count;
+    emit_32(as, 0);
+}
+
+// ------------------------ Helpers ------------------------ //
+// each returns non zero after reporting a runtime error
+
+static ObjectStr_t *global_name(vm_t *vm, int idx) {
+    return GET_STR_VAL(vm->chunk->constants.values[idx]);
+}
+
+static int helper_not(vm_t *vm, int unused) {
+    push(vm, DECL_BOOL_VAL(is_falsey(pop(vm))));
+    return 0;
+}
+
+static int helper_equal(vm_t *vm, int unused) {
+    Value_t b = pop(vm);
+    Value_t a = pop(vm);
+    push(vm, DECL_BOOL_VAL(equals(a, b)));
+    return 0;
+}
+
+static int helper_print(vm_t *vm, int unused) {
+    write_value(&vm->out, pop(vm));
+    end_line(&vm->out);
+    return 0;
+}
+
+static int helper_define_global(vm_t *vm, int idx) {
+    insert(&vm->globals, global_name(vm, idx), pop(vm));
+    return 0;
+}
+
+static int helper_get_global(vm_t *vm, int idx) {
+    Node_t *node = lookup_global(vm, idx);
+    if (node == NULL) {
+        throw_runtime_error(vm, "This variable has not been defined '%s'",
+                            global_name(vm, idx)->chars);
+        return 1;
+    }
+    push(vm, node->value);
+    return 0;
+}
+
+static int helper_set_global(vm_t *vm, int idx) {
+    Node_t *node = lookup_global(vm, idx);
+    if (node == NULL) {
+        throw_runtime_error(vm, "Undefined variable name '%s' LET's define it!",
+                            global_name(vm, idx)->chars);
+        return 1;
+    }
+    node->value = vm->stack_top[-1];
+    return 0;
+}
+
+// the callee runs to completion before the helper returns, natively if it's hot
+static int helper_call(vm_t *vm, int argc) {
+    return call_from_native(vm, argc) ? 0 : 1;
+}
+
+// returns the JitStatus_t the chunk exits with, see tail_call_from_native()
+static int helper_tail_call(vm_t *vm, int argc) {
+    return tail_call_from_native(vm, argc);
+}
+
+// ------------------------ Compilation ------------------------ //
+
+bool jit_supported() {
+    return sizeof(Value_t) == 16 && offsetof(Value_t, data) == 8;
+}
+
+// leaves with whatever status is in eax
+static void emit_epilogue(Assembler_t *as) {
+    emit_n(as, (uint8_t[]){0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3}, 6); // pop r13, r12, rbx ; ret
+}
+
+static void emit_exit(Assembler_t *as, JitStatus_t status) {
+    emit(as, 0xB8); // mov eax, imm32
+    emit_32(as, status);
+    emit_epilogue(as);
+}
+
+static void free_assembler(Assembler_t *as) {
+    free(as->bytes);
+    free(as->deopts);
+    free(as->error_jumps);
+    free(as->jumps);
+}
+
+// the templates trust operands and stack depth, so only verified chunks are compiled
+JitCode_t *jit_compile(Chunk_t *chunk) {
+    if (!jit_supported() || !chunk->verified) {
+        return NULL;
+    }
+    Assembler_t as = {0};
+
+    // push rbx, r12, r13 (keeps rsp 16 byte aligned for helper calls) ; mov rbx, rdi
+    emit_n(&as, (uint8_t[]){0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x89, 0xFB}, 8);
+    load_r12_vm(&as, offsetof(vm_t, stack_top));
+
+    int *native_offsets = ALLOCATE(int, chunk->count); // where each instruction's code starts
+    uint8_t *pc = chunk->code;
+    uint8_t *end = chunk->code + chunk->count;
+    while (pc < end) {
+        uint8_t *start = pc;
+        native_offsets[start - chunk->code] = as.count;
+        switch (*pc) {
+            case OP_CONSTANT: {
+                pc++;
+                int idx = read_operand(&pc);
+                save_pc(&as, pc);
+                push_constant(&as, &chunk->constants.values[idx]);
+                break;
+            }
+            case OP_NONE:
+                save_pc(&as, ++pc);
+                push_literal(&as, VAL_NONE, 0);
+                break;
+            case OP_TRUE:
+                save_pc(&as, ++pc);
+                push_literal(&as, VAL_BOOL, 1);
+                break;
+            case OP_FALSE:
+                save_pc(&as, ++pc);
+                push_literal(&as, VAL_BOOL, 0);
+                break;
+            case OP_ADD:
+            case OP_ADD_NUM:
+            case OP_ADD_STR: // strings deopt, the interpreter does the concatenation
+            case OP_ADD_ANY:
+                binary_num(&as, add_rax, sizeof(add_rax), 0x58, start);
+                pc++;
+                break;
+            case OP_SUB:
+                binary_num(&as, sub_rax, sizeof(sub_rax), 0x5C, start);
+                pc++;
+                break;
+            case OP_MUL:
+                binary_num(&as, imul_rax, sizeof(imul_rax), 0x59, start);
+                pc++;
+                break;
+            case OP_DIV:
+                divide_num(&as, start);
+                pc++;
+                break;
+            case OP_GREATER_THAN:
+                compare_num(&as, true, start);
+                pc++;
+                break;
+            case OP_LESS_THAN:
+                compare_num(&as, false, start);
+                pc++;
+                break;
+            case OP_NEGATE: {
+                cmp_type(&as, TYPE_AT(1), VAL_INT);
+                int not_int = jump_forward(&as, CC_NOT_EQUAL);
+                emit_n(&as, (uint8_t[]){0x49, 0xF7, 0x5C, 0x24, (uint8_t)DATA_AT(1)}, 5); // neg
+                deopt_if(&as, CC_OVERFLOW, start); // INT64_MIN, left unchanged by neg
+                int done = jump_forward(&as, 0);
+                patch_jump(&as, not_int, as.count);
+                guard_num(&as, TYPE_AT(1), start);
+                emit_n(&as, (uint8_t[]){0x49, 0x8B, 0x44, 0x24, (uint8_t)DATA_AT(1)}, 5);
+                emit_n(&as, (uint8_t[]){0x48, 0x0F, 0xBA, 0xF8, 0x3F}, 5); // btc rax, 63
+                emit_n(&as, (uint8_t[]){0x49, 0x89, 0x44, 0x24, (uint8_t)DATA_AT(1)}, 5);
+                patch_jump(&as, done, as.count);
+                pc++;
+                break;
+            }
+            case OP_POP:
+                bump_stack(&as, -1);
+                pc++;
+                break;
+            case OP_DUP:
+                save_pc(&as, ++pc);
+                push_top(&as);
+                break;
+            case OP_NOT:
+                call_helper(&as, helper_not, 0, ++pc);
+                break;
+            case OP_EQUAL:
+                call_helper(&as, helper_equal, 0, ++pc);
+                break;
+            case OP_PRINT:
+                call_helper(&as, helper_print, 0, ++pc);
+                break;
+            case OP_DEFINE_GLOBAL:
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL: {
+                pc++;
+                int idx = read_operand(&pc);
+                int (*helper)(vm_t *, int) = helper_set_global;
+                if (*start == OP_DEFINE_GLOBAL) {
+                    helper = helper_define_global;
+                } else if (*start == OP_GET_GLOBAL) {
+                    helper = helper_get_global;
+                }
+                call_helper(&as, helper, idx, pc);
+                break;
+            }
+            case OP_GET_SLOT: {
+                pc++;
+                int slot = read_operand(&pc);
+                save_pc(&as, pc);
+                slot_access(&as, 0x10, slot);                             // movups xmm0, slot
+                emit_n(&as, (uint8_t[]){0x41, 0x0F, 0x11, 0x04, 0x24}, 5); // movups [r12], xmm0
+                bump_stack(&as, 1);
+                break;
+            }
+            case OP_SET_SLOT: {
+                pc++;
+                uint8_t disp = (uint8_t)(-(int)sizeof(Value_t));
+                emit_n(&as, (uint8_t[]){0x41, 0x0F, 0x10, 0x44, 0x24, disp}, 6); // top into xmm0
+                slot_access(&as, 0x11, read_operand(&pc));                      // movups slot, xmm0
+                break;
+            }
+            case OP_JUMP:
+            case OP_LOOP: {
+                pc++;
+                int distance = read_jump(&pc);
+                int next = (int)(pc - chunk->code);
+                jump_to(&as, 0, *start == OP_JUMP ? next + distance : next - distance);
+                break;
+            }
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_JUMP_IF_FALSE_OR_POP:
+            case OP_JUMP_IF_TRUE_OR_POP: {
+                pc++;
+                int distance = read_jump(&pc);
+                bool on_truthy = *start == OP_JUMP_IF_TRUE || *start == OP_JUMP_IF_TRUE_OR_POP;
+                bool keep_value =
+                    *start == OP_JUMP_IF_FALSE_OR_POP || *start == OP_JUMP_IF_TRUE_OR_POP;
+                branch(&as, on_truthy, keep_value, (int)(pc - chunk->code) + distance);
+                break;
+            }
+            case OP_JUMP_IF_NOT_LESS:
+            case OP_JUMP_IF_NOT_GREATER:
+            case OP_JUMP_IF_LESS:
+            case OP_JUMP_IF_GREATER: {
+                pc++;
+                int distance = read_jump(&pc);
+                bool greater = *start == OP_JUMP_IF_NOT_GREATER || *start == OP_JUMP_IF_GREATER;
+                bool taken = *start == OP_JUMP_IF_LESS || *start == OP_JUMP_IF_GREATER;
+                compare_jump(&as, greater, taken, (int)(pc - chunk->code) + distance, start);
+                break;
+            }
+            case OP_CALL: {
+                pc++;
+                int argc = read_operand(&pc);
+                call_helper(&as, helper_call, argc, pc);
+                break;
+            }
+            case OP_TAIL_CALL: {
+                // the frame is done with either way: its result or the callee's frame is set up
+                pc++;
+                int argc = read_operand(&pc);
+                emit_helper_call(&as, helper_tail_call, argc, pc);
+                emit_epilogue(&as);
+                break;
+            }
+            case OP_RETURN:
+                pc++;
+                store_r12_vm(&as, offsetof(vm_t, stack_top));
+                mov_rax_imm(&as, (uint64_t)(uintptr_t)pc);
+                store_rax_vm(&as, offsetof(vm_t, pc));
+                emit_exit(&as, JIT_DONE);
+                break;
+            default:
+                // opcode we have no template for, leave the chunk to the interpreter
+                free(native_offsets);
+                free_assembler(&as);
+                return NULL;
+        }
+    }
+    // the verifier made sure every jump lands on an instruction
+    for (int i = 0; i < as.num_jumps; i++) {
+        patch_jump(&as, as.jumps[i].code_offset, native_offsets[as.jumps[i].target]);
+    }
+    free(native_offsets);
+
+    // out of line exits: each deopt stub hands its resume pc to the shared deopt tail
+    int error_exit = as.count;
+    emit_exit(&as, JIT_ERROR);
+    for (int i = 0; i < as.num_error_jumps; i++) {
+        patch_jump(&as, as.error_jumps[i], error_exit);
+    }
+
+    int *stub_jumps = ALLOCATE(int, as.num_deopts);
+    for (int i = 0; i < as.num_deopts; i++) {
+        patch_jump(&as, as.deopts[i].code_offset, as.count);
+        mov_rax_imm(&as, (uint64_t)(uintptr_t)as.deopts[i].resume_pc);
+        emit(&as, 0xE9); // jmp deopt tail
+        stub_jumps[i] = as.count;
+        emit_32(&as, 0);
+    }
+    int deopt_tail = as.count;
+    store_rax_vm(&as, offsetof(vm_t, pc));
+    store_r12_vm(&as, offsetof(vm_t, stack_top));
+    emit_exit(&as, JIT_DEOPT);
+    for (int i = 0; i < as.num_deopts; i++) {
+        patch_jump(&as, stub_jumps[i], deopt_tail);
+    }
+    free(stub_jumps);
+
+    // W^X: write the code while the pages are writable, then flip them to read + exec
+    void *memory = mmap(NULL, as.count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        free_assembler(&as);
+        return NULL;
+    }
+    memcpy(memory, as.bytes, as.count);
+    if (mprotect(memory, as.count, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, as.count);
+        free_assembler(&as);
+        return NULL;
+    }
+
+    JitCode_t *code = ALLOCATE(JitCode_t, 1);
+    code->memory = memory;
+    code->size = as.count;
+    code->entry = (JitStatus_t(*)(vm_t *))memory;
+    free_assembler(&as);
+    return code;
+}
+
+JitStatus_t jit_enter(vm_t *vm, JitCode_t *code) {
+    return code->entry(vm);
+}
+
+void jit_free(JitCode_t *code) {
+    if (code != NULL) {
+        munmap(code->memory, code->size);
+        free(code);
+    }
+}
+
+#else
+
+// no backend for this platform, everything stays in the interpreter
+bool jit_supported() {
+    return false;
+}
+
+JitCode_t *jit_compile(Chunk_t *chunk) {
+    return NULL;
+}
+
+JitStatus_t jit_enter(vm_t *vm, JitCode_t *code) {
+    return JIT_DEOPT;
+}
+
+void jit_free(JitCode_t *code) {
+}
+
+#endif
@@ -1,25 +1,196 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../includes/batch.h"
+#include "../includes/image.h"
+#include "../includes/natives.h"
 #include "../includes/vm.h"
 #include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    bool batch;
+    bool scale;
+    bool jit;
+    bool stats;
+    bool optimize;
+    bool profile;
+    bool trace;
+    bool print_code;
+    const char *profile_out; // collapsed stacks go here instead of the report
+    const char *image;       // heap image loaded before the script runs
+    const char *save_image;  // where the heap is saved once the script has run
+    FlushMode_t flush;       // when print output reaches stdout
+    int num_threads;
+    const char **paths;
+    int num_paths;
+} Options_t;
+
+void read_lines(vm_t *vm);
+int run_file(vm_t *vm, const char *path);
+int run_files(Options_t *options);
+char *read_file(const char *path);
+
+static void usage() {
+    fprintf(stderr, "Usage: main [-O] [--jit] [--stats] [--profile] [--profile-out file] [--trace]\n"
+                    "            [--print-code] [--flush line|size|exit] [--image file]\n"
+                    "            [--save-image file] [path]\n"
+                    "       main --batch [-O] [--jit] [--threads n] [--scale] path...\n");
+    exit(64);
+}
+
+static FlushMode_t parse_flush_mode(const char *mode) {
+    if (strcmp(mode, "line") == 0) {
+        return FLUSH_LINE;
+    } else if (strcmp(mode, "size") == 0) {
+        return FLUSH_SIZE;
+    } else if (strcmp(mode, "exit") == 0) {
+        return FLUSH_EXIT;
+    }
+    usage();
+    return FLUSH_SIZE;
+}
 
-void read_lines();
-void run_file(const char *path);
+static void parse_options(int argc, const char *argv[], Options_t *options) {
+    options->batch = false;
+    options->scale = false;
+    options->jit = false;
+    options->stats = false;
+    options->optimize = false;
+    options->profile = false;
+    options->profile_out = NULL;
+    options->image = NULL;
+    options->save_image = NULL;
+    options->trace = false;
+    options->print_code = false;
+    options->flush = isatty(fileno(stdout)) ? FLUSH_LINE : FLUSH_SIZE;
+    options->num_threads = default_thread_count();
+    options->paths = ALLOCATE(const char *, argc);
+    options->num_paths = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0) {
+            options->batch = true;
+        } else if (strcmp(argv[i], "--scale") == 0) {
+            options->scale = true;
+        } else if (strcmp(argv[i], "-O") == 0) {
+            options->optimize = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options->stats = true;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            options->trace = true;
+        } else if (strcmp(argv[i], "--print-code") == 0) {
+            options->print_code = true;
+        } else if (strcmp(argv[i], "--flush") == 0 && i + 1 < argc) {
+            options->flush = parse_flush_mode(argv[++i]);
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            options->profile = true;
+        } else if (strcmp(argv[i], "--profile-out") == 0 && i + 1 < argc) {
+            options->profile = true;
+            options->profile_out = argv[++i];
+        } else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+            options->image = argv[++i];
+        } else if (strcmp(argv[i], "--save-image") == 0 && i + 1 < argc) {
+            options->save_image = argv[++i];
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            if (!jit_supported()) {
+                fprintf(stderr, "--jit is only available on x86-64 linux\n");
+                exit(64);
+            }
+            options->jit = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options->num_threads = atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            usage();
+        } else {
+            options->paths[options->num_paths++] = argv[i];
+        }
+    }
+}
+
+// the rest of the flags report on or load into one vm, a batch runs many of them at once
+static void check_batch_options(Options_t *options) {
+    if (options->stats || options->profile || options->trace || options->print_code ||
+        options->image != NULL || options->save_image != NULL) {
+        fprintf(stderr, "--batch only takes -O, --jit, --threads and --scale\n");
+        usage();
+    }
+}
+
+static void report_profile(Profile_t *profile, Options_t *options) {
+    if (options->profile_out == NULL) {
+        dump_profile(profile, stderr);
+        return;
+    }
+    FILE *fp = fopen(options->profile_out, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: can't write profile to \"%s\"\n", options->profile_out);
+        return;
+    }
+    write_collapsed_profile(profile, options->num_paths == 0 ? "repl" : options->paths[0], fp);
+    fclose(fp);
+}
 
 int main(int argc, const char *argv[]) {
-    init_vm();
-    if (argc == 1) {
-        read_lines();
-    } else if (argc == 2) {
-        run_file(argv[1]);
+    Options_t options;
+    parse_options(argc, argv, &options);
+
+    int status = 0;
+    if (options.batch) {
+        check_batch_options(&options);
+        status = run_files(&options);
+    } else if (options.num_paths <= 1) {
+        vm_t vm;
+        init_vm(&vm);
+        define_natives(&vm);
+        vm.use_jit = options.jit;
+        vm.optimize = options.optimize;
+        vm.time_phases = options.stats;
+        set_output(&vm, stdout, options.flush);
+        Profile_t profile;
+        if (options.profile) {
+            init_profile(&profile);
+            vm.profile = &profile;
+        }
+        // traces and listings go to stderr so they never mix into the script's own output
+        Writer_t diagnostics;
+        if (options.trace || options.print_code) {
+            init_writer(&diagnostics, stderr, FLUSH_SIZE);
+            vm.trace = options.trace ? &diagnostics : NULL;
+            vm.listing = options.print_code ? &diagnostics : NULL;
+        }
+        if (options.image != NULL && !load_image(&vm, options.image)) {
+            status = 74;
+        } else if (options.num_paths == 0) {
+            read_lines(&vm);
+        } else {
+            status = run_file(&vm, options.paths[0]);
+        }
+        // a prelude's image, taken once it ran cleanly
+        if (status == 0 && options.save_image != NULL && !save_image(&vm, options.save_image)) {
+            status = 74;
+        }
+        if (options.stats) {
+            dump_stats(&vm, stderr);
+        }
+        if (options.profile) {
+            report_profile(&profile, &options);
+            free_profile(&profile);
+        }
+        if (options.trace || options.print_code) {
+            free_writer(&diagnostics);
+        }
+        free_vm(&vm);
     } else {
         fprintf(stderr, "Error: no path specified\n");
-        exit(64);
+        usage();
     }
 
-    free_vm();
-    return 0;
+    free(options.paths);
+    return status;
 }
 
-void run_file(const char *path) {
+char *read_file(const char *path) {
     FILE *fp = fopen(path, "r");
     if (!fp) {
         fprintf(stderr, "Error: invalid path \"%s\"\n", path);
@@ -33,28 +204,94 @@ void run_file(const char *path) {
     char *code = (char *)(malloc(size + 1));
     if (!code) {
         fprintf(stderr, "Error: not enough memory available to read file \"%s\"\n", path);
+        exit(74);
     }
 
-    int end = fread(code, sizeof(char), size, fp);
+    size_t end = fread(code, sizeof(char), size, fp);
     if (end < size) {
         fprintf(stderr, "Error: unsuccessful file read \"%s\"\n", path);
     }
     code[end] = '\0';
 
     fclose(fp);
+    return code;
+}
 
-    InterpretResult_t result = interpret(code);
+// returns the exit status for the script
+int run_file(vm_t *vm, const char *path) {
+    char *code = read_file(path);
+
+    InterpretResult_t result = interpret(vm, code);
+    free(code);
+    code = NULL;
     if (result == INTERPRET_COMPILE_ERROR) {
-        exit(65);
+        return 65;
     }
     if (result == INTERPRET_RUNTIME_ERROR) {
-        exit(70);
+        return 70;
     }
-    free(code);
-    code = NULL;
+    return 0;
+}
+
+static double elapsed_seconds(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// --scale: rerun the whole batch with 1..n threads and report throughput instead of output
+static void report_scaling(const char **sources, int count, int max_threads, BatchFlags_t flags) {
+    fprintf(stderr, "threads,seconds,scripts_per_sec,speedup\n");
+    double base = 0;
+    for (int threads = 1; threads <= max_threads; threads++) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        BatchResult_t *results = run_batch(sources, count, threads, flags);
+        double seconds = elapsed_seconds(start);
+        free_batch_results(results, count);
+
+        if (threads == 1) {
+            base = seconds;
+        }
+        fprintf(stderr, "%d,%.6f,%.1f,%.2f\n", threads, seconds, count / seconds, base / seconds);
+    }
+}
+
+// --batch: every path is an independent script, output is replayed in the order given
+int run_files(Options_t *options) {
+    int count = options->num_paths;
+    const char **sources = ALLOCATE(const char *, count);
+    for (int i = 0; i < count; i++) {
+        sources[i] = read_file(options->paths[i]);
+    }
+
+    BatchFlags_t flags = {.optimize = options->optimize, .use_jit = options->jit};
+    int status = 0;
+    if (options->scale) {
+        report_scaling(sources, count, options->num_threads, flags);
+    } else {
+        BatchResult_t *results = run_batch(sources, count, options->num_threads, flags);
+        for (int i = 0; i < count; i++) {
+            fwrite(results[i].out, sizeof(char), results[i].out_length, stdout);
+            fwrite(results[i].err, sizeof(char), results[i].err_length, stderr);
+            // report the first failure the same way a single run would
+            if (status == 0 && results[i].result == INTERPRET_COMPILE_ERROR) {
+                status = 65;
+            } else if (status == 0 && results[i].result == INTERPRET_RUNTIME_ERROR) {
+                status = 70;
+            }
+        }
+        free_batch_results(results, count);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free((char *)sources[i]);
+    }
+    free(sources);
+    return status;
 }
 
-void read_lines() {
+void read_lines(vm_t *vm) {
     char line[1024];
     while (true) {
         printf("> ");
@@ -62,6 +299,7 @@ void read_lines() {
             printf("\n");
             break;
         }
-        interpret(line);
+        interpret(vm, line);
+        flush_writer(&vm->out); // before the next prompt
     }
 }
@@ -28,11 +28,21 @@ static void free_object(Object_t *object) {
             free(str);
             break;
         }
+        case OBJ_FUNC: {
+            ObjectFunc_t *function = (ObjectFunc_t *)object;
+            free_chunk(&function->chunk);
+            jit_free(function->jit_code);
+            free(function);
+            break;
+        }
+        case OBJ_NATIVE:
+            free(object);
+            break;
     }
 }
 
-void free_objects() {
-    Object_t *cur = vm.objects;
+void free_object_list(Object_t *head) {
+    Object_t *cur = head;
     while (cur != NULL) {
         Object_t *next = cur->next;
         free_object(cur);
@@ -40,3 +50,19 @@ void free_objects() {
     }
     cur = NULL;
 }
+
+void free_objects(vm_t *vm) {
+    free_object_list(vm->objects);
+    vm->objects = NULL;
+}
+
+// frees what was allocated after mark (vm->objects at the time), mark and older objects stay
+void free_objects_since(vm_t *vm, Object_t *mark) {
+    Object_t **link = &vm->objects;
+    while (*link != mark) {
+        link = &(*link)->next;
+    }
+    *link = NULL;
+    free_object_list(vm->objects);
+    vm->objects = mark;
+}
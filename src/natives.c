@@ -0,0 +1,206 @@
+#include "../includes/natives.h"
+#include "../includes/hash_table.h"
+
+#include <math.h>
+#include <time.h>
+
+// natives are checked for their argument count before they run, only the types are left to them.
+// errors point at the line of the call like an instruction's do
+
+static bool expect_number(vm_t *vm, const char *name, Value_t value) {
+    if (!IS_NUMBER_VAL(value)) {
+        throw_runtime_error(vm, "%s() expects a number", name);
+        return false;
+    }
+    return true;
+}
+
+static bool expect_int(vm_t *vm, const char *name, Value_t value) {
+    if (!IS_INT_VAL(value)) {
+        throw_runtime_error(vm, "%s() expects an integer", name);
+        return false;
+    }
+    return true;
+}
+
+static bool expect_str(vm_t *vm, const char *name, Value_t value) {
+    if (!IS_STR(value)) {
+        throw_runtime_error(vm, "%s() expects a string", name);
+        return false;
+    }
+    return true;
+}
+
+// ------------------------ Math ------------------------ //
+
+// rounded results are ints while they fit in one
+static Value_t whole_number(double value) {
+    if (value >= -9223372036854775808.0 && value < 9223372036854775808.0) {
+        return DECL_INT_VAL((int64_t)value);
+    }
+    return DECL_NUM_VAL(value);
+}
+
+static bool native_sqrt(vm_t *vm, int argc, Value_t *args, Value_t *result) {
+    if (!expect_number(vm, "sqrt", args[0])) {
+        return false;
+    }
+    *result = DECL_NUM_VAL(sqrt(GET_NUMBER_VAL(args[0])));
+    return true;
+}
+
+static bool native_pow(vm_t *vm, int argc, Value_t *args, Value_t *result) {
+    if (!expect_number(vm, "pow", args[0]) || !expect_number(vm, "pow", args[1])) {
+        return false;
+    }
+    *result = DECL_NUM_VAL(pow(GET_NUMBER_VAL(args[0]), GET_NUMBER_VAL(args[1])));
+    return true;
+}
+
+static bool native_abs(vm_t *vm, int argc, Value_t *args, Value_t *result) {
+    if (!expect_number(vm, "abs", args[0])) {
+        return false;
+    }
+    if (IS_INT_VAL(args[0])) {
+        // negate_number() takes care of the one int without a positive counterpart
+        *result = GET_INT_VAL(args[0]) < 0 ? negate_number(args[0]) : args[0];
+    } else {
+        *result = DECL_NUM_VAL(fabs(GET_NUM_VAL(args[0])));
+    }
+    return true;
+}
+
+static bool native_floor(vm_t *vm, int argc, Value_t *args, Value_t *result) {
+    if (!expect_number(vm, "floor", args[0])) {
+        return false;
+    }
+    *result = IS_INT_VAL(args[0]) ? args[0] : whole_number(floor(GET_NUM_VAL(args[0])));
+    return true;
+}
+
+static bool native_ceil(vm_t *vm, int argc, Value_t *args, Value_t *result) {
+    if (!expect_number(vm, "ceil", args[0])) {
+        return false;
+    }
+    *result = IS_INT_VAL(args[0]) ? args[0] : whole_number(ceil(GET_NUM_VAL(args[0])));
+    return true;
+}
+
+// the smallest (or largest) of any number of numbers, as it was passed in
+static bool pick_number(vm_t *vm, const char *name, int argc, Value_t *args, Value_t *result,
+                        bool largest) {
+    if (argc == 0) {
+        throw_runtime_error(vm, "%s() expects at least one argument", name);
+        return false;
+    }
+    Value_t best = args[0];
+    for (int i = 0; i < argc; i++) {
+        if (!expect_number(vm, name, args[i])) {
+            return false;
+        }
+        if (largest ? less_than(best, args[i]) : less_than(args[i], best)) {
+            best = args[i];
+        }
+    }
+    *result = best;
+    return true;
+}
+
+static bool native_min(vm_t *vm, int argc, Value_t *args, Value_t *result) {
+    return pick_number(vm, "min", argc, args, result, false);
+}
+
+static bool native_max(vm_t *vm, int argc, Value_t *args, Value_t *result) {
+    return pick_number(vm, "max", argc, args, result, true);
+}
+
+// ------------------------ Strings ------------------------ //
+
+static bool native_len(vm_t *vm, int argc, Value_t *args, Value_t *result) {
+    if (!expect_str(vm, "len", args[0])) {
+        return false;
+    }
+    *result = DECL_INT_VAL(GET_STR_VAL(args[0])->length);
+    return true;
+}
+
+// substr(s, start, count), clamped to the string
+static bool native_substr(vm_t *vm, int argc, Value_t *args, Value_t *result) {
+    if (!expect_str(vm, "substr", args[0]) || !expect_int(vm, "substr", args[1]) ||
+        !expect_int(vm, "substr", args[2])) {
+        return false;
+    }
+    ObjectStr_t *str = GET_STR_VAL(args[0]);
+    int64_t start = GET_INT_VAL(args[1]);
+    int64_t count = GET_INT_VAL(args[2]);
+    start = start < 0 ? 0 : (start > str->length ? str->length : start);
+    count = count < 0 ? 0 : (count > str->length - start ? str->length - start : count);
+    *result = DECL_OBJ_VAL(allocate_runtime_str(vm, str->chars + start, (int)count));
+    return true;
+}
+
+// find(s, part): where part first starts in s, -1 if it doesn't
+static bool native_find(vm_t *vm, int argc, Value_t *args, Value_t *result) {
+    if (!expect_str(vm, "find", args[0]) || !expect_str(vm, "find", args[1])) {
+        return false;
+    }
+    ObjectStr_t *str = GET_STR_VAL(args[0]);
+    ObjectStr_t *part = GET_STR_VAL(args[1]);
+    *result = DECL_INT_VAL(-1);
+    for (int i = 0; i + part->length <= str->length; i++) {
+        if (memcmp(str->chars + i, part->chars, part->length) == 0) {
+            *result = DECL_INT_VAL(i);
+            break;
+        }
+    }
+    return true;
+}
+
+// ------------------------ Globals ------------------------ //
+
+// undefine(name): removes the global called name, false if there was none. globals are keyed by
+// the identifier's interned string, which a string built at runtime isn't always, so look that up
+static bool native_undefine(vm_t *vm, int argc, Value_t *args, Value_t *result) {
+    if (!expect_str(vm, "undefine", args[0])) {
+        return false;
+    }
+    ObjectStr_t *str = GET_STR_VAL(args[0]);
+    ObjectStr_t *name = allocate_str(vm, str->chars, str->length);
+    *result = DECL_BOOL_VAL(drop(&vm->globals, name));
+    return true;
+}
+
+// ------------------------ Time ------------------------ //
+
+// seconds of processor time, for timing scripts from inside
+static bool native_clock(vm_t *vm, int argc, Value_t *args, Value_t *result) {
+    *result = DECL_NUM_VAL((double)clock() / CLOCKS_PER_SEC);
+    return true;
+}
+
+// ===================================================================================================
+
+void define_native(vm_t *vm, const char *name, int arity, NativeFn_t function) {
+    ObjectStr_t *global_name = allocate_str(vm, name, (int)strlen(name));
+    ObjectNative_t *native = allocate_native(vm, global_name, arity, function);
+    insert(&vm->globals, global_name, DECL_OBJ_VAL(native));
+}
+
+typedef struct {
+    const char *name;
+    int arity;
+    NativeFn_t function;
+} NativeDef_t;
+
+static const NativeDef_t natives[] = {
+    {"sqrt", 1, native_sqrt},   {"pow", 2, native_pow},      {"abs", 1, native_abs},
+    {"floor", 1, native_floor}, {"ceil", 1, native_ceil},    {"min", -1, native_min},
+    {"max", -1, native_max},    {"len", 1, native_len},      {"substr", 3, native_substr},
+    {"find", 2, native_find},   {"clock", 0, native_clock},  {"undefine", 1, native_undefine},
+};
+
+void define_natives(vm_t *vm) {
+    for (int i = 0; i < (int)(sizeof(natives) / sizeof(NativeDef_t)); i++) {
+        define_native(vm, natives[i].name, natives[i].arity, natives[i].function);
+    }
+}
@@ -1,12 +1,13 @@
 #include "../includes/object.h"
+#include "../includes/intern.h"
 #include "../includes/value.h"
 #include "../includes/vm.h"
 
-static Object_t *allocate_object(size_t size, ObjectType_t type) {
+static Object_t *allocate_object(vm_t *vm, size_t size, ObjectType_t type) {
     Object_t *new_object = (Object_t *)(malloc(size));
     new_object->type = type;
-    new_object->next = vm.objects;
-    vm.objects = new_object;
+    new_object->next = vm->objects;
+    vm->objects = new_object;
     return new_object;
 }
 
@@ -19,23 +20,81 @@ static uint32_t hash_string(const char *key, int length) {
     return hash;
 }
 
-ObjectStr_t *allocate_str(const char *chars, int length) {
-    uint32_t hash = hash_string(chars, length);
-    // string object already exists in memory check
-    ObjectStr_t *interned = find_str(&vm.strings, chars, length, hash);
+static void fill_str(ObjectStr_t *str, const char *chars, int length, uint32_t hash) {
+    str->length = length;
+    memcpy(str->chars, chars, length);
+    str->chars[length] = '\0';
+    str->hash = hash;
+}
+
+// string not linked into any vm's object list; whoever creates it is responsible for freeing it
+ObjectStr_t *allocate_unowned_str(const char *chars, int length, uint32_t hash) {
+    ObjectStr_t *new_str = (ObjectStr_t *)malloc(sizeof(ObjectStr_t) + sizeof(char) * (length + 1));
+    new_str->object.type = OBJ_STR;
+    new_str->object.next = NULL;
+    fill_str(new_str, chars, length, hash);
+    return new_str;
+}
+
+static ObjectStr_t *allocate_local_str(vm_t *vm, const char *chars, int length, uint32_t hash) {
+    ObjectStr_t *new_str = (ObjectStr_t *)allocate_object(
+        vm, sizeof(ObjectStr_t) + sizeof(char) * (length + 1), OBJ_STR);
+    fill_str(new_str, chars, length, hash);
+    insert(&vm->strings, new_str, DECL_NONE_VAL);
+    return new_str;
+}
+
+static ObjectStr_t *count_lookup(vm_t *vm, ObjectStr_t *interned) {
     if (interned != NULL) {
-        return interned;
+        vm->stats.intern_hits++;
+    } else {
+        vm->stats.intern_misses++;
     }
+    return interned;
+}
 
-    ObjectStr_t *new_str =
-        (ObjectStr_t *)allocate_object(sizeof(ObjectStr_t) + sizeof(char) * (length + 1), OBJ_STR);
-    new_str->length = length;
-    memcpy(new_str->chars, chars, length);
-    new_str->chars[length] = '\0';
+// for literals and identifiers the compilers see. with a shared table they always come from it, so
+// an identifier is the same object in every vm using the table (globals are keyed by pointer)
+ObjectStr_t *allocate_str(vm_t *vm, const char *chars, int length) {
+    uint32_t hash = hash_string(chars, length);
+    if (vm->shared_strings != NULL) {
+        ObjectStr_t *interned =
+            count_lookup(vm, find_shared_str(vm->shared_strings, chars, length, hash));
+        return interned != NULL ? interned
+                                : intern_str(vm->shared_strings, chars, length, hash);
+    }
+    ObjectStr_t *interned = count_lookup(vm, find_str(&vm->strings, chars, length, hash));
+    return interned != NULL ? interned : allocate_local_str(vm, chars, length, hash);
+}
 
-    new_str->hash = hash_string(chars, length);
+// for strings made while running (concatenation, substr). they stay on the vm's own heap even with
+// a shared table, so the table only ever holds literals and doesn't fill up with scratch strings
+ObjectStr_t *allocate_runtime_str(vm_t *vm, const char *chars, int length) {
+    uint32_t hash = hash_string(chars, length);
+    ObjectStr_t *interned = find_str(&vm->strings, chars, length, hash);
+    if (interned == NULL && vm->shared_strings != NULL) {
+        interned = find_shared_str(vm->shared_strings, chars, length, hash);
+    }
+    interned = count_lookup(vm, interned);
+    return interned != NULL ? interned : allocate_local_str(vm, chars, length, hash);
+}
 
-    insert(&vm.strings, new_str, DECL_NONE_VAL);
+// the chunk starts out empty, the compiler writes the body into it
+ObjectFunc_t *allocate_func(vm_t *vm, ObjectStr_t *name) {
+    ObjectFunc_t *function =
+        (ObjectFunc_t *)allocate_object(vm, sizeof(ObjectFunc_t), OBJ_FUNC);
+    function->name = name;
+    init_chunk(&function->chunk);
+    function->calls = 0;
+    function->jit_code = NULL;
+    return function;
+}
 
-    return new_str;
+ObjectNative_t *allocate_native(vm_t *vm, ObjectStr_t *name, int arity, NativeFn_t function) {
+    ObjectNative_t *native =
+        (ObjectNative_t *)allocate_object(vm, sizeof(ObjectNative_t), OBJ_NATIVE);
+    native->name = name;
+    native->arity = arity;
+    native->function = function;
+    return native;
 }
@@ -0,0 +1,539 @@
+#include "../includes/optimizer.h"
+#include "../includes/hash_table.h"
+#include "../includes/memory.h"
+
+// -O pipeline: parse to an ast, run every pass in passes[] over it in order, lower it to bytecode,
+// then hand the chunk to the bytecode pass in peephole.c.
+// a pass may only make changes that can't be observed: same output, same runtime errors on the
+// same lines, same globals left behind (they outlive the chunk in the repl and for programs)
+
+#define DSE_WINDOW 64     // statements looked ahead for an overwriting store
+#define CSE_MAX_TEMPS 16  // temp slots a single statement may reserve
+
+typedef void (*AstPass_t)(Ast_t *ast);
+
+// ------------------------ Queries ------------------------ //
+
+static bool same_number(double a, double b) {
+    return memcmp(&a, &b, sizeof(double)) == 0; // 0 vs -0 and nan payloads matter
+}
+
+static bool same_tree(AstNode_t *a, AstNode_t *b) {
+    if (a->kind != b->kind) {
+        return false;
+    }
+    switch (a->kind) {
+        case AST_CONSTANT:
+            if (IS_NUM_VAL(a->value) && IS_NUM_VAL(b->value)) {
+                return same_number(GET_NUM_VAL(a->value), GET_NUM_VAL(b->value));
+            }
+            return a->value.type == b->value.type && equals(a->value, b->value);
+        case AST_GET_GLOBAL:
+            return a->name == b->name;
+        case AST_GET_TEMP:
+            return a->slot == b->slot;
+        case AST_UNARY:
+            return a->op == b->op && same_tree(a->left, b->left);
+        case AST_BINARY:
+            return a->op == b->op && same_tree(a->left, b->left) && same_tree(a->right, b->right);
+        default:
+            return false; // stores are never merged
+    }
+}
+
+static bool reads_global(AstNode_t *node, ObjectStr_t *name) {
+    if (node == NULL) {
+        return false;
+    } else if (node->kind == AST_GET_GLOBAL && node->name == name) {
+        return true;
+    }
+    return reads_global(node->left, name) || reads_global(node->right, name);
+}
+
+static bool stores_global(AstNode_t *node, ObjectStr_t *name) {
+    if (node == NULL) {
+        return false;
+    } else if (node->kind == AST_SET_GLOBAL && node->name == name) {
+        return true;
+    }
+    return stores_global(node->left, name) || stores_global(node->right, name);
+}
+
+// true when the node evaluates to a number whenever it evaluates without an error
+static bool known_number(AstNode_t *node) {
+    switch (node->kind) {
+        case AST_CONSTANT:
+            return IS_NUMBER_VAL(node->value);
+        case AST_UNARY:
+            return node->op == OP_NEGATE;
+        case AST_BINARY:
+            if (node->op == OP_ADD) {
+                return known_number(node->left) && known_number(node->right);
+            }
+            return node->op == OP_SUB || node->op == OP_MUL || node->op == OP_DIV;
+        case AST_SET_TEMP:
+            return known_number(node->left);
+        default:
+            return false;
+    }
+}
+
+// true when the node evaluates to a double (never an int) whenever it evaluates without an error
+static bool known_double(AstNode_t *node) {
+    switch (node->kind) {
+        case AST_CONSTANT:
+            return IS_NUM_VAL(node->value);
+        case AST_UNARY:
+            return node->op == OP_NEGATE && known_double(node->left);
+        case AST_BINARY:
+            // a double on either side makes the whole op a double
+            return (node->op == OP_ADD || node->op == OP_SUB || node->op == OP_MUL ||
+                    node->op == OP_DIV) &&
+                   (known_double(node->left) || known_double(node->right));
+        case AST_SET_TEMP:
+            return known_double(node->left);
+        default:
+            return false;
+    }
+}
+
+// globals a let earlier in the chunk has defined, so reading them can't fail
+typedef struct {
+    HashTable_t *defined;  // lets before the statement being optimized
+    AstStmt_t *lets;       // statements after it up to the one looked at, their lets count too
+    int num_lets;
+} Defined_t;
+
+static bool is_defined(Defined_t *defined, ObjectStr_t *name) {
+    if (get(defined->defined, name) != NULL) {
+        return true;
+    }
+    for (int i = 0; i < defined->num_lets; i++) {
+        if (defined->lets[i].kind == STMT_LET && defined->lets[i].name == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// conservative: anything that might raise a runtime error (or store a global) counts
+static bool can_fail(AstNode_t *node, Defined_t *defined) {
+    switch (node->kind) {
+        case AST_CONSTANT:
+            return false;
+        case AST_GET_GLOBAL:
+            return !is_defined(defined, node->name);
+        case AST_UNARY:
+            if (node->op == OP_NEGATE && !known_number(node->left)) {
+                return true;
+            }
+            return can_fail(node->left, defined);
+        case AST_BINARY:
+            if (node->op != OP_EQUAL && !(known_number(node->left) && known_number(node->right))) {
+                return true;
+            }
+            return can_fail(node->left, defined) || can_fail(node->right, defined);
+        default:
+            return true;
+    }
+}
+
+static void make_constant(AstNode_t *node, Value_t value) {
+    node->kind = AST_CONSTANT;
+    node->value = value;
+    node->left = NULL;
+    node->right = NULL;
+}
+
+// an int identity: x * 1 keeps x's type, x * 1.0 would turn an int x into a double
+static bool is_int_constant(AstNode_t *node, int64_t num) {
+    return node->kind == AST_CONSTANT && IS_INT_VAL(node->value) && GET_INT_VAL(node->value) == num;
+}
+
+// ------------------------ Constant folding ------------------------ //
+// only folds what can't fail at runtime, mismatched operands are left for the vm to report
+
+static void fold(Ast_t *ast, AstNode_t *node) {
+    if (node->left != NULL) {
+        fold(ast, node->left);
+    }
+    if (node->right != NULL) {
+        fold(ast, node->right);
+    }
+
+    if (node->kind == AST_UNARY && node->left->kind == AST_CONSTANT) {
+        Value_t value = node->left->value;
+        if (node->op == OP_NOT) {
+            make_constant(node, DECL_BOOL_VAL(is_falsey(value)));
+        } else if (IS_NUMBER_VAL(value)) {
+            make_constant(node, negate_number(value));
+        }
+        return;
+    }
+    if (node->kind != AST_BINARY || node->left->kind != AST_CONSTANT ||
+        node->right->kind != AST_CONSTANT) {
+        return;
+    }
+
+    Value_t a = node->left->value;
+    Value_t b = node->right->value;
+    if (node->op == OP_EQUAL) {
+        make_constant(node, DECL_BOOL_VAL(equals(a, b)));
+    } else if (IS_NUMBER_VAL(a) && IS_NUMBER_VAL(b)) {
+        switch (node->op) {
+            case OP_ADD:
+                make_constant(node, add_numbers(a, b));
+                break;
+            case OP_SUB:
+                make_constant(node, sub_numbers(a, b));
+                break;
+            case OP_MUL:
+                make_constant(node, mul_numbers(a, b));
+                break;
+            case OP_DIV:
+                make_constant(node, div_numbers(a, b));
+                break;
+            case OP_GREATER_THAN:
+                make_constant(node, DECL_BOOL_VAL(less_than(b, a)));
+                break;
+            case OP_LESS_THAN:
+                make_constant(node, DECL_BOOL_VAL(less_than(a, b)));
+                break;
+            default:
+                break;
+        }
+    } else if (node->op == OP_ADD && IS_STR(a) && IS_STR(b)) {
+        ObjectStr_t *left = GET_STR_VAL(a);
+        ObjectStr_t *right = GET_STR_VAL(b);
+        char *chars = ALLOCATE(char, left->length + right->length + 1);
+        memcpy(chars, left->chars, left->length);
+        memcpy(chars + left->length, right->chars, right->length);
+        ObjectStr_t *str = allocate_str(ast->vm, chars, left->length + right->length);
+        free(chars);
+        make_constant(node, DECL_OBJ_VAL(str));
+    }
+}
+
+static void fold_constants(Ast_t *ast) {
+    for (int i = 0; i < ast->count; i++) {
+        fold(ast, ast->stmts[i].expr);
+    }
+}
+
+// ------------------------ Strength reduction ------------------------ //
+
+// 1 / num when num is a power of two whose reciprocal is also a normal double, so x / num and
+// x * (1 / num) round identically
+static bool exact_reciprocal(double num, double *reciprocal) {
+    uint64_t bits;
+    memcpy(&bits, &num, sizeof(double));
+    int exponent = (int)((bits >> 52) & 0x7FF);
+    bool power_of_two = (bits & 0xFFFFFFFFFFFFFull) == 0 && exponent != 0 && exponent != 0x7FF;
+    if (!power_of_two || exponent - 1023 < -1022 || exponent - 1023 > 1022) {
+        return false;
+    }
+    *reciprocal = 1.0 / num;
+    return true;
+}
+
+static void reduce(AstNode_t *node) {
+    if (node->left != NULL) {
+        reduce(node->left);
+    }
+    if (node->right != NULL) {
+        reduce(node->right);
+    }
+
+    double reciprocal;
+    if (node->kind == AST_UNARY && node->op == OP_NEGATE && node->left->kind == AST_UNARY &&
+        node->left->op == OP_NEGATE && known_double(node->left->left)) {
+        *node = *node->left->left; // --x (not for ints, negating INT64_MIN gives a double)
+    } else if (node->kind != AST_BINARY) {
+        return;
+    } else if (node->op == OP_DIV && node->right->kind == AST_CONSTANT &&
+               IS_NUM_VAL(node->right->value) &&
+               exact_reciprocal(GET_NUM_VAL(node->right->value), &reciprocal)) {
+        node->op = OP_MUL; // x / 4 -> x * 0.25, same type errors as the divide
+        node->right->value = DECL_NUM_VAL(reciprocal);
+    } else if ((node->op == OP_MUL || node->op == OP_DIV) && is_int_constant(node->right, 1) &&
+               known_number(node->left)) {
+        *node = *node->left; // x * 1, x / 1
+    } else if (node->op == OP_MUL && is_int_constant(node->left, 1) && known_number(node->right)) {
+        *node = *node->right; // 1 * x
+    } else if (node->op == OP_SUB && is_int_constant(node->right, 0) &&
+               known_number(node->left)) {
+        *node = *node->left; // x - 0 (not x + 0, that turns -0 into 0)
+    }
+}
+
+static void reduce_strength(Ast_t *ast) {
+    for (int i = 0; i < ast->count; i++) {
+        reduce(ast->stmts[i].expr);
+    }
+}
+
+// ------------------------ Dead store elimination ------------------------ //
+// a store to a global is dead when a later statement stores it again before anything reads it.
+// everything in between (and the later value) has to be unable to fail, otherwise a runtime error
+// could stop the chunk with the first value still visible, e.g. to the next repl line
+
+static bool stored_global(AstStmt_t *stmt, ObjectStr_t **name, AstNode_t **value) {
+    if (stmt->kind == STMT_LET) {
+        *name = stmt->name;
+        *value = stmt->expr;
+        return true;
+    } else if (stmt->kind == STMT_EXPR && stmt->expr->kind == AST_SET_GLOBAL) {
+        *name = stmt->expr->name;
+        *value = stmt->expr->left;
+        return true;
+    }
+    return false;
+}
+
+// idx of the statement that overwrites the store at idx, -1 if the store may be observed
+static int overwriting_store(Ast_t *ast, int idx, HashTable_t *defined_before) {
+    ObjectStr_t *name;
+    AstNode_t *value;
+    stored_global(&ast->stmts[idx], &name, &value);
+
+    Defined_t defined = {.defined = defined_before, .lets = &ast->stmts[idx + 1], .num_lets = 0};
+    // a plain assignment to a global nothing has defined yet is a runtime error, keep it
+    if (ast->stmts[idx].kind == STMT_EXPR && !is_defined(&defined, name)) {
+        return -1;
+    }
+    if (can_fail(value, &defined)) {
+        return -1;
+    }
+
+    int end = idx + 1 + DSE_WINDOW < ast->count ? idx + 1 + DSE_WINDOW : ast->count;
+    for (int i = idx + 1; i < end; i++) {
+        AstStmt_t *stmt = &ast->stmts[i];
+        ObjectStr_t *next_name;
+        AstNode_t *next_value;
+        if (reads_global(stmt->expr, name) || can_fail(stmt->expr, &defined)) {
+            // a store to another global fails can_fail() too, but the overwrite we want doesn't
+            if (!stored_global(stmt, &next_name, &next_value) || next_name != name ||
+                reads_global(next_value, name) || can_fail(next_value, &defined)) {
+                return -1;
+            }
+            return i;
+        }
+        if (stored_global(stmt, &next_name, &next_value) && next_name == name) {
+            return i;
+        }
+        if (stores_global(stmt->expr, name)) {
+            return -1;
+        }
+        defined.num_lets++;
+    }
+    return -1;
+}
+
+static void remove_stmt(Ast_t *ast, int idx) {
+    memmove(&ast->stmts[idx], &ast->stmts[idx + 1], sizeof(AstStmt_t) * (ast->count - idx - 1));
+    ast->count--;
+}
+
+static void eliminate_dead_stores(Ast_t *ast) {
+    HashTable_t defined;
+    init_hash_table(&defined);
+    int i = 0;
+    while (i < ast->count) {
+        ObjectStr_t *name;
+        AstNode_t *value;
+        if (stored_global(&ast->stmts[i], &name, &value)) {
+            int later = overwriting_store(ast, i, &defined);
+            if (later >= 0) {
+                AstStmt_t *overwrite = &ast->stmts[later];
+                // the dead store was a let: the overwriting assignment now has to define the name
+                if (ast->stmts[i].kind == STMT_LET && overwrite->kind == STMT_EXPR) {
+                    overwrite->kind = STMT_LET;
+                    overwrite->name = name;
+                    overwrite->expr = overwrite->expr->left;
+                }
+                remove_stmt(ast, i);
+                continue;
+            }
+        }
+        if (ast->stmts[i].kind == STMT_LET) {
+            insert(&defined, ast->stmts[i].name, DECL_BOOL_VAL(true));
+        }
+        i++;
+    }
+    free_hash_table(&defined);
+}
+
+// ------------------------ Common subexpressions ------------------------ //
+// a pure expression that shows up more than once in a statement is computed where it first runs,
+// copied into a temp slot, and every later use reads the slot. the first use runs exactly where
+// it always did, so errors stay put; later uses can't see different globals because expressions
+// reading a global the statement assigns are never shared
+
+typedef struct {
+    AstNode_t *node;
+    uint32_t hash;
+    int size;
+    int order; // post order position, i.e. when it runs
+} Candidate_t;
+
+typedef struct {
+    Candidate_t *candidates;
+    int count;
+    int capacity;
+    int order;
+    ObjectStr_t **assigned; // globals the statement stores
+    int num_assigned;
+} CseScan_t;
+
+static uint32_t mix(uint32_t hash, uint64_t value) {
+    hash ^= (uint32_t)value ^ (uint32_t)(value >> 32);
+    return hash * 16777619u;
+}
+
+// returns whether the subtree can be shared (no stores, no assigned globals, no temps set)
+static bool scan(CseScan_t *cse, AstNode_t *node, uint32_t *hash, int *size) {
+    uint32_t left_hash = 0;
+    uint32_t right_hash = 0;
+    int left_size = 0;
+    int right_size = 0;
+    bool shareable = node->kind != AST_SET_GLOBAL && node->kind != AST_SET_TEMP;
+    if (node->left != NULL) {
+        shareable &= scan(cse, node->left, &left_hash, &left_size);
+    }
+    if (node->right != NULL) {
+        shareable &= scan(cse, node->right, &right_hash, &right_size);
+    }
+    if (node->kind == AST_GET_GLOBAL) {
+        for (int i = 0; i < cse->num_assigned; i++) {
+            shareable &= cse->assigned[i] != node->name;
+        }
+    }
+
+    uint64_t bits = 0;
+    if (node->kind == AST_CONSTANT) {
+        memcpy(&bits, &node->value.data, sizeof(bits));
+    }
+    *hash = mix(mix(mix(mix(2166136261u, node->kind), node->op), (uintptr_t)node->name), bits);
+    *hash = mix(mix(mix(*hash, node->slot), left_hash), right_hash);
+    *size = 1 + left_size + right_size;
+
+    int order = cse->order++;
+    if (shareable && (node->kind == AST_UNARY || node->kind == AST_BINARY)) {
+        if (cse->count + 1 > cse->capacity) {
+            cse->capacity = grow_capacity(cse->capacity);
+            cse->candidates = resize(cse->candidates, sizeof(Candidate_t), cse->capacity);
+        }
+        cse->candidates[cse->count++] =
+            (Candidate_t){.node = node, .hash = *hash, .size = *size, .order = order};
+    }
+    return shareable;
+}
+
+static void find_assigned(CseScan_t *cse, AstNode_t *node) {
+    if (node == NULL) {
+        return;
+    }
+    if (node->kind == AST_SET_GLOBAL) {
+        cse->assigned = resize(cse->assigned, sizeof(ObjectStr_t *), cse->num_assigned + 1);
+        cse->assigned[cse->num_assigned++] = node->name;
+    }
+    find_assigned(cse, node->left);
+    find_assigned(cse, node->right);
+}
+
+// biggest first, equal trees next to each other, then in the order they run
+static int compare_candidates(const void *a, const void *b) {
+    const Candidate_t *x = (const Candidate_t *)a;
+    const Candidate_t *y = (const Candidate_t *)b;
+    if (x->size != y->size) {
+        return y->size - x->size;
+    } else if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return x->order - y->order;
+}
+
+// shares the biggest repeated subexpression of the statement, false if there's nothing worth it
+static bool share_one(Ast_t *ast, AstStmt_t *stmt, CseScan_t *cse) {
+    cse->count = 0;
+    cse->order = 0;
+    uint32_t hash;
+    int size;
+    scan(cse, stmt->expr, &hash, &size);
+    if (cse->count < 2) {
+        return false;
+    }
+    qsort(cse->candidates, cse->count, sizeof(Candidate_t), compare_candidates);
+
+    for (int first = 0; first < cse->count; first++) {
+        Candidate_t *candidate = &cse->candidates[first];
+        int uses = 1;
+        for (int i = first + 1; i < cse->count && cse->candidates[i].hash == candidate->hash &&
+                                cse->candidates[i].size == candidate->size;
+             i++) {
+            uses += same_tree(candidate->node, cse->candidates[i].node);
+        }
+        // worth it once the saved instructions beat the set, the slot reads and the slot itself
+        if (uses < 2 || (candidate->size - 1) * (uses - 1) <= 3) {
+            continue;
+        }
+
+        int slot = stmt->num_temps++;
+        AstNode_t *original = candidate->node;
+        for (int i = first + 1; i < cse->count && cse->candidates[i].hash == candidate->hash &&
+                                cse->candidates[i].size == candidate->size;
+             i++) {
+            AstNode_t *use = cse->candidates[i].node;
+            if (same_tree(original, use)) {
+                *use = (AstNode_t){
+                    .kind = AST_GET_TEMP, .line = use->line, .slot = slot, .value = DECL_NONE_VAL};
+            }
+        }
+        AstNode_t *computed = new_node(ast, original->kind, original->line);
+        *computed = *original;
+        *original = (AstNode_t){.kind = AST_SET_TEMP,
+                                .line = original->line,
+                                .slot = slot,
+                                .left = computed,
+                                .value = DECL_NONE_VAL};
+        return true;
+    }
+    return false;
+}
+
+static void eliminate_common_subexpressions(Ast_t *ast) {
+    CseScan_t cse = {0};
+    for (int i = 0; i < ast->count; i++) {
+        AstStmt_t *stmt = &ast->stmts[i];
+        cse.num_assigned = 0;
+        find_assigned(&cse, stmt->expr);
+        while (stmt->num_temps < CSE_MAX_TEMPS && share_one(ast, stmt, &cse)) {
+        }
+    }
+    free(cse.candidates);
+    free(cse.assigned);
+}
+
+// ------------------------ Pipeline ------------------------ //
+
+static const AstPass_t passes[] = {
+    fold_constants,
+    reduce_strength,
+    eliminate_dead_stores,
+    eliminate_common_subexpressions,
+};
+
+// false (and chunk untouched) if the ast parser can't handle the code
+bool compile_optimized(vm_t *vm, const char *code, Chunk_t *chunk, bool tail_result) {
+    Ast_t ast;
+    if (!parse_ast(vm, code, tail_result, &ast)) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(passes) / sizeof(passes[0]); i++) {
+        passes[i](&ast);
+    }
+    generate_code(&ast, chunk);
+    optimize_chunk(chunk);
+    free_ast(&ast);
+    return true;
+}
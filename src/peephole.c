@@ -0,0 +1,752 @@
+#include "../includes/hash_table.h"
+#include "../includes/memory.h"
+#include "../includes/optimizer.h"
+
+// bytecode pass over every chunk compiled with -O, whichever compiler wrote it. chunks are decoded
+// into a list of instructions, rewritten, and encoded again. straight-line chunks get:
+//  - a global read after a store in the same chunk reuses the stored value instead of probing
+//  - a store to a global that's overwritten before anything reads it goes away, unless something
+//    in between could fail (the first value would then outlive the chunk, e.g. in the repl)
+//  - values that are computed only to be popped aren't computed, when that can't fail
+// chunks with jumps get compare + branch pairs fused where the compiler couldn't, and loop
+// invariant globals read once before their loop. a chunk with any opcode analyze() doesn't know
+// is left as it was
+
+#define STORE_WINDOW 256 // instructions searched for the store that overwrites an earlier one
+#define MAX_HOISTED 32   // stack slots one loop may keep hoisted globals in
+
+typedef enum {
+    KIND_ANY,
+    KIND_NUM, // int or double
+    KIND_STR,
+    KIND_OTHER, // none, bool
+} ValueKind_t;
+
+typedef struct {
+    OpCode_t op;
+    int operand; // jumps: their target as an instruction idx, see decode()
+    int line;
+    int name;         // global ops: which global (each name gets one id), -1 otherwise
+    bool may_fail;    // could raise a runtime error, set by analyze()
+    bool was_defined; // global ops: an earlier instruction in the chunk already defined the name
+    bool dup_before;  // OP_DUP goes right before this instruction
+    bool removed;
+} Insn_t;
+
+typedef struct {
+    int count;
+    int capacity;
+    Insn_t *insns;
+} InsnArray_t;
+
+static void append(InsnArray_t *array, Insn_t insn) {
+    if (array->count + 1 > array->capacity) {
+        array->capacity = grow_capacity(array->capacity);
+        array->insns = resize(array->insns, sizeof(Insn_t), array->capacity);
+    }
+    array->insns[array->count++] = insn;
+}
+
+static bool is_global_op(OpCode_t op) {
+    return op == OP_DEFINE_GLOBAL || op == OP_GET_GLOBAL || op == OP_SET_GLOBAL;
+}
+
+static bool is_literal(OpCode_t op) {
+    return op == OP_CONSTANT || op == OP_NONE || op == OP_TRUE || op == OP_FALSE;
+}
+
+// ------------------------ Decoding ------------------------ //
+
+static bool is_jump(OpCode_t op) {
+    return op_info[op].jump != 0;
+}
+
+// jump distances become target instruction idxs, so passes can move code around freely
+static void decode(Chunk_t *chunk, InsnArray_t *code) {
+    int *insn_at = ALLOCATE(int, chunk->count + 1); // instruction idx of every offset it starts at
+    int run = 0;
+    int run_end = chunk->line_runs.line_runs[0].count;
+    for (int offset = 0; offset < chunk->count;) {
+        while (offset >= run_end) {
+            run_end += chunk->line_runs.line_runs[++run].count;
+        }
+        uint8_t *pc = &chunk->code[offset];
+        Insn_t insn = {.op = (OpCode_t)*pc++, .line = chunk->line_runs.line_runs[run].line};
+        if (is_jump(insn.op)) {
+            insn.operand = jump_target(chunk, offset);
+            pc += OPERAND_MAX_BYTES;
+        } else if (op_info[insn.op].has_operand) {
+            insn.operand = read_operand(&pc);
+        }
+        insn_at[offset] = code->count;
+        append(code, insn);
+        offset = (int)(pc - chunk->code);
+    }
+    for (int i = 0; i < code->count; i++) {
+        if (is_jump(code->insns[i].op)) {
+            code->insns[i].operand = insn_at[code->insns[i].operand];
+        }
+    }
+    free(insn_at);
+}
+
+// gives every global the chunk touches a small id, returns how many there are
+static int number_globals(Chunk_t *chunk, InsnArray_t *code) {
+    HashTable_t ids;
+    init_hash_table(&ids);
+    int count = 0;
+    for (int i = 0; i < code->count; i++) {
+        Insn_t *insn = &code->insns[i];
+        insn->name = -1;
+        if (!is_global_op(insn->op)) {
+            continue;
+        }
+        ObjectStr_t *name = GET_STR_VAL(chunk->constants.values[insn->operand]);
+        Value_t *id = get(&ids, name);
+        if (id == NULL) {
+            insert(&ids, name, DECL_NUM_VAL(count));
+            insn->name = count++;
+        } else {
+            insn->name = (int)GET_NUM_VAL(*id);
+        }
+    }
+    free_hash_table(&ids);
+    return count;
+}
+
+static void encode(Chunk_t *chunk, InsnArray_t *code) {
+    chunk->count = 0;
+    free_line_array(&chunk->line_runs);
+    int *offsets = ALLOCATE(int, code->count); // where every instruction starts, jumps need them
+    int *jump_at = ALLOCATE(int, code->count); // where a jump's distance goes
+    for (int i = 0; i < code->count; i++) {
+        Insn_t *insn = &code->insns[i];
+        offsets[i] = chunk->count;
+        if (is_jump(insn->op)) {
+            jump_at[i] = write_jump(chunk, insn->op, insn->line);
+        } else {
+            write_chunk(chunk, insn->op, insn->line);
+            if (op_info[insn->op].has_operand) {
+                write_operand(chunk, insn->operand, insn->line);
+            }
+        }
+    }
+    for (int i = 0; i < code->count; i++) {
+        if (is_jump(code->insns[i].op)) {
+            int distance = offsets[code->insns[i].operand] - (jump_at[i] + OPERAND_MAX_BYTES);
+            patch_jump_operand(chunk, jump_at[i], op_info[code->insns[i].op].jump * distance);
+        }
+    }
+    free(offsets);
+    free(jump_at);
+    chunk->max_stack = max_stack_depth(chunk);
+}
+
+// ------------------------ Analysis ------------------------ //
+
+static ValueKind_t kind_of(Value_t value) {
+    if (IS_NUMBER_VAL(value)) {
+        return KIND_NUM;
+    }
+    return IS_STR(value) ? KIND_STR : KIND_OTHER;
+}
+
+// walks the code with the kind of every stack slot and global, marking what could fail at runtime.
+// false if the chunk has an instruction this pass doesn't handle
+static bool analyze(Chunk_t *chunk, InsnArray_t *code, int num_names) {
+    // a function's arguments could be anything, then at most one push per instruction
+    int depth = chunk->arity > 0 ? chunk->arity : 0;
+    ValueKind_t *stack = ALLOCATE(ValueKind_t, depth + code->count + 1);
+    for (int i = 0; i < depth; i++) {
+        stack[i] = KIND_ANY;
+    }
+    ValueKind_t *global_kinds = calloc(num_names + 1, sizeof(ValueKind_t));
+    bool *defined = calloc(num_names + 1, sizeof(bool));
+    bool ok = true;
+    for (int i = 0; ok && i < code->count; i++) {
+        Insn_t *insn = &code->insns[i];
+        ValueKind_t a = depth >= 2 ? stack[depth - 2] : KIND_ANY;
+        ValueKind_t b = depth >= 1 ? stack[depth - 1] : KIND_ANY;
+        ValueKind_t result = KIND_ANY;
+        insn->may_fail = false;
+        switch (insn->op) {
+            case OP_CONSTANT:
+                result = kind_of(chunk->constants.values[insn->operand]);
+                break;
+            case OP_NONE:
+            case OP_TRUE:
+            case OP_FALSE:
+            case OP_NOT:
+            case OP_EQUAL:
+                result = KIND_OTHER;
+                break;
+            case OP_NEGATE:
+                insn->may_fail = b != KIND_NUM;
+                result = KIND_NUM;
+                break;
+            case OP_ADD:
+            case OP_ADD_NUM:
+            case OP_ADD_STR:
+            case OP_ADD_ANY:
+                insn->may_fail = a != b || (a != KIND_NUM && a != KIND_STR);
+                result = a == b ? a : KIND_ANY;
+                break;
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+                insn->may_fail = a != KIND_NUM || b != KIND_NUM;
+                result = KIND_NUM;
+                break;
+            case OP_GREATER_THAN:
+            case OP_LESS_THAN:
+                insn->may_fail = a != KIND_NUM || b != KIND_NUM;
+                result = KIND_OTHER;
+                break;
+            case OP_PRINT:
+            case OP_POP:
+            case OP_RETURN:
+                break;
+            case OP_DUP:
+                result = b;
+                break;
+            case OP_GET_SLOT:
+                result = insn->operand < depth ? stack[insn->operand] : KIND_ANY;
+                break;
+            case OP_SET_SLOT:
+                if (insn->operand < depth) {
+                    stack[insn->operand] = b;
+                }
+                result = b;
+                break;
+            case OP_DEFINE_GLOBAL:
+                insn->was_defined = defined[insn->name];
+                defined[insn->name] = true;
+                global_kinds[insn->name] = b;
+                break;
+            case OP_GET_GLOBAL:
+                // a name defined before the chunk ran reads fine but could hold anything
+                insn->was_defined = defined[insn->name];
+                insn->may_fail = !insn->was_defined;
+                result = global_kinds[insn->name];
+                defined[insn->name] = true;
+                break;
+            case OP_SET_GLOBAL:
+                insn->was_defined = defined[insn->name];
+                insn->may_fail = !insn->was_defined;
+                defined[insn->name] = true;
+                global_kinds[insn->name] = b;
+                result = b;
+                break;
+            default:
+                ok = false; // jumps, calls, ... the walk above would be wrong for them
+                break;
+        }
+        depth -= op_info[insn->op].pops;
+        for (int pushed = 0; pushed < op_info[insn->op].pushes; pushed++) {
+            stack[depth++] = result;
+        }
+    }
+    free(stack);
+    free(global_kinds);
+    free(defined);
+    return ok;
+}
+
+// ------------------------ Load forwarding ------------------------ //
+
+// rewrites reads of a global the chunk has just stored:
+//  - stored a literal: push the literal again
+//  - x = ...; x  (OP_SET_GLOBAL, OP_POP, OP_GET_GLOBAL): keep the value instead of popping it
+//  - let x = ...; x  (OP_DEFINE_GLOBAL, OP_GET_GLOBAL): OP_DUP the value before defining it
+static void forward_loads(InsnArray_t *code, int num_names, InsnArray_t *out) {
+    Insn_t *stored = ALLOCATE(Insn_t, num_names + 1);
+    bool *known = calloc(num_names + 1, sizeof(bool));
+    for (int i = 0; i < code->count; i++) {
+        Insn_t insn = code->insns[i];
+        Insn_t *prev = out->count >= 1 ? &out->insns[out->count - 1] : NULL;
+        Insn_t *before_prev = out->count >= 2 ? &out->insns[out->count - 2] : NULL;
+
+        if (insn.op == OP_GET_GLOBAL && known[insn.name]) {
+            Insn_t literal = stored[insn.name];
+            literal.line = insn.line;
+            append(out, literal);
+        } else if (insn.op == OP_GET_GLOBAL && before_prev != NULL && prev->op == OP_POP &&
+                   before_prev->op == OP_SET_GLOBAL && before_prev->name == insn.name) {
+            out->count--;
+        } else if (insn.op == OP_GET_GLOBAL && prev != NULL && prev->op == OP_DEFINE_GLOBAL &&
+                   prev->name == insn.name) {
+            Insn_t define = *prev;
+            *prev = (Insn_t){.op = OP_DUP, .line = define.line, .name = -1};
+            append(out, define);
+        } else {
+            if (insn.op == OP_DEFINE_GLOBAL || insn.op == OP_SET_GLOBAL) {
+                known[insn.name] = prev != NULL && is_literal(prev->op);
+                if (known[insn.name]) {
+                    stored[insn.name] = *prev;
+                }
+            }
+            append(out, insn);
+        }
+    }
+    free(stored);
+    free(known);
+}
+
+// ------------------------ Dead stores ------------------------ //
+
+static Insn_t *next_live(InsnArray_t *code, int idx) {
+    for (int i = idx + 1; i < code->count; i++) {
+        if (!code->insns[i].removed) {
+            return &code->insns[i];
+        }
+    }
+    return NULL;
+}
+
+static void eliminate_dead_stores(InsnArray_t *code) {
+    for (int i = 0; i < code->count; i++) {
+        Insn_t *store = &code->insns[i];
+        // an assignment to a global that isn't defined yet is a runtime error, it has to stay
+        bool is_store = store->op == OP_DEFINE_GLOBAL ||
+                        (store->op == OP_SET_GLOBAL && store->was_defined);
+        if (store->removed || !is_store) {
+            continue;
+        }
+
+        int end = i + 1 + STORE_WINDOW < code->count ? i + 1 + STORE_WINDOW : code->count;
+        int j = i + 1;
+        while (j < end && (code->insns[j].removed ||
+                           (code->insns[j].name != store->name && !code->insns[j].may_fail))) {
+            j++;
+        }
+        if (j == end) {
+            continue;
+        }
+        Insn_t *overwrite = &code->insns[j];
+        if (overwrite->name != store->name || overwrite->op == OP_GET_GLOBAL) {
+            continue;
+        }
+
+        bool was_defined = store->was_defined;
+        if (store->op == OP_SET_GLOBAL || store->dup_before) {
+            store->removed = true; // the value stays on the stack either way
+        } else {
+            *store = (Insn_t){.op = OP_POP, .line = store->line, .name = -1};
+        }
+        if (overwrite->op == OP_SET_GLOBAL && !was_defined) {
+            // the dead store was what defined the global, now the overwrite has to
+            overwrite->op = OP_DEFINE_GLOBAL;
+            Insn_t *after = next_live(code, j);
+            if (after != NULL && after->op == OP_POP) {
+                after->removed = true;
+            } else {
+                overwrite->dup_before = true;
+            }
+        }
+        overwrite->was_defined = was_defined;
+    }
+}
+
+// ------------------------ Unused values ------------------------ //
+
+// pushes exactly one value and has no effect besides that
+static bool is_pure(Insn_t *insn) {
+    switch (insn->op) {
+        case OP_CONSTANT:
+        case OP_NONE:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_ADD:
+        case OP_ADD_NUM:
+        case OP_ADD_STR:
+        case OP_ADD_ANY:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_EQUAL:
+        case OP_GREATER_THAN:
+        case OP_LESS_THAN:
+        case OP_GET_GLOBAL:
+        case OP_GET_SLOT:
+            return !insn->may_fail;
+        default:
+            return false;
+    }
+}
+
+// the last instruction in out pushed the value being popped: drop both if that's safe, and pop
+// its operands instead
+static void pop_value(InsnArray_t *out, Insn_t pop) {
+    Insn_t *top = out->count > 0 ? &out->insns[out->count - 1] : NULL;
+    if (top != NULL && top->op == OP_DUP) {
+        out->count--;
+    } else if (top != NULL && is_pure(top)) {
+        int pops = op_info[top->op].pops;
+        out->count--;
+        for (int i = 0; i < pops; i++) {
+            pop_value(out, pop);
+        }
+    } else {
+        append(out, pop);
+    }
+}
+
+static void drop_unused_values(InsnArray_t *code, InsnArray_t *out) {
+    for (int i = 0; i < code->count; i++) {
+        Insn_t insn = code->insns[i];
+        if (insn.removed) {
+            continue;
+        }
+        if (insn.dup_before) {
+            append(out, (Insn_t){.op = OP_DUP, .line = insn.line, .name = -1});
+        }
+        if (insn.op == OP_POP) {
+            pop_value(out, insn);
+        } else {
+            append(out, insn);
+        }
+    }
+}
+
+// ------------------------ Loop invariant loads ------------------------ //
+// a global a loop reads but never stores is read once before the loop into a stack slot and the
+// loop reads the slot instead. only for globals that are defined on every path to the loop (a
+// define, store or read of them that no jump skips comes first), since reading those can't fail
+// and so reading them early changes nothing. the slots sit below everything the loop pushes and
+// are popped where it exits. only outermost loops are hoisted out of, that covers the loops nested
+// in them too
+
+typedef struct {
+    int head; // the instruction OP_LOOP jumps back to
+    int end;  // the OP_LOOP, the loop exits to end + 1
+    int base; // stack depth at head, the first slot used
+    int num_hoisted;
+    int names[MAX_HOISTED];
+    int operands[MAX_HOISTED]; // constant idx of each name
+} Loop_t;
+
+// stack depth before every instruction, -1 where it can't be reached. a function's starts at its
+// arguments
+static int *insn_depths(InsnArray_t *code, int entry_depth) {
+    int *depths = ALLOCATE(int, code->count);
+    int *pending = ALLOCATE(int, code->count);
+    for (int i = 0; i < code->count; i++) {
+        depths[i] = -1;
+    }
+    int num_pending = 0;
+    depths[0] = entry_depth;
+    pending[num_pending++] = 0;
+    while (num_pending > 0) {
+        int i = pending[--num_pending];
+        Insn_t *insn = &code->insns[i];
+        int depth = depths[i] - op_pops(insn->op, insn->operand) + op_info[insn->op].pushes;
+        int targets[2] = {ends_block(insn->op) ? -1 : i + 1,
+                          is_jump(insn->op) ? insn->operand : -1};
+        int target_depths[2] = {depth, jump_depth(insn->op, depths[i])};
+        for (int j = 0; j < 2; j++) {
+            if (targets[j] >= 0 && targets[j] < code->count && depths[targets[j]] < 0) {
+                depths[targets[j]] = target_depths[j];
+                pending[num_pending++] = targets[j];
+            }
+        }
+    }
+    free(pending);
+    return depths;
+}
+
+// instructions some forward jump can skip
+static bool *skippable_insns(InsnArray_t *code) {
+    int *spans = calloc(code->count + 1, sizeof(int));
+    for (int i = 0; i < code->count; i++) {
+        Insn_t *insn = &code->insns[i];
+        if (is_jump(insn->op) && insn->operand > i + 1) {
+            spans[i + 1]++;
+            spans[insn->operand]--;
+        }
+    }
+    bool *skippable = ALLOCATE(bool, code->count);
+    int open = 0;
+    for (int i = 0; i < code->count; i++) {
+        open += spans[i];
+        skippable[i] = open > 0;
+    }
+    free(spans);
+    return skippable;
+}
+
+static bool inside(Loop_t *loop, int idx) {
+    return idx >= loop->head && idx <= loop->end;
+}
+
+// picks what loop can hoist. false if it isn't a plain loop: entered anywhere but its head, left
+// anywhere but end + 1, or the stack depth differs there. or if it calls a function, which could
+// store to any global
+static bool plan_loop(InsnArray_t *code, int num_names, Loop_t *loop, int *depths, bool *defined) {
+    loop->base = depths[loop->head];
+    if (loop->base < 0 || loop->end + 1 >= code->count || depths[loop->end + 1] != loop->base) {
+        return false;
+    }
+    for (int i = 0; i < code->count; i++) {
+        Insn_t *insn = &code->insns[i];
+        if (inside(loop, i) && (insn->op == OP_CALL || insn->op == OP_TAIL_CALL ||
+                                insn->op == OP_RETURN)) {
+            return false;
+        } else if (!is_jump(insn->op)) {
+            continue;
+        }
+        int target = insn->operand;
+        if (inside(loop, i) ? !inside(loop, target) && target != loop->end + 1
+                            : target > loop->head && target <= loop->end) {
+            return false;
+        }
+    }
+
+    bool *stored = calloc(num_names + 1, sizeof(bool));
+    bool *taken = calloc(num_names + 1, sizeof(bool));
+    for (int i = loop->head; i <= loop->end; i++) {
+        Insn_t *insn = &code->insns[i];
+        if (insn->op == OP_DEFINE_GLOBAL || insn->op == OP_SET_GLOBAL) {
+            stored[insn->name] = true;
+        }
+    }
+    loop->num_hoisted = 0;
+    for (int i = loop->head; i <= loop->end && loop->num_hoisted < MAX_HOISTED; i++) {
+        Insn_t *insn = &code->insns[i];
+        if (insn->op == OP_GET_GLOBAL && defined[insn->name] && !stored[insn->name] &&
+            !taken[insn->name]) {
+            taken[insn->name] = true;
+            loop->names[loop->num_hoisted] = insn->name;
+            loop->operands[loop->num_hoisted++] = insn->operand;
+        }
+    }
+    free(stored);
+    free(taken);
+    return loop->num_hoisted > 0;
+}
+
+// the outermost loops worth hoisting out of, in code order
+static int find_loops(InsnArray_t *code, int num_names, int entry_depth, Loop_t **loops) {
+    int *depths = insn_depths(code, entry_depth);
+    bool *skippable = skippable_insns(code);
+    bool *defined = calloc(num_names + 1, sizeof(bool));
+    int *ends = ALLOCATE(int, code->count); // the last OP_LOOP back to every instruction
+    for (int i = 0; i < code->count; i++) {
+        ends[i] = -1;
+    }
+    for (int i = 0; i < code->count; i++) {
+        if (code->insns[i].op == OP_LOOP) {
+            ends[code->insns[i].operand] = i;
+        }
+    }
+
+    int num_loops = 0;
+    int capacity = 0;
+    *loops = NULL;
+    int scanned = 0; // instructions before this have been looked at for definitions
+    for (int head = 0; head < code->count; head++) {
+        if (ends[head] < 0) {
+            continue;
+        }
+        for (; scanned < head; scanned++) {
+            Insn_t *insn = &code->insns[scanned];
+            if (insn->op == OP_CALL || insn->op == OP_TAIL_CALL) {
+                // the callee can undefine() any global, only definitions after it count
+                memset(defined, 0, sizeof(bool) * (num_names + 1));
+            } else if (insn->name >= 0 && depths[scanned] >= 0 && !skippable[scanned]) {
+                defined[insn->name] = true;
+            }
+        }
+        // a for loop's body comes after its increment and loops back into it, the loop runs to
+        // the last back edge into anything between head and end
+        int end = ends[head];
+        for (int i = head + 1; i <= end; i++) {
+            end = ends[i] > end ? ends[i] : end;
+        }
+        Loop_t loop = {.head = head, .end = end};
+        if (plan_loop(code, num_names, &loop, depths, defined)) {
+            if (num_loops + 1 > capacity) {
+                capacity = grow_capacity(capacity);
+                *loops = resize(*loops, sizeof(Loop_t), capacity);
+            }
+            (*loops)[num_loops++] = loop;
+        }
+        head = end; // loops nested in this one are covered by it
+    }
+    free(depths);
+    free(skippable);
+    free(defined);
+    free(ends);
+    return num_loops;
+}
+
+// where a jump at idx to target lands once the loops have their loads and pops: jumps out of a
+// loop go through its pops, jumps into one from outside through its loads
+static int remap_target(Loop_t *loops, int num_loops, int *new_idx, int *preheaders, int *exits,
+                        int idx, int target) {
+    for (int i = 0; i < num_loops; i++) {
+        if (inside(&loops[i], idx) && target == loops[i].end + 1) {
+            return exits[i];
+        }
+    }
+    for (int i = 0; i < num_loops; i++) {
+        if (!inside(&loops[i], idx) && target == loops[i].head) {
+            return preheaders[i];
+        }
+    }
+    return new_idx[target];
+}
+
+static void hoist_invariant_loads(InsnArray_t *code, int num_names, int entry_depth,
+                                  InsnArray_t *out) {
+    Loop_t *loops;
+    int num_loops = find_loops(code, num_names, entry_depth, &loops);
+
+    // where everything goes first, jumps forward need it
+    int *new_idx = ALLOCATE(int, code->count);
+    int *preheaders = ALLOCATE(int, num_loops + 1);
+    int *exits = ALLOCATE(int, num_loops + 1);
+    for (int i = 0, cur = 0, count = 0; i < code->count; i++) {
+        if (cur < num_loops && i == loops[cur].head) {
+            preheaders[cur] = count;
+            count += loops[cur].num_hoisted;
+        }
+        new_idx[i] = count++;
+        if (cur < num_loops && i == loops[cur].end) {
+            exits[cur] = count;
+            count += loops[cur++].num_hoisted;
+        }
+    }
+
+    for (int i = 0, cur = 0; i < code->count; i++) {
+        Insn_t insn = code->insns[i];
+        Loop_t *loop = cur < num_loops && inside(&loops[cur], i) ? &loops[cur] : NULL;
+        if (is_jump(insn.op)) {
+            insn.operand =
+                remap_target(loops, num_loops, new_idx, preheaders, exits, i, insn.operand);
+        }
+        if (loop != NULL && i == loop->head) {
+            for (int j = 0; j < loop->num_hoisted; j++) {
+                append(out, (Insn_t){.op = OP_GET_GLOBAL, .operand = loop->operands[j],
+                                     .line = insn.line, .name = loop->names[j]});
+            }
+        }
+        if (loop != NULL && (insn.op == OP_GET_SLOT || insn.op == OP_SET_SLOT) &&
+            insn.operand >= loop->base) {
+            insn.operand += loop->num_hoisted; // the hoisted slots went in below
+        }
+        for (int j = 0; loop != NULL && j < loop->num_hoisted && insn.op == OP_GET_GLOBAL; j++) {
+            if (insn.name == loop->names[j]) {
+                insn = (Insn_t){.op = OP_GET_SLOT, .operand = loop->base + j, .line = insn.line,
+                                .name = -1};
+            }
+        }
+        append(out, insn);
+        if (loop != NULL && i == loop->end) {
+            for (int j = 0; j < loop->num_hoisted; j++) {
+                append(out, (Insn_t){.op = OP_POP, .line = insn.line, .name = -1});
+            }
+            cur++;
+        }
+    }
+    free(loops);
+    free(new_idx);
+    free(preheaders);
+    free(exits);
+}
+
+// ------------------------ Branch fusion ------------------------ //
+
+// the compiler only fuses a compare into the jump after it when that jump is the last thing it
+// wrote, e.g. not the left operand of an `and` that became a plain branch. any compare (+ NOT)
+// + OP_JUMP_IF_FALSE that nothing jumps into the middle of becomes one instruction here
+static void fuse_branches(InsnArray_t *code, InsnArray_t *out) {
+    bool *targeted = calloc(code->count + 1, sizeof(bool));
+    for (int i = 0; i < code->count; i++) {
+        if (is_jump(code->insns[i].op)) {
+            targeted[code->insns[i].operand] = true;
+        }
+    }
+    for (int i = 0; i + 1 < code->count; i++) {
+        Insn_t *compare = &code->insns[i];
+        if (compare->op != OP_LESS_THAN && compare->op != OP_GREATER_THAN) {
+            continue;
+        }
+        bool negated = code->insns[i + 1].op == OP_NOT && !targeted[i + 1];
+        int j = i + 1 + negated;
+        if (j >= code->count || code->insns[j].op != OP_JUMP_IF_FALSE || targeted[j]) {
+            continue;
+        }
+        Insn_t *jump = &code->insns[j];
+        if (compare->op == OP_LESS_THAN) {
+            jump->op = negated ? OP_JUMP_IF_LESS : OP_JUMP_IF_NOT_LESS;
+        } else {
+            jump->op = negated ? OP_JUMP_IF_GREATER : OP_JUMP_IF_NOT_GREATER;
+        }
+        jump->line = compare->line;
+        for (int k = i; k < j; k++) {
+            code->insns[k].removed = true;
+        }
+    }
+
+    // removed instructions map to the next one kept, that's the fused jump for a compare
+    int *new_idx = ALLOCATE(int, code->count);
+    for (int i = 0, kept = 0; i < code->count; i++) {
+        new_idx[i] = kept;
+        kept += !code->insns[i].removed;
+    }
+    for (int i = 0; i < code->count; i++) {
+        Insn_t insn = code->insns[i];
+        if (insn.removed) {
+            continue;
+        }
+        if (is_jump(insn.op)) {
+            insn.operand = new_idx[insn.operand];
+        }
+        append(out, insn);
+    }
+    free(targeted);
+    free(new_idx);
+}
+
+void optimize_chunk(Chunk_t *chunk) {
+    InsnArray_t code = {0};
+    decode(chunk, &code);
+    int num_names = number_globals(chunk, &code);
+    for (int i = 0; i < code.count; i++) {
+        OpCode_t op = code.insns[i].op;
+        bool early_return = (op == OP_RETURN || op == OP_TAIL_CALL) && i + 1 < code.count;
+        if (is_jump(op) || op == OP_CALL || early_return) {
+            // the passes below take every instruction to run right after the one before it, and
+            // no global to change unless the chunk stores to it
+            InsnArray_t fused = {0};
+            fuse_branches(&code, &fused);
+            InsnArray_t hoisted = {0};
+            hoist_invariant_loads(&fused, num_names, chunk->arity > 0 ? chunk->arity : 0,
+                                  &hoisted);
+            encode(chunk, &hoisted);
+            free(code.insns);
+            free(fused.insns);
+            free(hoisted.insns);
+            return;
+        }
+    }
+    if (!analyze(chunk, &code, num_names)) {
+        free(code.insns);
+        return;
+    }
+
+    InsnArray_t forwarded = {0};
+    forward_loads(&code, num_names, &forwarded);
+    analyze(chunk, &forwarded, num_names);
+    eliminate_dead_stores(&forwarded);
+
+    InsnArray_t result = {0};
+    drop_unused_values(&forwarded, &result);
+    encode(chunk, &result);
+
+    free(code.insns);
+    free(forwarded.insns);
+    free(result.insns);
+}
@@ -0,0 +1,209 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../includes/profiler.h"
+#include "../includes/memory.h"
+
+#include <time.h>
+
+#define PROFILE_TOP_LINES 20 // lines listed by dump_profile()
+
+// cpu cycles where there's a cycle counter, nanoseconds everywhere else
+static uint64_t read_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+void init_profile(Profile_t *profile) {
+    memset(profile->ops, 0, sizeof(profile->ops));
+    profile->lines = NULL;
+    profile->line_capacity = 0;
+    profile->chunks = NULL;
+    profile->num_chunks = 0;
+    profile->chunk_capacity = 0;
+    profile->offset_lines = NULL;
+    profile->chunk = NULL;
+    profile->cur_op = -1;
+    profile->cur_line = 0;
+    profile->started = 0;
+}
+
+void free_profile(Profile_t *profile) {
+    free(profile->lines);
+    for (int i = 0; i < profile->chunk_capacity; i++) {
+        free(profile->chunks[i].lines);
+    }
+    free(profile->chunks);
+    init_profile(profile);
+}
+
+static ProfileChunk_t *find_chunk_slot(ProfileChunk_t *chunks, int capacity, Chunk_t *chunk) {
+    uint32_t idx = (uint32_t)(((uintptr_t)chunk >> 4) * 2654435761u) & (capacity - 1);
+    while (chunks[idx].chunk != NULL && chunks[idx].chunk != chunk) {
+        idx = (idx + 1) & (capacity - 1);
+    }
+    return &chunks[idx];
+}
+
+// capacity stays a power of two and at most half full
+static void grow_chunks(Profile_t *profile) {
+    int capacity = profile->chunk_capacity == 0 ? 16 : profile->chunk_capacity * 2;
+    ProfileChunk_t *chunks = calloc(capacity, sizeof(ProfileChunk_t));
+    for (int i = 0; i < profile->chunk_capacity; i++) {
+        if (profile->chunks[i].chunk != NULL) {
+            *find_chunk_slot(chunks, capacity, profile->chunks[i].chunk) = profile->chunks[i];
+        }
+    }
+    free(profile->chunks);
+    profile->chunks = chunks;
+    profile->chunk_capacity = capacity;
+}
+
+// expands the chunk's line runs so profile_step() finds an instruction's line in one load
+static void expand_lines(Profile_t *profile, ProfileChunk_t *entry, Chunk_t *chunk) {
+    entry->chunk = chunk;
+    entry->lines = resize(entry->lines, sizeof(int), chunk->count > 0 ? chunk->count : 1);
+
+    int offset = 0;
+    int max_line = 0;
+    for (int i = 0; i < chunk->line_runs.count; i++) {
+        LineRun_t run = chunk->line_runs.line_runs[i];
+        for (int j = 0; j < run.count; j++) {
+            entry->lines[offset++] = run.line;
+        }
+        max_line = run.line > max_line ? run.line : max_line;
+    }
+
+    if (max_line + 1 > profile->line_capacity) {
+        int old_capacity = profile->line_capacity;
+        profile->line_capacity = max_line + 1;
+        profile->lines = resize(profile->lines, sizeof(ProfileCounter_t), max_line + 1);
+        memset(profile->lines + old_capacity, 0,
+               sizeof(ProfileCounter_t) * (profile->line_capacity - old_capacity));
+    }
+}
+
+// rebuild is for chunks entered from the top: a script's chunk can reuse the address of the last
+// one (the repl compiles every line into a chunk on its stack), function chunks live as long as
+// the vm and are only expanded once
+static void switch_chunk(Profile_t *profile, Chunk_t *chunk, bool rebuild) {
+    if (profile->num_chunks + 1 > profile->chunk_capacity / 2) {
+        grow_chunks(profile);
+    }
+    ProfileChunk_t *entry = find_chunk_slot(profile->chunks, profile->chunk_capacity, chunk);
+    if (entry->chunk == NULL) {
+        profile->num_chunks++;
+        expand_lines(profile, entry, chunk);
+    } else if (rebuild) {
+        expand_lines(profile, entry, chunk);
+    }
+    profile->chunk = chunk;
+    profile->offset_lines = entry->lines;
+}
+
+void profile_enter(Profile_t *profile, Chunk_t *chunk) {
+    switch_chunk(profile, chunk, true);
+    profile->cur_op = -1;
+}
+
+static void charge(Profile_t *profile, uint64_t now) {
+    if (profile->cur_op >= 0) {
+        profile->ops[profile->cur_op].cycles += now - profile->started;
+        profile->lines[profile->cur_line].cycles += now - profile->started;
+    }
+}
+
+// called before the instruction at offset of chunk runs
+void profile_step(Profile_t *profile, Chunk_t *chunk, int op, int offset) {
+    uint64_t now = read_clock();
+    charge(profile, now);
+    if (chunk != profile->chunk) {
+        switch_chunk(profile, chunk, false); // a call or return switched chunks
+    }
+    profile->cur_op = op;
+    profile->cur_line = profile->offset_lines[offset];
+    profile->ops[op].runs++;
+    profile->lines[profile->cur_line].runs++;
+    profile->started = read_clock(); // leaves our own bookkeeping out of the next instruction
+}
+
+void profile_exit(Profile_t *profile) {
+    charge(profile, read_clock());
+    profile->cur_op = -1;
+}
+
+// ------------------------ Reports ------------------------ //
+
+typedef struct {
+    int idx;
+    uint64_t cycles;
+} Ranked_t;
+
+static int by_cycles(const void *a, const void *b) {
+    const Ranked_t *x = (const Ranked_t *)a;
+    const Ranked_t *y = (const Ranked_t *)b;
+    if (x->cycles != y->cycles) {
+        return x->cycles < y->cycles ? 1 : -1;
+    }
+    return x->idx - y->idx;
+}
+
+// the counters that ran at least once, hottest first
+static int rank_counters(const ProfileCounter_t *counters, int count, Ranked_t *ranked) {
+    int num_ranked = 0;
+    for (int i = 0; i < count; i++) {
+        if (counters[i].runs > 0) {
+            ranked[num_ranked++] = (Ranked_t){.idx = i, .cycles = counters[i].cycles};
+        }
+    }
+    qsort(ranked, num_ranked, sizeof(Ranked_t), by_cycles);
+    return num_ranked;
+}
+
+void dump_profile(Profile_t *profile, FILE *fp) {
+    uint64_t total_runs = 0;
+    uint64_t total_cycles = 0;
+    for (int i = 0; i < OP_COUNT; i++) {
+        total_runs += profile->ops[i].runs;
+        total_cycles += profile->ops[i].cycles;
+    }
+    double percent = total_cycles == 0 ? 0.0 : 100.0 / (double)total_cycles;
+    fprintf(fp, "profile: %llu instructions, %llu cycles\n", (unsigned long long)total_runs,
+            (unsigned long long)total_cycles);
+
+    Ranked_t ops[OP_COUNT];
+    int num_ops = rank_counters(profile->ops, OP_COUNT, ops);
+    fprintf(fp, "%-18s %14s %16s %7s\n", "opcode", "runs", "cycles", "share");
+    for (int i = 0; i < num_ops; i++) {
+        ProfileCounter_t *counter = &profile->ops[ops[i].idx];
+        fprintf(fp, "%-18s %14llu %16llu %6.1f%%\n", op_info[ops[i].idx].name,
+                (unsigned long long)counter->runs, (unsigned long long)counter->cycles,
+                (double)counter->cycles * percent);
+    }
+
+    Ranked_t *lines = ALLOCATE(Ranked_t, profile->line_capacity + 1);
+    int num_lines = rank_counters(profile->lines, profile->line_capacity, lines);
+    fprintf(fp, "%-18s %14s %16s %7s\n", "hottest lines", "runs", "cycles", "share");
+    for (int i = 0; i < num_lines && i < PROFILE_TOP_LINES; i++) {
+        ProfileCounter_t *counter = &profile->lines[lines[i].idx];
+        fprintf(fp, "line %-13d %14llu %16llu %6.1f%%\n", lines[i].idx,
+                (unsigned long long)counter->runs, (unsigned long long)counter->cycles,
+                (double)counter->cycles * percent);
+    }
+    free(lines);
+}
+
+// one "name;line n cycles" sample per line, the collapsed stack format flamegraph.pl and
+// speedscope read
+void write_collapsed_profile(Profile_t *profile, const char *name, FILE *fp) {
+    for (int line = 0; line < profile->line_capacity; line++) {
+        if (profile->lines[line].cycles > 0) {
+            fprintf(fp, "%s;line %d %llu\n", name, line,
+                    (unsigned long long)profile->lines[line].cycles);
+        }
+    }
+}
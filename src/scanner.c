@@ -1,124 +1,125 @@
 #include "../includes/scanner.h"
 
-Scanner_t scanner;
-
-static bool at_end();
+static bool at_end(Scanner_t *scanner);
 static bool is_digit(char c);
 static bool is_alpha(char c);
-static TokenType_t get_identifier_type();
-static TokenType_t check_keyword(int start, int length, const char *rest, TokenType_t type);
-static Token_t init_token(TokenType_t type);
-static Token_t init_error_token(const char *err_msg);
-static char peek();
-static char peek_next();
-static char consume();
-
-void init_scanner(const char *file) {
-    scanner.start = file;
-    scanner.cur = file;
-    scanner.line = 1;
+static TokenType_t get_identifier_type(Scanner_t *scanner);
+static TokenType_t check_keyword(Scanner_t *scanner, int start, int length, const char *rest,
+                                 TokenType_t type);
+static Token_t init_token(Scanner_t *scanner, TokenType_t type);
+static Token_t init_error_token(Scanner_t *scanner, const char *err_msg);
+static char peek(Scanner_t *scanner);
+static char peek_next(Scanner_t *scanner);
+static char consume(Scanner_t *scanner);
+
+void init_scanner(Scanner_t *scanner, const char *file) {
+    scanner->start = file;
+    scanner->cur = file;
+    scanner->line = 1;
 }
 
-Token_t scan_token() {
+Token_t scan_token(Scanner_t *scanner) {
     while (true) {
-        char c = peek();
+        char c = peek(scanner);
         if (c == ' ' || c == '\r' || c == '\t') {
-            consume();
+            consume(scanner);
         } else if (c == '\n') {
-            scanner.line++;
-            consume();
-        } else if (c == '/' && peek_next() == '/') {
-            while (peek() != '\n' && !at_end()) {
-                consume();
+            scanner->line++;
+            consume(scanner);
+        } else if (c == '/' && peek_next(scanner) == '/') {
+            while (peek(scanner) != '\n' && !at_end(scanner)) {
+                consume(scanner);
             }
         } else {
             break;
         }
     }
-    scanner.start = scanner.cur;
-    if (at_end()) {
-        return init_token(TOKEN_END_FILE);
+    scanner->start = scanner->cur;
+    if (at_end(scanner)) {
+        return init_token(scanner, TOKEN_END_FILE);
     }
 
-    char c = consume();
+    char c = consume(scanner);
 
     // handle numbers
-    if (is_digit(c) || (c == '.' && is_digit(peek_next()))) {
-        while (is_digit(peek())) {
-            consume();
+    if (is_digit(c) || (c == '.' && is_digit(peek_next(scanner)))) {
+        while (is_digit(peek(scanner))) {
+            consume(scanner);
         }
 
         // handle decimals
-        if (peek() == '.' && is_digit(peek_next())) {
-            consume(); // consume decimal
-            while (is_digit(peek())) {
-                consume();
+        if (peek(scanner) == '.' && is_digit(peek_next(scanner))) {
+            consume(scanner); // consume decimal
+            while (is_digit(peek(scanner))) {
+                consume(scanner);
             }
         }
-        return init_token(TOKEN_NUM);
+        return init_token(scanner, TOKEN_NUM);
     }
 
     // handle identifiers
     if (is_alpha(c)) {
-        while (is_alpha(peek()) || is_digit(peek())) {
-            consume();
+        while (is_alpha(peek(scanner)) || is_digit(peek(scanner))) {
+            consume(scanner);
         }
-        return init_token(get_identifier_type());
+        return init_token(scanner, get_identifier_type(scanner));
     }
     switch (c) {
         case '(':
-            return init_token(TOKEN_OPEN_PAREN);
+            return init_token(scanner, TOKEN_OPEN_PAREN);
         case ')':
-            return init_token(TOKEN_CLOSE_PAREN);
+            return init_token(scanner, TOKEN_CLOSE_PAREN);
         case '{':
-            return init_token(TOKEN_OPEN_CURLY);
+            return init_token(scanner, TOKEN_OPEN_CURLY);
         case '}':
-            return init_token(TOKEN_CLOSE_CURLY);
+            return init_token(scanner, TOKEN_CLOSE_CURLY);
         case ',':
-            return init_token(TOKEN_COMMA);
+            return init_token(scanner, TOKEN_COMMA);
         case '.':
-            return init_token(TOKEN_DOT);
+            return init_token(scanner, TOKEN_DOT);
         case '-':
-            return init_token(TOKEN_SUB);
+            return init_token(scanner, TOKEN_SUB);
         case '+':
-            return init_token(TOKEN_ADD);
+            return init_token(scanner, TOKEN_ADD);
         case '*':
-            return init_token(TOKEN_MUL);
+            return init_token(scanner, TOKEN_MUL);
         case '/':
-            return init_token(TOKEN_DIV);
+            return init_token(scanner, TOKEN_DIV);
         case ';':
-            return init_token(TOKEN_SEMICOLON);
+            return init_token(scanner, TOKEN_SEMICOLON);
         case '!':
-            return init_token(check_next('=') ? TOKEN_NOT_EQUAL : TOKEN_NOT);
+            return init_token(scanner, check_next(scanner, '=') ? TOKEN_NOT_EQUAL : TOKEN_NOT);
         case '=':
-            return init_token(check_next('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+            return init_token(scanner, check_next(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
         case '<': {
-            if (check_next('<')) {
-                return init_token(TOKEN_LEFT_SHIFT);
+            if (check_next(scanner, '<')) {
+                return init_token(scanner, TOKEN_LEFT_SHIFT);
             }
-            return init_token(check_next('=') ? TOKEN_LESS_THAN_EQUAL : TOKEN_LESS_THAN);
+            return init_token(scanner,
+                              check_next(scanner, '=') ? TOKEN_LESS_THAN_EQUAL : TOKEN_LESS_THAN);
         }
         case '>': {
-            if (check_next('>'))
-                return init_token(TOKEN_RIGHT_SHIFT);
-            return init_token(check_next('=') ? TOKEN_GREATER_THAN_EQUAL : TOKEN_GREATER_THAN);
+            if (check_next(scanner, '>'))
+                return init_token(scanner, TOKEN_RIGHT_SHIFT);
+            return init_token(scanner, check_next(scanner, '=') ? TOKEN_GREATER_THAN_EQUAL
+                                                              : TOKEN_GREATER_THAN);
         }
         case '"': {
-            while (!at_end() && peek() != '"') {
-                if (peek() == '\n') {
-                    scanner.line++;
+            while (!at_end(scanner) && peek(scanner) != '"') {
+                if (peek(scanner) == '\n') {
+                    scanner->line++;
                 }
-                consume();
+                consume(scanner);
             }
-            if (at_end()) {
-                return init_error_token("Error: Unclosed string");
+            if (at_end(scanner)) {
+                return init_error_token(scanner, "Error: Unclosed string");
             }
-            consume(); // closing quote
-            return init_token(TOKEN_STR);
+            consume(scanner); // closing quote
+            return init_token(scanner, TOKEN_STR);
         }
     }
 
-    return init_error_token("Unexpected token");
+    return init_error_token(scanner, "Unexpected token");
 }
 
 static bool is_digit(char c) {
@@ -129,65 +130,65 @@ static bool is_alpha(char c) {
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_');
 }
 
-static char peek() {
-    return *scanner.cur;
+static char peek(Scanner_t *scanner) {
+    return *scanner->cur;
 }
 
-static char peek_next() {
-    if (at_end())
+static char peek_next(Scanner_t *scanner) {
+    if (at_end(scanner))
         return '\0';
-    return *(scanner.cur + 1);
+    return *(scanner->cur + 1);
 }
 
-static char consume() {
-    return *scanner.cur++;
+static char consume(Scanner_t *scanner) {
+    return *scanner->cur++;
 }
 
-static TokenType_t get_identifier_type() {
+static TokenType_t get_identifier_type(Scanner_t *scanner) {
     // check if it's a keyword first
-    switch (*scanner.start) {
+    switch (*scanner->start) {
         case 'a':
-            return check_keyword(1, 2, "nd", TOKEN_AND);
+            return check_keyword(scanner, 1, 2, "nd", TOKEN_AND);
         case 'c':
-            return check_keyword(1, 4, "lass", TOKEN_CLASS);
+            return check_keyword(scanner, 1, 4, "lass", TOKEN_CLASS);
         case 'e':
-            return check_keyword(1, 3, "lse", TOKEN_ELSE);
+            return check_keyword(scanner, 1, 3, "lse", TOKEN_ELSE);
         case 'i':
-            return check_keyword(1, 1, "f", TOKEN_IF);
+            return check_keyword(scanner, 1, 1, "f", TOKEN_IF);
         case 'n':
-            return check_keyword(1, 3, "one", TOKEN_NONE);
+            return check_keyword(scanner, 1, 3, "one", TOKEN_NONE);
         case 'o':
-            return check_keyword(1, 1, "r", TOKEN_OR);
+            return check_keyword(scanner, 1, 1, "r", TOKEN_OR);
         case 'l':
-            return check_keyword(1, 2, "et", TOKEN_LET);
+            return check_keyword(scanner, 1, 2, "et", TOKEN_LET);
         case 'p':
-            return check_keyword(1, 4, "rint", TOKEN_PRINT);
+            return check_keyword(scanner, 1, 4, "rint", TOKEN_PRINT);
         case 'r':
-            return check_keyword(1, 5, "eturn", TOKEN_RETURN);
+            return check_keyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
         case 's':
-            return check_keyword(1, 4, "uper", TOKEN_SUPER);
+            return check_keyword(scanner, 1, 4, "uper", TOKEN_SUPER);
         case 'w':
-            return check_keyword(1, 4, "hile", TOKEN_WHILE);
+            return check_keyword(scanner, 1, 4, "hile", TOKEN_WHILE);
         case 'f': {
-            if (scanner.cur - scanner.start > 1) {
-                switch (*(scanner.start + 1)) {
+            if (scanner->cur - scanner->start > 1) {
+                switch (*(scanner->start + 1)) {
                     case 'a':
-                        return check_keyword(2, 3, "lse", TOKEN_FALSE);
+                        return check_keyword(scanner, 2, 3, "lse", TOKEN_FALSE);
                     case 'o':
-                        return check_keyword(2, 2, "or", TOKEN_FOR);
+                        return check_keyword(scanner, 2, 1, "r", TOKEN_FOR);
                     case 'u':
-                        return check_keyword(2, 3, "unc", TOKEN_FUNC);
+                        return check_keyword(scanner, 2, 2, "nc", TOKEN_FUNC);
                 }
             }
             break;
         }
         case 't': {
-            if (scanner.cur - scanner.start > 1) {
-                switch (*(scanner.start + 1)) {
+            if (scanner->cur - scanner->start > 1) {
+                switch (*(scanner->start + 1)) {
                     case 'h':
-                        return check_keyword(2, 2, "is", TOKEN_THIS);
+                        return check_keyword(scanner, 2, 2, "is", TOKEN_THIS);
                     case 'r':
-                        return check_keyword(2, 2, "ue", TOKEN_TRUE);
+                        return check_keyword(scanner, 2, 2, "ue", TOKEN_TRUE);
                 }
             }
             break;
@@ -196,39 +197,40 @@ static TokenType_t get_identifier_type() {
     return TOKEN_IDENTIFIER;
 }
 
-static TokenType_t check_keyword(int start, int length, const char *rest, TokenType_t type) {
-    if (scanner.cur - scanner.start == start + length &&
-        strncmp(scanner.start + start, rest, length) == 0) {
+static TokenType_t check_keyword(Scanner_t *scanner, int start, int length, const char *rest,
+                                 TokenType_t type) {
+    if (scanner->cur - scanner->start == start + length &&
+        strncmp(scanner->start + start, rest, length) == 0) {
         return type;
     }
     return TOKEN_IDENTIFIER;
 }
 
-static Token_t init_token(TokenType_t type) {
+static Token_t init_token(Scanner_t *scanner, TokenType_t type) {
     Token_t new_token;
     new_token.type = type;
-    new_token.start = scanner.start;
-    new_token.length = scanner.cur - scanner.start;
-    new_token.line = scanner.line;
+    new_token.start = scanner->start;
+    new_token.length = scanner->cur - scanner->start;
+    new_token.line = scanner->line;
     return new_token;
 }
 
-static Token_t init_error_token(const char *err_msg) {
+static Token_t init_error_token(Scanner_t *scanner, const char *err_msg) {
     Token_t err_token;
     err_token.type = TOKEN_ERROR;
-    err_token.start = scanner.start;
+    err_token.start = scanner->start;
     err_token.length = strlen(err_msg);
-    err_token.line = scanner.line;
+    err_token.line = scanner->line;
     return err_token;
 }
 
-static bool at_end() {
-    return *scanner.cur == '\0';
+static bool at_end(Scanner_t *scanner) {
+    return *scanner->cur == '\0';
 }
 
-bool check_next(const char expected) {
-    if (!at_end() && *scanner.cur == expected) {
-        scanner.cur++;
+bool check_next(Scanner_t *scanner, const char expected) {
+    if (!at_end(scanner) && *scanner->cur == expected) {
+        scanner->cur++;
         return true;
     }
     return false;
@@ -0,0 +1,100 @@
+#define _DEFAULT_SOURCE
+
+#include "../includes/stack.h"
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// set while a vm runs on this thread; a fault inside its reservation is a stack overflow
+static __thread StackGuard_t guard = {NULL, NULL};
+static pthread_once_t handler_once = PTHREAD_ONCE_INIT;
+static struct sigaction previous_action; // whatever handled SIGSEGV before us, faults we don't own
+
+static size_t page_values() {
+    return (size_t)sysconf(_SC_PAGESIZE) / sizeof(Value_t);
+}
+
+void init_value_stack(ValueStack_t *stack) {
+    void *region = mmap(NULL, STACK_MAX_VALUES * sizeof(Value_t), PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        fprintf(stderr, "Error: not enough memory avaialable");
+        exit(1);
+    }
+    stack->values = (Value_t *)region;
+    stack->committed = 0;
+}
+
+void free_value_stack(ValueStack_t *stack) {
+    munmap(stack->values, STACK_MAX_VALUES * sizeof(Value_t));
+    stack->values = NULL;
+    stack->committed = 0;
+}
+
+// make sure at least values slots are usable. false if that's more than was reserved
+bool commit_value_stack(ValueStack_t *stack, size_t values) {
+    if (values <= stack->committed) {
+        return true;
+    }
+    size_t page = page_values();
+    size_t rounded = (values + page - 1) / page * page;
+    // leave at least one PROT_NONE page at the end of the reservation as the guard
+    if (rounded + page > STACK_MAX_VALUES) {
+        return false;
+    }
+    if (mprotect(stack->values + stack->committed, (rounded - stack->committed) * sizeof(Value_t),
+                 PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    stack->committed = rounded;
+    return true;
+}
+
+// any other fault goes to the handler that was installed before ours (an embedder's, say). with
+// none it's a real crash: put the default action back and let it fault again
+static void on_fault(int signal, siginfo_t *info, void *context) {
+    Value_t *address = (Value_t *)info->si_addr;
+    if (guard.stack != NULL && guard.jump != NULL && address >= guard.stack->values &&
+        address < guard.stack->values + STACK_MAX_VALUES) {
+        siglongjmp(*(sigjmp_buf *)guard.jump, 1);
+    }
+    if (previous_action.sa_flags & SA_SIGINFO) {
+        previous_action.sa_sigaction(signal, info, context);
+    } else if (previous_action.sa_handler != SIG_DFL && previous_action.sa_handler != SIG_IGN) {
+        previous_action.sa_handler(signal);
+    } else {
+        // an ignored fault would just fault again forever
+        struct sigaction action;
+        action.sa_handler = SIG_DFL;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = 0;
+        sigaction(signal, &action, NULL);
+    }
+}
+
+// SA_NODEFER since we leave through siglongjmp; the jump buffer then doesn't need to save the
+// signal mask, which keeps arming the guard free of syscalls
+static void install_handler() {
+    struct sigaction action;
+    action.sa_sigaction = on_fault;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigaction(SIGSEGV, &action, &previous_action);
+}
+
+// returns the previous guard so nested runs can put it back
+StackGuard_t arm_stack_guard(ValueStack_t *stack, void *jump) {
+    pthread_once(&handler_once, install_handler);
+    StackGuard_t previous = guard;
+    guard = (StackGuard_t){.stack = stack, .jump = jump};
+    return previous;
+}
+
+void restore_stack_guard(StackGuard_t previous) {
+    guard = previous;
+}
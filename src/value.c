@@ -2,6 +2,9 @@
 #include "../includes/memory.h"
 #include "../includes/object.h"
 
+#include <errno.h>
+#include <math.h>
+
 // init / reset method for value arrays
 void init_value_array(ValueArray_t *array) {
     array->capacity = 0;
@@ -27,34 +30,217 @@ void free_value_array(ValueArray_t *array) {
     init_value_array(array);
 }
 
-void print_object(Value_t value) {
+// ------------------------ Number formatting ------------------------ //
+
+// the text printf("%g") gives (6 significant digits, trailing zeros stripped). numbers that are
+// a short decimal (up to 6 digits) or an integer below 2^53 are formatted with integer math; the
+// result is exactly what %g gives because both print the same decimal: the double is within half
+// an ulp of it, far closer than the rounding boundaries of a 6 digit number. everything else
+// (more digits, huge, tiny, nan, inf) goes to snprintf
+#define NUM_DIGITS 6
+#define EXACT_INT_LIMIT 9007199254740992.0 // 2^53
+
+static const double powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                       1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                       1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static int count_digits(uint64_t num) {
+    int digits = 1;
+    while (num >= 10) {
+        num /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+// writes the digits of num right to left, ending before end
+static char *put_digits(char *end, uint64_t num) {
+    do {
+        *--end = (char)('0' + num % 10);
+        num /= 10;
+    } while (num > 0);
+    return end;
+}
+
+// digits.digits[e+-]XX with at least two exponent digits, digits has no trailing zeros
+static int put_exponential(char *buf, uint64_t digits, int exponent) {
+    char tmp[24];
+    char *first = put_digits(tmp + sizeof(tmp), digits);
+    int num_digits = (int)(tmp + sizeof(tmp) - first);
+    int length = 0;
+    buf[length++] = first[0];
+    if (num_digits > 1) {
+        buf[length++] = '.';
+        memcpy(buf + length, first + 1, num_digits - 1);
+        length += num_digits - 1;
+    }
+    buf[length++] = 'e';
+    buf[length++] = exponent < 0 ? '-' : '+';
+    exponent = exponent < 0 ? -exponent : exponent;
+    if (exponent < 10) {
+        buf[length++] = '0';
+    }
+    char *exp_first = put_digits(tmp + sizeof(tmp), (uint64_t)exponent);
+    memcpy(buf + length, exp_first, tmp + sizeof(tmp) - exp_first);
+    return length + (int)(tmp + sizeof(tmp) - exp_first);
+}
+
+// num / 10^scale with num < 10^NUM_DIGITS and not ending in 0 unless scale is 0
+static int put_decimal(char *buf, uint64_t num, int scale) {
+    int num_digits = count_digits(num);
+    int exponent = num_digits - 1 - scale;
+    if (exponent < -4 || exponent >= NUM_DIGITS) {
+        while (num % 10 == 0) {
+            num /= 10;
+        }
+        return put_exponential(buf, num, exponent);
+    }
+
+    char tmp[32];
+    char *end = tmp + sizeof(tmp);
+    char *first = put_digits(end, num);
+    while (end - first <= scale) {
+        *--first = '0'; // leading zeros of 0.000ddd
+    }
+    int int_digits = (int)(end - first) - scale;
+    memcpy(buf, first, int_digits);
+    int length = int_digits;
+    if (scale > 0) {
+        buf[length++] = '.';
+        memcpy(buf + length, first + int_digits, scale);
+        length += scale;
+    }
+    return length;
+}
+
+// integer with more than NUM_DIGITS digits, rounded half to even like printf does for exact ties
+static int put_rounded_int(char *buf, uint64_t num) {
+    int dropped = count_digits(num) - NUM_DIGITS;
+    uint64_t divisor = (uint64_t)powers_of_ten[dropped];
+    uint64_t digits = num / divisor;
+    uint64_t rest = num % divisor;
+    if (rest > divisor / 2 || (rest == divisor / 2 && digits % 2 == 1)) {
+        digits++;
+    }
+    int exponent = NUM_DIGITS - 1 + dropped;
+    if (digits == (uint64_t)powers_of_ten[NUM_DIGITS]) {
+        digits /= 10;
+        exponent++;
+    }
+    while (digits % 10 == 0) {
+        digits /= 10;
+    }
+    return put_exponential(buf, digits, exponent);
+}
+
+// buf needs NUM_BUFFER bytes, returns the length (no terminator)
+#define NUM_BUFFER 32
+static int format_num(double num, char *buf) {
+    if (num == 0) {
+        buf[0] = '-';
+        buf[signbit(num) ? 1 : 0] = '0';
+        return signbit(num) ? 2 : 1;
+    }
+    if (isfinite(num)) {
+        int sign = num < 0 ? 1 : 0;
+        double abs = num < 0 ? -num : num;
+        buf[0] = '-';
+        if (abs < EXACT_INT_LIMIT && abs == (double)(uint64_t)abs) {
+            uint64_t whole = (uint64_t)abs;
+            if (whole < (uint64_t)powers_of_ten[NUM_DIGITS]) {
+                return sign + put_decimal(buf + sign, whole, 0);
+            }
+            return sign + put_rounded_int(buf + sign, whole);
+        }
+        // smallest scale where abs is a short decimal, division by an exact power of ten is
+        // correctly rounded so the compare holds iff abs is the double nearest that decimal
+        for (int scale = 1; scale < (int)(sizeof(powers_of_ten) / sizeof(double)); scale++) {
+            double scaled = abs * powers_of_ten[scale];
+            if (scaled >= powers_of_ten[NUM_DIGITS]) {
+                break;
+            }
+            uint64_t digits = (uint64_t)(scaled + 0.5);
+            if (digits != 0 && (double)digits / powers_of_ten[scale] == abs) {
+                return sign + put_decimal(buf + sign, digits, scale);
+            }
+        }
+    }
+    return snprintf(buf, NUM_BUFFER, "%g", num);
+}
+
+// plain digits, no printf
+static int format_int(int64_t num, char *buf) {
+    char tmp[24];
+    // negate as unsigned so INT64_MIN works
+    uint64_t abs = num < 0 ? 0 - (uint64_t)num : (uint64_t)num;
+    char *first = put_digits(tmp + sizeof(tmp), abs);
+    if (num < 0) {
+        *--first = '-';
+    }
+    int length = (int)(tmp + sizeof(tmp) - first);
+    memcpy(buf, first, length);
+    return length;
+}
+
+static void write_object(Writer_t *writer, Value_t value) {
     switch (OBJ_TYPE(value)) {
         case OBJ_STR:
-            printf("%s", GET_CSTR_VAL(value));
+            write_bytes(writer, GET_CSTR_VAL(value), GET_STR_VAL(value)->length);
+            break;
+        case OBJ_FUNC:
+            write_str(writer, "<func ");
+            write_str(writer, GET_FUNC_VAL(value)->name->chars);
+            write_str(writer, ">");
+            break;
+        case OBJ_NATIVE:
+            write_str(writer, "<native ");
+            write_str(writer, GET_NATIVE_VAL(value)->name->chars);
+            write_str(writer, ">");
             break;
     }
 }
 
-// print value helper function for other disassembler
-void print_value(Value_t value) {
+// OP_PRINT, the disassembler and traces all print values through here
+void write_value(Writer_t *writer, Value_t value) {
     switch (value.type) {
         case VAL_BOOL:
-            printf(GET_BOOL_VAL(value) ? "true" : "false");
+            write_str(writer, GET_BOOL_VAL(value) ? "true" : "false");
             break;
         case VAL_NONE:
-            printf("none");
+            write_str(writer, "none");
             break;
-        case VAL_NUM:
-            printf("%g", GET_NUM_VAL(value));
+        case VAL_NUM: {
+            char buf[NUM_BUFFER];
+            write_bytes(writer, buf, format_num(GET_NUM_VAL(value), buf));
+            break;
+        }
+        case VAL_INT: {
+            char buf[NUM_BUFFER];
+            write_bytes(writer, buf, format_int(GET_INT_VAL(value), buf));
             break;
+        }
         case VAL_OBJ:
-            print_object(value);
+            write_object(writer, value);
             break;
     }
 }
 
+bool is_falsey(Value_t value) {
+    return IS_NONE_VAL(value) || (IS_BOOL_VAL(value) && GET_BOOL_VAL(value) == false);
+}
+
+// an int and a double are equal when they are the same number exactly
+static bool int_equals_num(int64_t a, double b) {
+    // (double)a is an integer in [-2^63, 2^63], so past the first check b converts back exactly
+    return (double)a == b && b != 9223372036854775808.0 && (int64_t)b == a;
+}
+
 bool equals(Value_t a, Value_t b) {
-    if (a.type != b.type) {
+    if (IS_INT_VAL(a) && IS_NUM_VAL(b)) {
+        return int_equals_num(GET_INT_VAL(a), GET_NUM_VAL(b));
+    } else if (IS_NUM_VAL(a) && IS_INT_VAL(b)) {
+        return int_equals_num(GET_INT_VAL(b), GET_NUM_VAL(a));
+    } else if (a.type != b.type) {
         return false;
     }
     switch (a.type) {
@@ -62,12 +248,105 @@ bool equals(Value_t a, Value_t b) {
             return GET_BOOL_VAL(a) == GET_BOOL_VAL(b);
         case VAL_NUM:
             return GET_NUM_VAL(a) == GET_NUM_VAL(b);
+        case VAL_INT:
+            return GET_INT_VAL(a) == GET_INT_VAL(b);
         case VAL_NONE:
             return true;
         case VAL_OBJ: {
-            return GET_OBJ_VAL(a) == GET_OBJ_VAL(b);
+            if (GET_OBJ_VAL(a) == GET_OBJ_VAL(b)) {
+                return true;
+            }
+            // a vm using a shared intern table can hold a runtime copy of a literal another vm
+            // interned later, so equal strings aren't always the same object
+            if (!IS_STR(a) || !IS_STR(b)) {
+                return false;
+            }
+            ObjectStr_t *x = GET_STR_VAL(a);
+            ObjectStr_t *y = GET_STR_VAL(b);
+            return x->hash == y->hash && x->length == y->length &&
+                   memcmp(x->chars, y->chars, x->length) == 0;
         }
         default:
             return false;
     }
 }
+
+// ------------------------ Numbers ------------------------ //
+// the semantics every layer shares (vm slow paths, constant folding, the columnar fallback): ints
+// stay ints while the result is exact, everything else is done in doubles
+
+// digits only is an int, unless it doesn't fit in 64 bits
+Value_t number_literal(const char *chars, int length) {
+    bool is_int = true;
+    for (int i = 0; i < length; i++) {
+        is_int = is_int && chars[i] >= '0' && chars[i] <= '9';
+    }
+    if (is_int) {
+        errno = 0;
+        long long num = strtoll(chars, NULL, 10);
+        if (errno != ERANGE) {
+            return DECL_INT_VAL((int64_t)num);
+        }
+    }
+    return DECL_NUM_VAL(strtod(chars, NULL));
+}
+
+// same contract as __builtin_*_overflow: true when a / b has no exact int result (it has a
+// remainder, divides by zero or overflows), the vm then divides in doubles
+bool div_ints(int64_t a, int64_t b, int64_t *result) {
+    if (b == 0 || (a == INT64_MIN && b == -1) || a % b != 0) {
+        return true;
+    }
+    *result = a / b;
+    return false;
+}
+
+Value_t add_numbers(Value_t a, Value_t b) {
+    int64_t result;
+    if (IS_INT_VAL(a) && IS_INT_VAL(b) &&
+        !__builtin_add_overflow(GET_INT_VAL(a), GET_INT_VAL(b), &result)) {
+        return DECL_INT_VAL(result);
+    }
+    return DECL_NUM_VAL(GET_NUMBER_VAL(a) + GET_NUMBER_VAL(b));
+}
+
+Value_t sub_numbers(Value_t a, Value_t b) {
+    int64_t result;
+    if (IS_INT_VAL(a) && IS_INT_VAL(b) &&
+        !__builtin_sub_overflow(GET_INT_VAL(a), GET_INT_VAL(b), &result)) {
+        return DECL_INT_VAL(result);
+    }
+    return DECL_NUM_VAL(GET_NUMBER_VAL(a) - GET_NUMBER_VAL(b));
+}
+
+Value_t mul_numbers(Value_t a, Value_t b) {
+    int64_t result;
+    if (IS_INT_VAL(a) && IS_INT_VAL(b) &&
+        !__builtin_mul_overflow(GET_INT_VAL(a), GET_INT_VAL(b), &result)) {
+        return DECL_INT_VAL(result);
+    }
+    return DECL_NUM_VAL(GET_NUMBER_VAL(a) * GET_NUMBER_VAL(b));
+}
+
+Value_t div_numbers(Value_t a, Value_t b) {
+    int64_t result;
+    if (IS_INT_VAL(a) && IS_INT_VAL(b) && !div_ints(GET_INT_VAL(a), GET_INT_VAL(b), &result)) {
+        return DECL_INT_VAL(result);
+    }
+    return DECL_NUM_VAL(GET_NUMBER_VAL(a) / GET_NUMBER_VAL(b));
+}
+
+Value_t negate_number(Value_t a) {
+    if (IS_INT_VAL(a) && GET_INT_VAL(a) != INT64_MIN) {
+        return DECL_INT_VAL(-GET_INT_VAL(a));
+    }
+    return DECL_NUM_VAL(-GET_NUMBER_VAL(a));
+}
+
+// two ints compare exactly, anything else as doubles
+bool less_than(Value_t a, Value_t b) {
+    if (IS_INT_VAL(a) && IS_INT_VAL(b)) {
+        return GET_INT_VAL(a) < GET_INT_VAL(b);
+    }
+    return GET_NUMBER_VAL(a) < GET_NUMBER_VAL(b);
+}
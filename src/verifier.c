@@ -0,0 +1,180 @@
+#include "../includes/verifier.h"
+#include "../includes/memory.h"
+#include "../includes/object.h"
+
+// everything run() and the jit take on trust is checked here once per chunk: opcodes exist,
+// operands are well formed, inside the code and index real constants (strings for global names),
+// jumps land on instructions, slots exist, the stack never underflows or goes past max_stack and
+// has the same depth on every path into an instruction, and the chunk ends with an instruction
+// control can't fall through so pc can't run off the end. a chunk that passes is marked verified,
+// along with the functions among its constants
+
+static bool reject(FILE *err, int offset, const char *reason) {
+    fprintf(err, "Invalid bytecode at offset %d: %s\n", offset, reason);
+    return false;
+}
+
+// length in bytes of the operand at offset, 0 if it runs off the end of the code or is wider
+// than OPERAND_MAX_BYTES
+static int operand_length(Chunk_t *chunk, int offset) {
+    for (int length = 1; length <= OPERAND_MAX_BYTES; length++) {
+        if (offset + length > chunk->count) {
+            return 0;
+        } else if (!(chunk->code[offset + length - 1] & 0x80)) {
+            return length;
+        }
+    }
+    return 0;
+}
+
+static bool names_global(uint8_t op) {
+    return op == OP_DEFINE_GLOBAL || op == OP_GET_GLOBAL || op == OP_SET_GLOBAL;
+}
+
+// one instruction on its own: opcode, operand encoding and constant idx. returns its length, 0
+// after rejecting it
+static int check_instruction(Chunk_t *chunk, int offset, FILE *err) {
+    uint8_t op = chunk->code[offset];
+    if (op >= OP_COUNT) {
+        return reject(err, offset, "unknown opcode");
+    }
+    const OpInfo_t *info = &op_info[op];
+    int length = 1;
+    if (info->has_operand) {
+        int operand_bytes = operand_length(chunk, offset + 1);
+        if (operand_bytes == 0) {
+            return reject(err, offset, "operand runs past the end of the code or is too wide");
+        } else if (info->jump != 0 && operand_bytes != OPERAND_MAX_BYTES) {
+            return reject(err, offset, "jump distance is not padded to full width");
+        }
+        length += operand_bytes;
+    }
+    if (info->constant_operand) {
+        uint8_t *pc = &chunk->code[offset + 1];
+        int idx = read_operand(&pc);
+        if (idx >= chunk->constants.count) {
+            return reject(err, offset, "constant index out of range");
+        }
+        if (names_global(op) && !IS_STR(chunk->constants.values[idx])) {
+            return reject(err, offset, "global name is not a string constant");
+        }
+    }
+    if (op == OP_TAIL_CALL && chunk->arity < 0) {
+        return reject(err, offset, "OP_TAIL_CALL outside of a function");
+    }
+    return length;
+}
+
+// depth is the stack depth before the instruction at offset runs
+static bool check_effect(Chunk_t *chunk, int offset, int depth, FILE *err) {
+    uint8_t op = chunk->code[offset];
+    int pops = instruction_pops(&chunk->code[offset]);
+    if (op == OP_GET_SLOT || op == OP_SET_SLOT) {
+        // a slot has to exist already, and set never targets the value it copies
+        uint8_t *pc = &chunk->code[offset + 1];
+        int slot = read_operand(&pc);
+        if (slot >= (op == OP_GET_SLOT ? depth : depth - 1)) {
+            return reject(err, offset, "slot out of range");
+        }
+    }
+    if (depth - pops < 0) {
+        return reject(err, offset, "stack underflow");
+    } else if (depth - pops + op_info[op].pushes > chunk->max_stack) {
+        return reject(err, offset, "stack grows past max_stack");
+    } else if (op == OP_RETURN && chunk->arity < 0 && depth > 1) {
+        // whatever the script leaves behind is at most its result
+        return reject(err, offset, "unbalanced stack at OP_RETURN");
+    } else if (op == OP_RETURN && chunk->arity >= 0 && depth < 1) {
+        return reject(err, offset, "function returns without a value");
+    }
+    return true;
+}
+
+// records the depth a path reaches target with, it has to match every other path's
+static bool reach(int *depths, int *pending, int *num_pending, int target, int depth,
+                  FILE *err) {
+    if (depths[target] < 0) {
+        depths[target] = depth;
+        pending[(*num_pending)++] = target;
+    } else if (depths[target] != depth) {
+        return reject(err, target, "stack depth differs between paths");
+    }
+    return true;
+}
+
+static bool check_flow(Chunk_t *chunk, bool *starts, FILE *err) {
+    int *depths = ALLOCATE(int, chunk->count);
+    int *pending = ALLOCATE(int, chunk->count);
+    for (int i = 0; i < chunk->count; i++) {
+        depths[i] = -1;
+    }
+    int num_pending = 0;
+    // a function starts with its arguments on the stack
+    int entry_depth = chunk->arity > 0 ? chunk->arity : 0;
+    bool ok = entry_depth <= chunk->max_stack || reject(err, 0, "arguments don't fit in max_stack");
+    ok = ok && reach(depths, pending, &num_pending, 0, entry_depth, err);
+    while (ok && num_pending > 0) {
+        int offset = pending[--num_pending];
+        uint8_t op = chunk->code[offset];
+        ok = check_effect(chunk, offset, depths[offset], err);
+        int depth =
+            depths[offset] - instruction_pops(&chunk->code[offset]) + op_info[op].pushes;
+
+        // a backward jump past the start also comes out negative, so ask the op, not the target
+        if (ok && op_info[op].jump != 0) {
+            int target = jump_target(chunk, offset);
+            if (target < 0 || target >= chunk->count || !starts[target]) {
+                ok = reject(err, offset, "jump doesn't land on an instruction");
+            } else {
+                ok = reach(depths, pending, &num_pending, target,
+                           jump_depth(op, depths[offset]), err);
+            }
+        }
+        if (ok && !ends_block(op)) {
+            int next = offset + instruction_length(&chunk->code[offset]);
+            ok = reach(depths, pending, &num_pending, next, depth, err);
+        }
+    }
+    free(depths);
+    free(pending);
+    return ok;
+}
+
+bool verify_chunk(Chunk_t *chunk, FILE *err) {
+    if (__atomic_load_n(&chunk->verified, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+
+    // decode everything first so jumps can be checked against instruction starts
+    bool *starts = calloc(chunk->count + 1, sizeof(bool));
+    int offset = 0;
+    uint8_t last = OP_COUNT;
+    while (offset < chunk->count) {
+        int length = check_instruction(chunk, offset, err);
+        if (length == 0) {
+            free(starts);
+            return false;
+        }
+        starts[offset] = true;
+        last = chunk->code[offset];
+        offset += length;
+    }
+    if (last == OP_COUNT || !ends_block(last)) {
+        free(starts);
+        return reject(err, offset, "control runs off the end of the code");
+    }
+
+    bool ok = check_flow(chunk, starts, err);
+    free(starts);
+    for (int i = 0; ok && i < chunk->constants.count; i++) {
+        Value_t value = chunk->constants.values[i];
+        if (IS_FUNC(value)) {
+            Chunk_t *function_chunk = &GET_FUNC_VAL(value)->chunk;
+            ok = function_chunk->arity >= 0 && verify_chunk(function_chunk, err);
+        }
+    }
+    if (ok) {
+        __atomic_store_n(&chunk->verified, true, __ATOMIC_RELEASE);
+    }
+    return ok;
+}
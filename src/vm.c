@@ -1,75 +1,269 @@
+#define _DEFAULT_SOURCE
+
 #include "../includes/vm.h"
 #include "../includes/debug.h"
+#include "../includes/image.h"
+#include "../includes/jit.h"
 #include "../includes/memory.h"
 #include "../includes/object.h"
+#include "../includes/verifier.h"
 
+#include <setjmp.h>
 #include <stdarg.h>
+#include <time.h>
 
-static Value_t peek(int offset);
-static void throw_runtime_error(const char *format, ...);
+static Value_t peek(vm_t *vm, int offset);
 
 #define BINARY_OP(type, op)                                                                        \
-    if (!IS_NUM_VAL(peek(0)) || !IS_NUM_VAL(peek(1))) {                                            \
-        throw_runtime_error("Operands are not numbers");                                           \
+    if (!IS_NUMBER_VAL(peek(vm, 0)) || !IS_NUMBER_VAL(peek(vm, 1))) {                              \
+        throw_runtime_error(vm, "Operands are not numbers");                                       \
         return INTERPRET_RUNTIME_ERROR;                                                            \
     }                                                                                              \
-    double b = GET_NUM_VAL(pop());                                                                 \
-    double a = GET_NUM_VAL(pop());                                                                 \
-    push(type(a op b));
+    Value_t right = pop(vm);                                                                       \
+    Value_t left = pop(vm);                                                                        \
+    double b = GET_NUMBER_VAL(right);                                                              \
+    double a = GET_NUMBER_VAL(left);                                                               \
+    push(vm, type(a op b));
+
+// two ints stay ints unless int_op (__builtin_*_overflow style: true when the result doesn't fit)
+// says otherwise, then they fall through to the double op like every other pair of numbers
+#define ARITH_OP(int_op, op)                                                                       \
+    if (IS_INT_VAL(peek(vm, 0)) && IS_INT_VAL(peek(vm, 1))) {                                      \
+        int64_t result;                                                                            \
+        if (!int_op(GET_INT_VAL(peek(vm, 1)), GET_INT_VAL(peek(vm, 0)), &result)) {                \
+            vm->stack_top--;                                                                       \
+            vm->stack_top[-1] = DECL_INT_VAL(result);                                              \
+            break;                                                                                 \
+        }                                                                                          \
+    }                                                                                              \
+    BINARY_OP(DECL_NUM_VAL, op)
+
+// ints compare exactly, not through doubles. pops both operands and leaves the outcome in result
+#define COMPARE_VALUES(op, result)                                                                 \
+    if (IS_INT_VAL(peek(vm, 0)) && IS_INT_VAL(peek(vm, 1))) {                                      \
+        result = GET_INT_VAL(peek(vm, 1)) op GET_INT_VAL(peek(vm, 0));                             \
+    } else if (IS_NUMBER_VAL(peek(vm, 0)) && IS_NUMBER_VAL(peek(vm, 1))) {                         \
+        result = GET_NUMBER_VAL(peek(vm, 1)) op GET_NUMBER_VAL(peek(vm, 0));                       \
+    } else {                                                                                       \
+        throw_runtime_error(vm, "Operands are not numbers");                                       \
+        return INTERPRET_RUNTIME_ERROR;                                                            \
+    }                                                                                              \
+    vm->stack_top -= 2;
+
+#define COMPARE_OP(op)                                                                             \
+    bool result;                                                                                   \
+    COMPARE_VALUES(op, result)                                                                     \
+    push(vm, DECL_BOOL_VAL(result));
+
+// compare and branch in one instruction: jumps when the comparison comes out as taken. the
+// distance is read after comparing so an error reports the line of the comparison
+#define COMPARE_JUMP(op, taken)                                                                    \
+    bool result;                                                                                   \
+    COMPARE_VALUES(op, result)                                                                     \
+    int distance = read_jump(&vm->pc);                                                             \
+    if (result == taken) {                                                                         \
+        vm->pc += distance;                                                                        \
+    }
+
+void init_vm(vm_t *vm) {
+    init_value_stack(&vm->stack);
+    vm->stack_top = vm->stack.values;
+    vm->stack_base = vm->stack.values;
+    vm->frames = ALLOCATE(CallFrame_t, FRAMES_MAX);
+    vm->frame_count = 0;
+    vm->base_frame = 0;
+    vm->objects = NULL;
+    vm->shared_strings = NULL;
+    vm->use_jit = false;
+    vm->optimize = false;
+    vm->global_cache = NULL;
+    vm->global_cache_capacity = 0;
+    vm->stats = (VmStats_t){0};
+    vm->time_phases = false;
+    vm->profile = NULL;
+    vm->trace = NULL;
+    vm->listing = NULL;
+    vm->image = NULL;
+    vm->image_size = 0;
+    init_writer(&vm->out, stdout, FLUSH_SIZE);
+    vm->err = stderr;
+    init_hash_table(&vm->strings);
+    init_hash_table(&vm->globals);
+    vm->globals.max_tombstone_ratio = GLOBALS_MAX_TOMBSTONE_RATIO;
+}
+
+void free_vm(vm_t *vm) {
+    free_objects(vm);
+    free_hash_table(&vm->strings);
+    free_hash_table(&vm->globals);
+    unmap_image(vm); // after the tables, strings may still point into it until then
+    free(vm->global_cache);
+    vm->global_cache = NULL;
+    vm->global_cache_capacity = 0;
+    free_value_stack(&vm->stack);
+    free(vm->frames);
+    vm->frames = NULL;
+    free_writer(&vm->out);
+}
+
+// whatever is buffered for the old stream is written out first. embedders that print to the
+// same stream themselves should flush_writer(&vm->out) before they do
+void set_output(vm_t *vm, FILE *fp, FlushMode_t mode) {
+    flush_writer(&vm->out);
+    vm->out.fp = fp;
+    vm->out.mode = mode;
+}
+
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static double per_second(uint64_t count, uint64_t ns) {
+    return ns == 0 ? 0.0 : count * 1e9 / ns;
+}
 
-vm_t vm;
+void dump_stats(vm_t *vm, FILE *fp) {
+    VmStats_t *stats = &vm->stats;
+    if (vm->time_phases) {
+        // the scanner runs inside the compiler, so parse + codegen is what's left of the compile
+        uint64_t codegen_ns =
+            stats->compile_ns > stats->scan_ns ? stats->compile_ns - stats->scan_ns : 0;
+        fprintf(fp, "scan: %.3f ms, %llu tokens (%.0f tokens/s)\n", stats->scan_ns / 1e6,
+                (unsigned long long)stats->tokens, per_second(stats->tokens, stats->scan_ns));
+        fprintf(fp, "parse + codegen: %.3f ms, %llu bytes emitted (%.0f bytes/s)\n",
+                codegen_ns / 1e6, (unsigned long long)stats->bytes_emitted,
+                per_second(stats->bytes_emitted, codegen_ns));
+        fprintf(fp, "run: %.3f ms\n", stats->run_ns / 1e6);
+    }
+    uint64_t interned = stats->intern_hits + stats->intern_misses;
+    fprintf(fp, "interning: %llu hits, %llu misses (%.1f%% hit rate)\n",
+            (unsigned long long)stats->intern_hits, (unsigned long long)stats->intern_misses,
+            interned == 0 ? 0.0 : 100.0 * stats->intern_hits / interned);
+    dump_table_stats("strings", &vm->strings, fp);
+    dump_table_stats("globals", &vm->globals, fp);
+    uint64_t lookups = stats->global_hits + stats->global_misses;
+    fprintf(fp, "global cache: %llu hits, %llu misses (%.1f%% hit rate)\n",
+            (unsigned long long)stats->global_hits, (unsigned long long)stats->global_misses,
+            lookups == 0 ? 0.0 : 100.0 * stats->global_hits / lookups);
+}
+
+// compile() / compile_with_result(), timed when time_phases is set. tokens are produced on demand
+// by the parser, and a clock read per token would cost more than scanning it, so scanning is
+// timed by a scan only pass over the same source beforehand
+static bool timed_compile(vm_t *vm, const char *code, Chunk_t *chunk, bool with_result) {
+    if (!vm->time_phases) {
+        return with_result ? compile_with_result(vm, code, chunk) : compile(vm, code, chunk);
+    }
 
-void init_vm() {
-    vm.stack_top = vm.stack;
-    vm.objects = NULL;
-    init_hash_table(&vm.strings);
-    init_hash_table(&vm.globals);
+    uint64_t start = now_ns();
+    Scanner_t scanner;
+    init_scanner(&scanner, code);
+    uint64_t tokens = 0;
+    do {
+        tokens++;
+    } while (scan_token(&scanner).type != TOKEN_END_FILE);
+    vm->stats.tokens += tokens;
+    vm->stats.scan_ns += now_ns() - start;
+
+    start = now_ns();
+    bool compiled = with_result ? compile_with_result(vm, code, chunk) : compile(vm, code, chunk);
+    vm->stats.compile_ns += now_ns() - start;
+    vm->stats.bytes_emitted += chunk->count;
+    return compiled;
+}
+
+// the store below is what faults on the guard page. the fence (no instructions, it only stops the
+// compiler from sinking stores past it) makes sure pc and the frames are in vm by then
+void push(vm_t *vm, Value_t value) {
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    *vm->stack_top = value;
+    vm->stack_top++;
 }
 
-void free_vm() {
-    free_objects();
-    free_hash_table(&vm.strings);
-    free_hash_table(&vm.globals);
+Value_t pop(vm_t *vm) {
+    vm->stack_top--;
+    return *vm->stack_top;
 }
 
-void push(Value_t value) {
-    *vm.stack_top = value;
-    vm.stack_top++;
+static Value_t peek(vm_t *vm, int offset) {
+    return vm->stack_top[-1 - offset];
 }
 
-Value_t pop() {
-    vm.stack_top--;
-    return *vm.stack_top;
+static void reset_stack(vm_t *vm) {
+    vm->stack_top = vm->stack.values;
+    vm->stack_base = vm->stack.values;
+    vm->frame_count = 0;
 }
 
-static Value_t peek(int offset) {
-    return vm.stack_top[-1 - offset];
+// readies a vm for another script without paying for init_vm() and define_natives() again, see
+// run_batch(). objects allocated since mark (vm->objects after the natives were defined) are
+// freed, globals go back to just the natives and the stack and stats start over. output is only
+// flushed, the caller points it at the next script's stream
+void reset_vm(vm_t *vm, Object_t *mark) {
+    flush_writer(&vm->out);
+    free_objects_since(vm, mark);
+
+    // global cache entries are keyed by literals, which can outlive the script in a shared intern
+    // table, so the fresh table carries on the version and every entry misses
+    uint32_t version = vm->globals.version;
+    free_hash_table(&vm->globals);
+    init_hash_table(&vm->globals);
+    vm->globals.max_tombstone_ratio = GLOBALS_MAX_TOMBSTONE_RATIO;
+    vm->globals.version = version + 1;
+    free_hash_table(&vm->strings);
+    init_hash_table(&vm->strings);
+    for (Object_t *object = mark; object != NULL; object = object->next) {
+        if (object->type == OBJ_NATIVE) {
+            ObjectNative_t *native = (ObjectNative_t *)object;
+            insert(&vm->globals, native->name, DECL_OBJ_VAL(native));
+        } else if (object->type == OBJ_STR) {
+            insert(&vm->strings, (ObjectStr_t *)object, DECL_NONE_VAL);
+        }
+    }
+
+    reset_stack(vm);
+    vm->stats = (VmStats_t){0};
 }
 
-static void reset_stack() {
-    vm.stack_top = vm.stack;
+#define TRACE_MAX_CALLS 16 // calls listed when a runtime error happens inside a deep recursion
+
+// a function's frame has the function right below its stack_base, the script's has nothing
+static void report_frame(vm_t *vm, Chunk_t *chunk, uint8_t *pc, Value_t *stack_base,
+                         bool in_function) {
+    int line = get_line(chunk->line_runs, (pc - chunk->code) - 1);
+    if (in_function) {
+        fprintf(vm->err, "[line %d] in %s()\n", line, GET_FUNC_VAL(stack_base[-1])->name->chars);
+    } else {
+        fprintf(vm->err, "[line %d] in program\n", line);
+    }
 }
 
-static void throw_runtime_error(const char *format, ...) {
+void throw_runtime_error(vm_t *vm, const char *format, ...) {
+    flush_writer(&vm->out); // keeps the error after the output that came before it
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm->err, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm->err);
 
-    size_t offset = (vm.pc - vm.chunk->code) - 1;
-    int line = get_line(vm.chunk->line_runs, offset);
-    fprintf(stderr, "[line %d] in program\n", line);
-    reset_stack();
-}
-
-static bool is_falsey(Value_t value) {
-    return IS_NONE_VAL(value) || (IS_BOOL_VAL(value) && GET_BOOL_VAL(value) == false);
+    // innermost call first, the saved frames hold the pc each caller resumes at
+    report_frame(vm, vm->chunk, vm->pc, vm->stack_base, vm->frame_count > 0);
+    for (int i = vm->frame_count - 1; i >= 0; i--) {
+        if (vm->frame_count - i == TRACE_MAX_CALLS && i > 0) {
+            fprintf(vm->err, "[... %d more calls]\n", i);
+            i = 0;
+        }
+        CallFrame_t *frame = &vm->frames[i];
+        report_frame(vm, frame->chunk, frame->pc, frame->stack_base, i > 0);
+    }
+    reset_stack(vm);
 }
 
-static void concatenate() {
-    ObjectStr_t *b = GET_STR_VAL(pop());
-    ObjectStr_t *a = GET_STR_VAL(pop());
+static void concatenate(vm_t *vm) {
+    ObjectStr_t *b = GET_STR_VAL(pop(vm));
+    ObjectStr_t *a = GET_STR_VAL(pop(vm));
 
     int new_length = a->length + b->length;
     char *new_str = ALLOCATE(char, new_length + 1);
@@ -77,190 +271,447 @@ static void concatenate() {
     memcpy(new_str + a->length, b->chars, b->length);
     new_str[new_length] = '\0';
 
-    ObjectStr_t *res = allocate_str(new_str, new_length);
-    push(DECL_OBJ_VAL(res));
+    ObjectStr_t *res = allocate_runtime_str(vm, new_str, new_length);
+    free(new_str);
+    push(vm, DECL_OBJ_VAL(res));
+}
+
+// inline cache for globals: one entry per constant slot of the running chunk, so every access
+// site naming the same global shares an entry. an entry stays good while it is for the same name
+// and the table hasn't been resized or had a key dropped since, then a hit is two compares. the
+// chunks of one compile (the script and its functions) get disjoint entries through cache_base
+Node_t *lookup_global(vm_t *vm, int idx) {
+    ObjectStr_t *name = GET_STR_VAL(vm->chunk->constants.values[idx]);
+    GlobalCache_t *entry = &vm->global_cache[vm->chunk->cache_base + idx];
+    if (entry->key == name && entry->version == vm->globals.version) {
+        vm->stats.global_hits++;
+        return entry->node;
+    }
+
+    vm->stats.global_misses++;
+    Node_t *node = get_node(&vm->globals, name);
+    if (node != NULL) {
+        *entry = (GlobalCache_t){.key = name, .node = node, .version = vm->globals.version};
+    }
+    return node;
+}
+
+// entries are checked against their key so they survive switching chunks, the cache only grows
+static void reserve_global_cache(vm_t *vm, Chunk_t *chunk) {
+    int needed = chunk->cache_base + chunk->constants.count;
+    if (needed <= vm->global_cache_capacity) {
+        return;
+    }
+    vm->global_cache = resize(vm->global_cache, sizeof(GlobalCache_t), needed);
+    for (int i = vm->global_cache_capacity; i < needed; i++) {
+        vm->global_cache[i] = (GlobalCache_t){.key = NULL, .node = NULL, .version = 0};
+    }
+    vm->global_cache_capacity = needed;
+}
+
+// false after reporting a runtime error
+static bool get_global(vm_t *vm, int idx) {
+    Node_t *node = lookup_global(vm, idx);
+    if (node == NULL) {
+        throw_runtime_error(vm, "This variable has not been defined '%s'",
+                            GET_STR_VAL(vm->chunk->constants.values[idx])->chars);
+        return false;
+    }
+    push(vm, node->value);
+    return true;
+}
+
+static bool set_global(vm_t *vm, int idx) {
+    Node_t *node = lookup_global(vm, idx);
+    if (node == NULL) {
+        throw_runtime_error(vm, "Undefined variable name '%s' LET's define it!",
+                            GET_STR_VAL(vm->chunk->constants.values[idx])->chars);
+        return false;
+    }
+    node->value = peek(vm, 0);
+    return true;
+}
+
+// generic add, false after reporting a runtime error
+static bool add(vm_t *vm) {
+    if (IS_STR(peek(vm, 0)) && IS_STR(peek(vm, 1))) {
+        concatenate(vm);
+    } else if (IS_NUMBER_VAL(peek(vm, 0)) && IS_NUMBER_VAL(peek(vm, 1))) {
+        Value_t b = pop(vm);
+        Value_t a = pop(vm);
+        push(vm, add_numbers(a, b));
+    } else {
+        throw_runtime_error(vm, "Operands are not both strings or both numbers");
+        return false;
+    }
+    return true;
+}
+
+// ------------------------ Calls ------------------------ //
+
+// points the registers at function's code, with its arguments (already in place) starting at args
+static inline bool enter_function(vm_t *vm, ObjectFunc_t *function, Value_t *args) {
+    Chunk_t *chunk = &function->chunk;
+    size_t needed = (args - vm->stack.values) + chunk->max_stack;
+    if (needed > vm->stack.committed && !commit_value_stack(&vm->stack, needed)) {
+        throw_runtime_error(vm, "Stack overflow: %s needs %d stack slots", function->name->chars,
+                            chunk->max_stack);
+        return false;
+    }
+    reserve_global_cache(vm, chunk);
+    vm->chunk = chunk;
+    vm->pc = chunk->code;
+    vm->stack_base = args;
+    return true;
+}
+
+static void wrong_arg_count(vm_t *vm, ObjectStr_t *name, int arity, int argc) {
+    throw_runtime_error(vm, "%s() takes %d arguments but got %d", name->chars, arity, argc);
+}
+
+// natives run right on the caller's stack: they read the arguments where they are and the
+// result replaces the callee, no frame is pushed
+static bool call_native(vm_t *vm, ObjectNative_t *native, int argc) {
+    if (native->arity >= 0 && native->arity != argc) {
+        wrong_arg_count(vm, native->name, native->arity, argc);
+        return false;
+    }
+    Value_t *args = vm->stack_top - argc;
+    if (!native->function(vm, argc, args, &args[-1])) {
+        return false;
+    }
+    vm->stack_top = args;
+    return true;
+}
+
+// OP_CALL / OP_TAIL_CALL on anything but a function taking argc arguments: a native, or an error
+static bool slow_call(vm_t *vm, Value_t callee, int argc) {
+    if (IS_NATIVE(callee)) {
+        return call_native(vm, GET_NATIVE_VAL(callee), argc);
+    } else if (IS_FUNC(callee)) {
+        ObjectFunc_t *function = GET_FUNC_VAL(callee);
+        wrong_arg_count(vm, function->name, function->chunk.arity, argc);
+    } else {
+        throw_runtime_error(vm, "Can only call functions");
+    }
+    return false;
+}
+
+// the calls that push a frame, anything else goes through slow_call()
+static inline bool takes_args(Value_t callee, int argc) {
+    return IS_FUNC(callee) && GET_FUNC_VAL(callee)->chunk.arity == argc;
+}
+
+// the callee and its arguments are the top argc + 1 values, they become the new frame as they are
+static inline bool call_value(vm_t *vm, int argc) {
+    Value_t callee = vm->stack_top[-1 - argc];
+    if (!takes_args(callee, argc)) {
+        return slow_call(vm, callee, argc);
+    }
+    if (vm->frame_count == FRAMES_MAX) {
+        throw_runtime_error(vm, "Stack overflow: more than %d nested calls", FRAMES_MAX);
+        return false;
+    }
+    CallFrame_t *frame = &vm->frames[vm->frame_count];
+    *frame = (CallFrame_t){.chunk = vm->chunk, .pc = vm->pc, .stack_base = vm->stack_base};
+    if (!enter_function(vm, GET_FUNC_VAL(callee), vm->stack_top - argc)) {
+        return false;
+    }
+    vm->frame_count++;
+    return true;
+}
+
+// the result replaces the callee, everything above it goes
+static inline void return_from_call(vm_t *vm) {
+    Value_t result = vm->stack_top[-1];
+    vm->stack_top = vm->stack_base;
+    vm->stack_top[-1] = result;
+    CallFrame_t *frame = &vm->frames[--vm->frame_count];
+    vm->chunk = frame->chunk;
+    vm->pc = frame->pc;
+    vm->stack_base = frame->stack_base;
+}
+
+// a call in tail position of a function taking argc arguments (see takes_args()): the callee and
+// its arguments slide down over the current frame's, so recursion through tail calls runs in
+// constant space
+static inline bool tail_call_value(vm_t *vm, int argc) {
+    Value_t callee = vm->stack_top[-1 - argc];
+    Value_t *moved = vm->stack_top - argc - 1;
+    if (!enter_function(vm, GET_FUNC_VAL(callee), vm->stack_base)) {
+        return false;
+    }
+    memmove(vm->stack_base - 1, moved, (argc + 1) * sizeof(Value_t));
+    vm->stack_top = vm->stack_base + argc;
+    return true;
+}
+
+// quickening patches the opcode byte in place. a program's chunk can be run by several vms at
+// once; a single byte store is atomic and every variant of an op decodes the same operands, so
+// another thread sees either the old or the new op and both are correct
+static void rewrite_op(uint8_t *op, OpCode_t opcode) {
+    __atomic_store_n(op, (uint8_t)opcode, __ATOMIC_RELAXED);
+}
+
+// --trace / --profile hook, called before every instruction run_instrumented() executes
+static void instrument(vm_t *vm) {
+    int offset = (int)(vm->pc - vm->chunk->code);
+    if (vm->trace != NULL) {
+        write_str(vm->trace, "       ");
+        for (Value_t *idx = vm->stack.values; idx < vm->stack_top; idx++) {
+            write_str(vm->trace, "[ ");
+            write_value(vm->trace, *idx);
+            write_str(vm->trace, " ]");
+        }
+        write_str(vm->trace, "\n");
+        disassemble_instruction(vm->trace, vm->chunk, offset);
+    }
+    if (vm->profile != NULL) {
+        profile_step(vm->profile, vm->chunk, *vm->pc, offset);
+    }
+}
+
+static bool instrumented(vm_t *vm) {
+    return vm->trace != NULL || vm->profile != NULL;
+}
+
+static bool call_natively(vm_t *vm);
+
+#include "../includes/run_loop.h"
+#define RUN_INSTRUMENTED
+#include "../includes/run_loop.h"
+#undef RUN_INSTRUMENTED
+
+// ------------------------ Native calls ------------------------ //
+
+// native code is only worth it for code that keeps getting run. exactly one run sees the counter
+// hit the threshold so the chunk is compiled once even if vms share it across threads; the
+// counter stops there
+static JitCode_t *hot_jit_code(Chunk_t *chunk, int *runs, JitCode_t **jit_code) {
+    JitCode_t *code = __atomic_load_n(jit_code, __ATOMIC_ACQUIRE);
+    if (code != NULL || __atomic_load_n(runs, __ATOMIC_RELAXED) >= JIT_HOT_THRESHOLD) {
+        return code;
+    }
+    if (__atomic_add_fetch(runs, 1, __ATOMIC_RELAXED) == JIT_HOT_THRESHOLD) {
+        code = jit_compile(chunk);
+        __atomic_store_n(jit_code, code, __ATOMIC_RELEASE);
+    }
+    return code;
+}
+
+// a function's frame has it right below its stack_base
+static JitCode_t *frame_jit_code(vm_t *vm) {
+    ObjectFunc_t *function = GET_FUNC_VAL(vm->stack_base[-1]);
+    return hot_jit_code(&function->chunk, &function->calls, &function->jit_code);
+}
+
+// runs the frame call_value() just pushed until it returns, leaving the result on top of it. it
+// stays native code through tail calls into other functions with native code; a failed guard, a
+// tail call into a function without or no jit_code to begin with hands the rest of the frame to
+// the interpreter. false after a runtime error
+static bool run_native_frame(vm_t *vm, JitCode_t *jit_code) {
+    int base_frame = vm->base_frame;
+    vm->base_frame = vm->frame_count;
+    JitStatus_t status = jit_code != NULL ? jit_enter(vm, jit_code) : JIT_DEOPT;
+    while (status == JIT_TAIL_CALL) {
+        jit_code = frame_jit_code(vm);
+        status = jit_code != NULL ? jit_enter(vm, jit_code) : JIT_DEOPT;
+    }
+    bool ok = status == JIT_DONE || (status == JIT_DEOPT && run(vm) == INTERPRET_OK);
+    vm->base_frame = base_frame;
+    return ok;
+}
+
+// OP_CALL of the interpreter just pushed a frame: hot functions run natively right away
+static bool call_natively(vm_t *vm) {
+    JitCode_t *jit_code = frame_jit_code(vm);
+    if (jit_code == NULL) {
+        return true; // the interpreter goes on with the frame
+    }
+    if (!run_native_frame(vm, jit_code)) {
+        return false;
+    }
+    return_from_call(vm);
+    return true;
+}
+
+bool call_from_native(vm_t *vm, int argc) {
+    int frames = vm->frame_count;
+    if (!call_value(vm, argc)) {
+        return false;
+    } else if (vm->frame_count == frames) {
+        return true; // a native, its result is in place already
+    }
+    if (!run_native_frame(vm, frame_jit_code(vm))) {
+        return false;
+    }
+    return_from_call(vm);
+    return true;
 }
 
-static InterpretResult_t run() {
-    while (true) {
+JitStatus_t tail_call_from_native(vm_t *vm, int argc) {
+    Value_t callee = vm->stack_top[-1 - argc];
+    if (takes_args(callee, argc)) {
+        return tail_call_value(vm, argc) ? JIT_TAIL_CALL : JIT_ERROR;
+    }
+    return slow_call(vm, callee, argc) ? JIT_DONE : JIT_ERROR;
+}
 
-#ifdef DEBUG_TRACE_EXECUTION
-        printf(("       "));
-        for (Value_t *idx = vm.stack; idx < vm.stack_top; idx++) {
-            printf("[ ");
-            print_value(*idx);
-            printf(" ]");
+static InterpretResult_t enter(vm_t *vm, JitCode_t *jit_code) {
+    if (jit_code != NULL) {
+        JitStatus_t status = jit_enter(vm, jit_code);
+        if (status == JIT_DONE) {
+            return INTERPRET_OK;
+        } else if (status == JIT_ERROR) {
+            return INTERPRET_RUNTIME_ERROR;
         }
-        printf("\n");
-        disassemble_instruction(vm.chunk, (int)(vm.pc - vm.chunk->code));
-#endif
-
-        uint8_t instruction;
-        switch (instruction = *vm.pc++) {
-            case OP_CONSTANT: {
-                Value_t constant = vm.chunk->constants.values[*(vm.pc++)];
-                push(constant);
-                break;
-            }
-            case OP_CONSTANT_LONG: {
-                int idx = (vm.pc[0]) | (vm.pc[1] << 8) | (vm.pc[2] << 16);
-                vm.pc += 3;
-                Value_t constant = vm.chunk->constants.values[idx];
-                push(constant);
-                break;
-            }
-            case OP_NONE: {
-                push(DECL_NONE_VAL);
-                break;
-            }
-            case OP_TRUE: {
-                push(DECL_BOOL_VAL(true));
-                break;
-            }
-            case OP_FALSE: {
-                push(DECL_BOOL_VAL(false));
-                break;
-            }
-            case OP_EQUAL: {
-                Value_t b = pop();
-                Value_t a = pop();
-                push(DECL_BOOL_VAL(equals(a, b)));
-                break;
-            }
-            case OP_GREATER_THAN: {
-                BINARY_OP(DECL_BOOL_VAL, >);
-                break;
-            }
-            case OP_LESS_THAN: {
-                BINARY_OP(DECL_BOOL_VAL, <);
-                break;
-            }
-            case OP_NOT: {
-                push(DECL_BOOL_VAL(is_falsey(pop())));
-                break;
-            }
-            case OP_ADD: {
-                if (IS_STR(peek(0)) && IS_STR(peek(1))) {
-                    concatenate();
-                } else if (IS_NUM_VAL(peek(0)) && IS_NUM_VAL(peek(1))) {
-                    BINARY_OP(DECL_NUM_VAL, +);
-                } else {
-                    throw_runtime_error("Operands are not both strings or both numbers");
-                }
-                break;
-            }
-            case OP_SUB: {
-                BINARY_OP(DECL_NUM_VAL, -);
-                break;
-            }
-            case OP_MUL: {
-                BINARY_OP(DECL_NUM_VAL, *);
-                break;
-            }
-            case OP_DIV: {
-                BINARY_OP(DECL_NUM_VAL, /);
-                break;
-            }
-            case OP_NEGATE: {
-                if (!IS_NUM_VAL(peek(0))) {
-                    throw_runtime_error("Operand is not a number ");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(DECL_NUM_VAL(-GET_NUM_VAL(pop())));
-                break;
-            }
-            case OP_PRINT: {
-                print_value(pop());
-                printf("\n");
-                break;
-            }
-            case OP_POP: {
-                pop();
-                break;
-            }
-            case OP_DEFINE_GLOBAL: {
-                ObjectStr_t *global_name = GET_STR_VAL(vm.chunk->constants.values[*vm.pc++]);
-                insert(&vm.globals, global_name, peek(0));
-                pop();
-                break;
-            }
-            case OP_DEFINE_GLOBAL_LONG: {
-                int idx = *vm.pc++;      // last byte
-                idx |= (*vm.pc++ << 8);  // middle byte
-                idx |= (*vm.pc++ << 16); // front byte
-                ObjectStr_t *global_name = GET_STR_VAL(vm.chunk->constants.values[idx]);
-                insert(&vm.globals, global_name, peek(0));
-                pop();
-                break;
-            }
-            case OP_GET_GLOBAL: {
-                ObjectStr_t *global_name = GET_STR_VAL(vm.chunk->constants.values[*vm.pc++]);
-                Value_t *value = get(&vm.globals, global_name);
-                if (value == NULL) {
-                    throw_runtime_error("This variable has not been defined '%s'",
-                                        global_name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(*value);
-                break;
-            }
-            case OP_GET_GLOBAL_LONG: {
-                int idx = *vm.pc++;      // last byte
-                idx |= (*vm.pc++ << 8);  // middle byte
-                idx |= (*vm.pc++ << 16); // front byte
-                ObjectStr_t *global_name = GET_STR_VAL(vm.chunk->constants.values[idx]);
-                Value_t *value = get(&vm.globals, global_name);
-                if (value == NULL) {
-                    throw_runtime_error("This variable has not been defined '%s'",
-                                        global_name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(*value);
-                break;
-            }
-            case OP_SET_GLOBAL: {
-                ObjectStr_t *global_name = GET_STR_VAL(vm.chunk->constants.values[*vm.pc++]);
-                if (insert(&vm.globals, global_name, peek(0))) {
-                    drop(&vm.globals, global_name);
-                    throw_runtime_error("Undefined variable name '%s' LET's define it!",
-                                        global_name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_SET_GLOBAL_LONG: {
-                int idx = *vm.pc++;      // last byte
-                idx |= (*vm.pc++ << 8);  // middle byte
-                idx |= (*vm.pc++ << 16); // front byte
-                ObjectStr_t *global_name = GET_STR_VAL(vm.chunk->constants.values[idx]);
-                if (insert(&vm.globals, global_name, peek(0))) {
-                    drop(&vm.globals, global_name);
-                    throw_runtime_error("Undefined variable name '%s' LET's define it!",
-                                        global_name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_RETURN:
-                return INTERPRET_OK;
+        // deoptimized: pc and stack_top are at the instruction whose type guard failed
+    }
+    return instrumented(vm) ? run_instrumented(vm) : run(vm);
+}
+
+// the stack is committed up to what the compiler worked out the chunk needs, so push / pop stay
+// unchecked. the guard page behind it turns a wrong max_stack (or an embedder pushing too much)
+// into a runtime error instead of memory corruption
+static InterpretResult_t execute(vm_t *vm, Chunk_t *chunk, JitCode_t *jit_code) {
+    if (!verify_chunk(chunk, vm->err)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    vm->chunk = chunk;
+    vm->pc = vm->chunk->code;
+    vm->frame_count = 0;
+    vm->base_frame = 0;
+    reserve_global_cache(vm, chunk);
+
+    vm->stack_base = vm->stack_top;
+    size_t in_use = vm->stack_top - vm->stack.values;
+    if (!commit_value_stack(&vm->stack, in_use + chunk->max_stack)) {
+        vm->pc++; // errors report the line of the instruction before pc
+        throw_runtime_error(vm, "Stack overflow: expression needs %d stack slots", chunk->max_stack);
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    if (instrumented(vm)) {
+        jit_code = NULL; // native code has no per instruction hook, run it in the interpreter
+    }
+    if (vm->profile != NULL) {
+        profile_enter(vm->profile, chunk);
+    }
+
+    sigjmp_buf overflow;
+    StackGuard_t previous = arm_stack_guard(&vm->stack, &overflow);
+    InterpretResult_t result;
+    uint64_t start = vm->time_phases ? now_ns() : 0;
+    if (sigsetjmp(overflow, 0) == 0) {
+        result = enter(vm, jit_code);
+    } else {
+        // pc, chunk and frames are where the faulting push left them, see push()
+        throw_runtime_error(vm, "Stack overflow");
+        result = INTERPRET_RUNTIME_ERROR;
+    }
+    restore_stack_guard(previous);
+    if (vm->time_phases) {
+        vm->stats.run_ns += now_ns() - start;
+    }
+    if (vm->profile != NULL) {
+        profile_exit(vm->profile);
+    }
+    if (vm->trace != NULL) {
+        flush_writer(vm->trace);
+    }
+    return result;
+}
+
+// a script runs once, without a loop every instruction runs once too and compiling it would cost
+// more than it saves. calls don't count, hot functions get their own native code
+static bool has_loop(Chunk_t *chunk) {
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk->code + offset)) {
+        if (chunk->code[offset] == OP_LOOP) {
+            return true;
         }
     }
+    return false;
 }
 
-InterpretResult_t interpret(const char *code) {
+InterpretResult_t interpret(vm_t *vm, const char *code) {
     Chunk_t chunk;
     init_chunk(&chunk);
 
-    if (!compile(code, &chunk)) {
+    if (!timed_compile(vm, code, &chunk, false) || !verify_chunk(&chunk, vm->err)) {
         free_chunk(&chunk);
         return INTERPRET_COMPILE_ERROR;
     }
 
-    vm.chunk = &chunk;
-    vm.pc = vm.chunk->code;
-
-    InterpretResult_t result = run();
+    JitCode_t *jit_code = vm->use_jit && has_loop(&chunk) ? jit_compile(&chunk) : NULL;
+    InterpretResult_t result = execute(vm, &chunk, jit_code);
 
+    jit_free(jit_code);
     free_chunk(&chunk);
     return result;
 }
+
+// params are the names the caller will bind on every run, their order fixes the binding slots
+Program_t *compile_program(vm_t *vm, const char *code, const char **params, int num_params) {
+    Program_t *program = ALLOCATE(Program_t, 1);
+    init_chunk(&program->chunk);
+    if (!timed_compile(vm, code, &program->chunk, true) ||
+        !verify_chunk(&program->chunk, vm->err)) {
+        free_chunk(&program->chunk);
+        free(program);
+        return NULL;
+    }
+
+    program->runs = 0;
+    program->jit_code = NULL;
+    program->num_params = num_params;
+    program->params = ALLOCATE(ObjectStr_t *, num_params);
+    for (int i = 0; i < num_params; i++) {
+        program->params[i] = allocate_str(vm, params[i], (int)strlen(params[i]));
+        if (get_node(&vm->globals, program->params[i]) == NULL) {
+            insert(&vm->globals, program->params[i], DECL_NONE_VAL);
+        }
+    }
+    // every param is defined now, later inserts can only move them by bumping the version
+    program->param_nodes = ALLOCATE(Node_t *, num_params);
+    for (int i = 0; i < num_params; i++) {
+        program->param_nodes[i] = get_node(&vm->globals, program->params[i]);
+    }
+    program->param_table = &vm->globals;
+    program->param_version = vm->globals.version;
+    return program;
+}
+
+// bindings holds one value per param slot. on the compiling vm, while its globals haven't moved,
+// they are stored straight into the nodes compile_program() found. other vms (and a table that
+// has since resized or dropped a key) fall back to inserting by the interned names
+InterpretResult_t run_program(vm_t *vm, Program_t *program, const Value_t *bindings,
+                              Value_t *result) {
+    if (program->param_table == &vm->globals && program->param_version == vm->globals.version) {
+        for (int i = 0; i < program->num_params; i++) {
+            program->param_nodes[i]->value = bindings[i];
+        }
+    } else {
+        for (int i = 0; i < program->num_params; i++) {
+            insert(&vm->globals, program->params[i], bindings[i]);
+        }
+    }
+
+    reset_stack(vm);
+    JitCode_t *jit_code =
+        vm->use_jit ? hot_jit_code(&program->chunk, &program->runs, &program->jit_code) : NULL;
+    InterpretResult_t status = execute(vm, &program->chunk, jit_code);
+    if (result != NULL) {
+        bool returned = status == INTERPRET_OK && vm->stack_top > vm->stack.values;
+        *result = returned ? peek(vm, 0) : DECL_NONE_VAL;
+    }
+    reset_stack(vm);
+    return status;
+}
+
+void free_program(Program_t *program) {
+    jit_free(program->jit_code);
+    free_chunk(&program->chunk);
+    free(program->params);
+    free(program->param_nodes);
+    free(program);
+}
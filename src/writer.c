@@ -0,0 +1,88 @@
+#include "../includes/writer.h"
+#include "../includes/memory.h"
+
+#include <stdarg.h>
+
+void init_writer(Writer_t *writer, FILE *fp, FlushMode_t mode) {
+    writer->fp = fp;
+    writer->data = ALLOCATE(char, WRITER_CAPACITY);
+    writer->count = 0;
+    writer->capacity = WRITER_CAPACITY;
+    writer->mode = mode;
+}
+
+// flushes whatever is still buffered
+void free_writer(Writer_t *writer) {
+    flush_writer(writer);
+    free(writer->data);
+    writer->data = NULL;
+}
+
+void flush_writer(Writer_t *writer) {
+    if (writer->count > 0) {
+        fwrite(writer->data, 1, writer->count, writer->fp);
+        writer->count = 0;
+    }
+    fflush(writer->fp);
+}
+
+// FLUSH_EXIT keeps everything, the other modes write out a full buffer
+static void make_room(Writer_t *writer, int length) {
+    if (writer->mode == FLUSH_EXIT) {
+        while (writer->count + length > writer->capacity) {
+            writer->capacity *= 2;
+        }
+        writer->data = resize(writer->data, sizeof(char), writer->capacity);
+    } else {
+        flush_writer(writer);
+    }
+}
+
+void write_bytes(Writer_t *writer, const char *bytes, int length) {
+    if (writer->count + length > writer->capacity) {
+        make_room(writer, length);
+        if (writer->count + length > writer->capacity) {
+            fwrite(bytes, 1, length, writer->fp);
+            return;
+        }
+    }
+    memcpy(writer->data + writer->count, bytes, length);
+    writer->count += length;
+}
+
+void write_str(Writer_t *writer, const char *str) {
+    write_bytes(writer, str, (int)strlen(str));
+}
+
+// formats straight into the buffer, only falls back to a temporary for output that doesn't fit
+void write_format(Writer_t *writer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int room = writer->capacity - writer->count;
+    int length = vsnprintf(writer->data + writer->count, room, format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    if (length < room) {
+        writer->count += length;
+        return;
+    }
+
+    char *formatted = ALLOCATE(char, length + 1);
+    va_start(args, format);
+    vsnprintf(formatted, length + 1, format, args);
+    va_end(args);
+    write_bytes(writer, formatted, length);
+    free(formatted);
+}
+
+void end_line(Writer_t *writer) {
+    if (writer->count == writer->capacity) {
+        make_room(writer, 1);
+    }
+    writer->data[writer->count++] = '\n';
+    if (writer->mode == FLUSH_LINE) {
+        flush_writer(writer);
+    }
+}